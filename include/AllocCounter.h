@@ -0,0 +1,70 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+// Enables counting of the heap allocations in a measurement build. The build must also wrap the allocation functions:
+// -D ALLOC_STATS -Wl,--wrap=malloc -Wl,--wrap=calloc
+#ifdef ALLOC_STATS
+#define ALLOC_STATS_ENABLED 1
+#else
+#define ALLOC_STATS_ENABLED 0
+#endif
+
+/**
+ * Counts the calls of malloc() and calloc() of all tasks, including those of the precompiled BLE stack, by means of
+ * the linker's symbol wrapping. Without ALLOC_STATS, no function is wrapped and the count stays 0.
+ *
+ * Unlike sampling the free heap, reading the count neither walks the heap nor takes its lock.
+ */
+class AllocCounter
+{
+    public:
+
+        /**
+         * Returns the number of allocations since start. Can be called from any task.
+         */
+        static inline uint32_t getCount()
+        {
+            return count_.load(std::memory_order_relaxed);
+        }
+
+        static constexpr bool isEnabled()
+        {
+            return ALLOC_STATS_ENABLED != 0;
+        }
+
+        /**
+         * Called by the wrappers of the allocation functions.
+         */
+        static inline void count()
+        {
+            count_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+    private:
+
+        static std::atomic<uint32_t> count_;
+};
@@ -0,0 +1,137 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Maps the raw value of a joystick axis onto the full stick axis range (-32767..32767).
+ *
+ * Each half of the axis (raw minimum to center, center to raw maximum) is mapped independently, so the
+ * output reaches full scale in both directions although the center of the joystick unit is usually not in
+ * the middle of its raw range. The extremes of the raw range are learned while the stick is in use: the range is
+ * only widened after kLearnConfirmSamples consecutive samples beyond the current extreme, and only up to the least
+ * extreme of them. Hence corrupted samples or a short glitch cannot shrink the output range permanently.
+ * The center is provided by the center calibration.
+ *
+ * Integer math only. The class does not depend on the Arduino framework.
+ */
+class AxisMapper
+{
+    public:
+
+        // Output value at full deflection
+        static const int16_t kOutputMax = 32767;
+
+        // Minimum distance between the center and each extreme [raw steps]
+        static const uint8_t kMinHalfRange = 16;
+
+        // Number of consecutive samples beyond an extreme that are required to widen the range
+        static const uint8_t kLearnConfirmSamples = 8;
+
+        /**
+         * Creates a mapper with a range of +/- defaultHalfRange around the center.
+         *
+         * @param center Raw center value.
+         *
+         * @param defaultHalfRange Initial distance between the center and each extreme [raw steps].
+         *                         Choose it smaller than the actual range, so that full scale is reachable before learning.
+         *
+         * @param invert True, if the output is inverted, i.e. the raw maximum maps to -kOutputMax.
+         */
+        AxisMapper(uint8_t center, uint8_t defaultHalfRange, bool invert);
+
+        /**
+         * Sets the raw center value. The extremes are moved away, if they are closer than kMinHalfRange.
+         */
+        void setCenter(uint8_t center);
+
+        /**
+         * Sets the raw extremes, e.g. as loaded from non-volatile memory.
+         * The extremes are moved away from the center, if they are closer than kMinHalfRange.
+         */
+        void setRange(uint8_t rawMin, uint8_t rawMax);
+
+        /**
+         * Discards the learned range and restores the range of +/- defaultHalfRange around the current center.
+         */
+        void resetRange(uint8_t defaultHalfRange);
+
+        /**
+         * Extends the range, if the raw value and the kLearnConfirmSamples - 1 previous ones all exceed an extreme.
+         *
+         * @return True, if an extreme has changed.
+         */
+        bool learn(uint8_t raw);
+
+        /**
+         * Maps a raw value onto the stick axis range.
+         */
+        inline int16_t map(uint8_t raw) const
+        {
+            return mapQ8((uint16_t) raw << 8);
+        }
+
+        /**
+         * Maps a raw value with 8 fractional bits onto the stick axis range, e.g. a filtered value.
+         */
+        int16_t mapQ8(uint16_t rawQ8) const;
+
+        inline uint8_t getCenter() const
+        {
+            return center_;
+        }
+
+        inline uint8_t getMin() const
+        {
+            return min_;
+        }
+
+        inline uint8_t getMax() const
+        {
+            return max_;
+        }
+
+    private:
+
+        uint8_t center_;
+
+        uint8_t min_;
+
+        uint8_t max_;
+
+        bool invert_;
+
+        // Number of consecutive samples passed to learn() above the maximum, and the least of them
+        uint8_t highCount_;
+        uint8_t highConfirmed_;
+
+        // Number of consecutive samples passed to learn() below the minimum, and the greatest of them
+        uint8_t lowCount_;
+        uint8_t lowConfirmed_;
+
+        /**
+         * Ensures that both extremes keep a distance of at least kMinHalfRange from the center.
+         */
+        void enforceMinHalfRange();
+};
@@ -0,0 +1,119 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Debouncer for up to 32 buttons that are sampled periodically.
+ *
+ * The sample histories are stored bit-sliced: one word per time step, one bit per button. Thus, the edges
+ * of all buttons are detected at once with a few bitwise operations, i.e. the cost per sample does not depend
+ * on the number of buttons.
+ *
+ * With h0 being the newest sample and h7 the oldest one (bit set = pressed):
+ * - Down: h0 & h1 & h2 & ~h5 & ~h6 & ~h7, i.e. released for 3 samples, then pressed for 3 samples.
+ * - Up:   the inverse pattern.
+ * Samples h3 and h4 are ignored, since the signal may bounce there. After an edge, the histories of the
+ * affected buttons are filled with the new state, so that an edge is reported only once.
+ *
+ * The class does not depend on the Arduino framework.
+ *
+ * @tparam N Number of buttons (1..32). Button i corresponds to bit i of the masks.
+ */
+template <uint8_t N>
+class BitSlicedDebouncer
+{
+    static_assert( (N >= 1) && (N <= 32), "BitSlicedDebouncer supports 1 to 32 buttons" );
+
+    public:
+
+        // Bit mask with one bit per button
+        typedef uint32_t tMask;
+
+        static const uint8_t kHistoryLength = 8;
+
+        // Mask of the bits that correspond to buttons
+        static const tMask kButtonsMask = (N == 32) ? 0xFFFFFFFFu : ( (1u << N) - 1 );
+
+        /**
+         * Adds a sample of all buttons and detects the edges.
+         *
+         * @param sample Bit mask of the buttons that are currently pressed.
+         */
+        void update(tMask sample)
+        {
+            for (uint8_t step = kHistoryLength - 1; step > 0; --step)
+            {
+                history_[step] = history_[step - 1];
+            }
+
+            history_[0] = sample & kButtonsMask;
+
+            down_ =  history_[0] &  history_[1] &  history_[2] & ~history_[5] & ~history_[6] & ~history_[7];
+            up_   = ~history_[0] & ~history_[1] & ~history_[2] &  history_[5] &  history_[6] &  history_[7] & kButtonsMask;
+
+            // Report each edge only once
+            for (uint8_t step = 0; step < kHistoryLength; ++step)
+            {
+                history_[step] = (history_[step] | down_) & ~up_;
+            }
+
+            pressed_ = (pressed_ | down_) & ~up_;
+        }
+
+        /**
+         * Returns the buttons with a "button down" edge in the last sample.
+         */
+        inline tMask getDownEvents() const
+        {
+            return down_;
+        }
+
+        /**
+         * Returns the buttons with a "button up" edge in the last sample.
+         */
+        inline tMask getUpEvents() const
+        {
+            return up_;
+        }
+
+        /**
+         * Returns the debounced state of all buttons.
+         */
+        inline tMask getPressed() const
+        {
+            return pressed_;
+        }
+
+    private:
+
+        // Sample histories, index 0 is the newest sample
+        tMask history_[kHistoryLength] = {0};
+
+        tMask down_ = 0;
+
+        tMask up_ = 0;
+
+        tMask pressed_ = 0;
+};
@@ -0,0 +1,126 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Determines the button states to be sent in each input report from the stream of button edges.
+ *
+ * Each report applies at most one pending edge per button. Thus, every press appears in at least one report
+ * and every release in a later one, even if a tap is shorter than the report period. Pending edges of a button
+ * are limited to kMaxPendingEdges; if a tap arrives while the limit is reached, the oldest pending tap is
+ * coalesced with it (i.e. dropped) and counted, so the reported state cannot lag behind the user arbitrarily.
+ *
+ * The class does not depend on the Arduino framework.
+ *
+ * @tparam N Number of buttons (1..32). Button i corresponds to bit i of the masks.
+ */
+template <uint8_t N>
+class ButtonReportBuilder
+{
+    static_assert( (N >= 1) && (N <= 32), "ButtonReportBuilder supports 1 to 32 buttons" );
+
+    public:
+
+        // Bit mask with one bit per button
+        typedef uint32_t tMask;
+
+        // Maximum number of pending edges per button (two taps)
+        static const uint8_t kMaxPendingEdges = 4;
+
+        /**
+         * Adds an edge of a button. The edges of each button alternate between press and release.
+         */
+        void addEdge(uint8_t btnIdx)
+        {
+            ++pendingEdges_[btnIdx];
+
+            // Removing a press/release pair keeps the final state
+            if (pendingEdges_[btnIdx] > kMaxPendingEdges)
+            {
+                pendingEdges_[btnIdx] -= 2;
+                ++coalescedTapCount_;
+            }
+        }
+
+        /**
+         * Adds edges such that the pending edges lead to the given state, e.g. after edges have been lost.
+         *
+         * @param pressed Bit mask of the buttons that are currently pressed.
+         */
+        void resync(tMask pressed)
+        {
+            for (uint8_t btnIdx = 0; btnIdx < N; ++btnIdx)
+            {
+                bool finalState = ( (reported_ >> btnIdx) ^ pendingEdges_[btnIdx] ) & 1;
+
+                if ( finalState != ((pressed >> btnIdx) & 1) )
+                {
+                    addEdge(btnIdx);
+                }
+            }
+        }
+
+        /**
+         * Applies one pending edge per button and returns the button states for the next report.
+         */
+        tMask build()
+        {
+            for (uint8_t btnIdx = 0; btnIdx < N; ++btnIdx)
+            {
+                if (pendingEdges_[btnIdx] > 0)
+                {
+                    reported_ ^= (tMask) 1 << btnIdx;
+                    --pendingEdges_[btnIdx];
+                }
+            }
+
+            return reported_;
+        }
+
+        /**
+         * Returns the button states of the last built report without applying an edge.
+         */
+        inline tMask getReported() const
+        {
+            return reported_;
+        }
+
+        /**
+         * Returns the number of taps that have been coalesced with a later tap.
+         */
+        inline uint32_t getCoalescedTapCount() const
+        {
+            return coalescedTapCount_;
+        }
+
+    private:
+
+        // Button states of the last built report
+        tMask reported_ = 0;
+
+        uint8_t pendingEdges_[N] = {0};
+
+        uint32_t coalescedTapCount_ = 0;
+};
@@ -0,0 +1,162 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Learns the rest position (center) of a two-axis joystick while the gamepad is in use.
+ *
+ * A rest period is detected when no button is active and the variance of both axes stays below a threshold
+ * for a given time. Means of rest periods that are too far away from the nominal center are rejected. Only after
+ * several consecutive rest periods with consistent means, their average moves the center estimate by a fraction
+ * of the difference (exponential moving average). Thus, a stick held steadily near the center is only taken for
+ * the center if it is held at the same position for all of these rest periods without any button activity,
+ * and even then it only has a small effect.
+ *
+ * The center is kept with 8 fractional bits (Q8), so that it can be refined below one raw step.
+ *
+ * The class does not depend on the Arduino framework.
+ */
+class CenterCalibrator
+{
+    public:
+
+        static const uint8_t kNumAxes = 2;
+
+        // Maximum deviation of the mean of a rest period from the average of the preceding consistent ones [raw steps, Q8]
+        static const uint16_t kMaxConsistentDeviationQ8 = 256;
+
+        /**
+         * Creates a calibrator whose center estimate equals the nominal center.
+         *
+         * @param nominalCenter Nominal raw center value of both axes.
+         *
+         * @param maxCenterOffset Maximum deviation of a learned center from the nominal center [raw steps].
+         *
+         * @param restMicros Duration of a rest period [us].
+         *
+         * @param maxVariance Maximum variance of the raw values of each axis during a rest period [raw steps^2].
+         *
+         * @param updateShift Weight of each confirmed mean in the center estimate as a power of two, i.e. 2 = 1/4.
+         *
+         * @param confirmPeriods Number of consecutive rest periods with consistent means that update the center.
+         */
+        CenterCalibrator(uint8_t nominalCenter, uint8_t maxCenterOffset, uint32_t restMicros, uint8_t maxVariance, uint8_t updateShift,
+                         uint8_t confirmPeriods);
+
+        /**
+         * Adds a sample of the raw joystick values.
+         *
+         * @param raw Raw values of both axes.
+         *
+         * @param btnActive True, if any button is pressed or has been pressed since the previous sample.
+         *
+         * @param nowMicros Time of the sample [us].
+         *
+         * @return True, if a rest period has been completed and the center estimate has been updated.
+         */
+        bool update(const uint8_t raw[kNumAxes], bool btnActive, uint64_t nowMicros);
+
+        /**
+         * Returns the center of the given axis, rounded to raw steps.
+         */
+        inline uint8_t getCenter(uint8_t axis) const
+        {
+            return (centerQ8_[axis] + 0x80) >> 8;
+        }
+
+        /**
+         * Returns the center of the given axis with 8 fractional bits.
+         */
+        inline uint16_t getCenterQ8(uint8_t axis) const
+        {
+            return centerQ8_[axis];
+        }
+
+        /**
+         * Sets the center of the given axis, e.g. as loaded from non-volatile memory.
+         * Values that are too far away from the nominal center are ignored.
+         *
+         * @return False, if the value has been ignored.
+         */
+        bool setCenterQ8(uint8_t axis, uint16_t centerQ8);
+
+        /**
+         * Returns the number of completed rest periods.
+         */
+        inline uint32_t getUpdateCount() const
+        {
+            return updateCount_;
+        }
+
+    private:
+
+        uint8_t nominalCenter_;
+
+        uint8_t maxCenterOffset_;
+
+        uint32_t restMicros_;
+
+        uint8_t maxVariance_;
+
+        uint8_t updateShift_;
+
+        uint8_t confirmPeriods_;
+
+        uint16_t centerQ8_[kNumAxes];
+
+        // Number of consecutive rest periods with consistent means, and the sum of their means
+        uint8_t numConsistent_ = 0;
+
+        uint32_t consistentSumQ8_[kNumAxes] = {0};
+
+        // Start of the current rest period [us]
+        uint64_t restStartMicros_ = 0;
+
+        // Number of samples, sums and sums of squares of the current rest period
+        uint32_t numSamples_ = 0;
+
+        uint32_t sum_[kNumAxes] = {0};
+
+        uint32_t sumSq_[kNumAxes] = {0};
+
+        uint32_t updateCount_ = 0;
+
+        /**
+         * Discards the samples of the current rest period and starts a new one.
+         */
+        void restartRestPeriod(uint64_t nowMicros);
+
+        /**
+         * Adds the means of a completed rest period to the consecutive consistent ones.
+         *
+         * @return True, if confirmPeriods consistent means have been collected.
+         */
+        bool confirmRestMeans(const uint16_t meanQ8[kNumAxes]);
+
+        /**
+         * Returns true, if the given center is within the allowed range around the nominal center.
+         */
+        bool isPlausible(uint16_t centerQ8) const;
+};
@@ -0,0 +1,178 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+/**
+ * Deferred logging facility for the hot path.
+ *
+ * Instead of formatting text, a call site pushes a format ID and up to kMaxArgs raw 32-bit arguments into a
+ * fixed-size lock-free ring buffer. This costs a few dozen cycles and never allocates memory. A task with idle
+ * priority formats the entries later on and emits them via the ESP32 log functions.
+ *
+ * The ring buffer is a bounded multi-producer queue (per-entry sequence numbers), so any task may log.
+ * If the ring buffer is full, the message is dropped and counted. The number of dropped messages is
+ * reported by the log task.
+ *
+ * Arguments are passed as uint32_t. Hence, format strings must only use integer conversions (%d, %u, %x, %c);
+ * float values need to be converted to fixed-point integers by the call site.
+ */
+class DeferredLog
+{
+    public:
+
+        // Maximum number of arguments per message
+        static const uint8_t kMaxArgs = 8;
+
+        // Number of entries of the ring buffer (power of 2)
+        static const uint16_t kCapacity = 64;
+
+        // Log levels, corresponding to ARDUHAL_LOG_LEVEL_*
+        enum tLevel { LEVEL_ERROR = 1, LEVEL_WARN = 2, LEVEL_INFO = 3, LEVEL_DEBUG = 4 };
+
+        /**
+         * IDs of all deferred log messages. The format strings are defined in DeferredLog.cpp.
+         */
+        enum tFormatId : uint16_t {
+            kFmtReportHex = 0,
+            kFmtInputTickDuration,
+            kFmtInputTickJitter,
+            kFmtRateTier,
+            kFmtReportCounts,
+            kFmtInputLatency,
+            kFmtHousekeepingSlotDuration,
+            kFmtRtcTimestamp,
+            kFmtPowerStatus,
+            kFmtButtonEvents,
+            kFmtJoystickBus,
+            kFmtI2CBusLoad,
+            kFmtMotionAim,
+            kFmtReportSend,
+            kFmtConnParams,
+            kFmtReportCongestion,
+            kNumFormats
+        };
+
+        /**
+         * Entry of the ring buffer.
+         */
+        typedef struct {
+            // Time when the message has been logged [us, lower 32 bits of esp_timer_get_time()]
+            uint32_t timestampMicros;
+
+            uint16_t formatId;
+
+            uint32_t args[kMaxArgs];
+        } tEntry;
+
+        static DeferredLog* getInstance();
+
+        /**
+         * Starts the task that formats and emits the logged messages.
+         * 
+         * @param taskCore Core on which the log task is executed.
+         */
+        void start(BaseType_t taskCore);
+
+        /**
+         * Pushes a message into the ring buffer. Can be called from any task.
+         * 
+         * @return False, if the ring buffer is full and the message has been dropped.
+         */
+        bool log(tFormatId formatId,
+                 uint32_t a0 = 0, uint32_t a1 = 0, uint32_t a2 = 0, uint32_t a3 = 0,
+                 uint32_t a4 = 0, uint32_t a5 = 0, uint32_t a6 = 0, uint32_t a7 = 0);
+
+        /**
+         * Returns the number of messages that have been dropped because the ring buffer was full.
+         */
+        inline uint32_t getDroppedCount()
+        {
+            return droppedCount_.load(std::memory_order_relaxed);
+        }
+
+        DeferredLog(const DeferredLog&) = delete;
+
+        DeferredLog& operator = (const DeferredLog&) = delete;
+
+        DeferredLog(DeferredLog&&) = delete;
+
+        DeferredLog& operator = (DeferredLog&&) = delete;
+
+    private:
+
+        /**
+         * Format string and level of a message.
+         */
+        typedef struct {
+            tLevel level;
+            const char *format;
+        } tFormat;
+
+        // Table of all format strings, indexed by tFormatId
+        static const tFormat kFormats[kNumFormats];
+
+        // Period at which the log task checks the ring buffer
+        static const TickType_t kLogTaskDelay = 20 / portTICK_PERIOD_MS;
+
+        /**
+         * Slot of the ring buffer. The sequence number indicates whether the slot is free or filled.
+         */
+        typedef struct {
+            std::atomic<uint32_t> seq;
+            tEntry entry;
+        } tCell;
+
+        tCell cells_[kCapacity];
+
+        // Position of the next entry to be written
+        std::atomic<uint32_t> enqueuePos_{0};
+
+        // Position of the next entry to be read, owned by the log task
+        uint32_t dequeuePos_ = 0;
+
+        std::atomic<uint32_t> droppedCount_{0};
+
+        // Private constructor to prevent creation of multiple instances
+        DeferredLog();
+
+        /**
+         * Takes the oldest entry from the ring buffer. Must only be called by the log task.
+         * 
+         * @return False, if the ring buffer is empty.
+         */
+        bool pop(tEntry &entry);
+
+        /**
+         * Formats and emits an entry.
+         */
+        void emit(const tEntry &entry);
+
+        /**
+         * Continuously takes entries from the ring buffer and emits them.
+         * This function is executed inside of a task with idle priority.
+         */
+        static void logTask(void *p);
+};
@@ -0,0 +1,171 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// The functions called by interrupt routines are forced inline, so that they end up in the routine's memory section (IRAM)
+#define EDGE_DEBOUNCER_INLINE inline __attribute__((always_inline))
+
+/**
+ * Leading-edge debouncer for a button whose edges are captured by an interrupt.
+ *
+ * The first edge that changes the debounced state is accepted immediately and timestamped, i.e. a press is
+ * reported without waiting for the contact to settle. Afterwards, all edges are rejected during a lockout
+ * window, which covers the bouncing of the contact. Since bounces may end with either level, the level is
+ * polled after the lockout window has expired: if it differs from the debounced state, the change is accepted
+ * then (e.g. a release during the lockout window).
+ *
+ * Glitches: The level is read by the interrupt routine instead of being derived from the edge. A spike that
+ * is shorter than the interrupt latency therefore reads the unchanged level and is ignored.
+ *
+ * The state machine only depends on the levels and timestamps passed in, so it can be driven by synthetic
+ * bounce traces. The class does not depend on the Arduino framework.
+ */
+class EdgeDebouncer
+{
+    public:
+
+        /**
+         * @param lockoutMicros Duration of the lockout window after each accepted change [us].
+         */
+        explicit EdgeDebouncer(uint32_t lockoutMicros)
+        : lockoutMicros_{lockoutMicros}
+        {
+        }
+
+        /**
+         * Processes an edge. Called by the interrupt routine.
+         *
+         * @param pressed Level of the button as read in the interrupt routine.
+         *
+         * @param nowMicros Time of the edge [us].
+         *
+         * @return True, if the debounced state has changed.
+         */
+        EDGE_DEBOUNCER_INLINE bool onEdge(bool pressed, uint32_t nowMicros)
+        {
+            if (isLockedOut(nowMicros))
+            {
+                ++bounceCount_;
+
+                return false;
+            }
+
+            return accept(pressed, nowMicros);
+        }
+
+        /**
+         * Resynchronizes the debounced state with the level after the lockout window has expired.
+         * Must be called periodically.
+         *
+         * @param pressed Current level of the button.
+         *
+         * @param nowMicros Current time [us].
+         *
+         * @return True, if the debounced state has changed.
+         */
+        EDGE_DEBOUNCER_INLINE bool poll(bool pressed, uint32_t nowMicros)
+        {
+            if (isLockedOut(nowMicros))
+            {
+                return false;
+            }
+
+            return accept(pressed, nowMicros);
+        }
+
+        inline bool isPressed() const
+        {
+            return pressed_;
+        }
+
+        /**
+         * Returns the number of accepted presses (wraps around).
+         */
+        inline uint8_t getPressCount() const
+        {
+            return pressCount_;
+        }
+
+        /**
+         * Returns the time of the most recent accepted change [us].
+         */
+        inline uint32_t getEventMicros() const
+        {
+            return eventMicros_;
+        }
+
+        /**
+         * Returns the number of edges rejected during lockout windows.
+         */
+        inline uint32_t getBounceCount() const
+        {
+            return bounceCount_;
+        }
+
+    private:
+
+        uint32_t lockoutMicros_;
+
+        bool pressed_ = false;
+
+        uint8_t pressCount_ = 0;
+
+        uint32_t eventMicros_ = 0;
+
+        // Lockout window in progress (cleared on expiry, so that timestamps wrapping around cannot restart it)
+        bool lockedOut_ = false;
+
+        uint32_t bounceCount_ = 0;
+
+        EDGE_DEBOUNCER_INLINE bool isLockedOut(uint32_t nowMicros)
+        {
+            if ( lockedOut_ && (nowMicros - eventMicros_ >= lockoutMicros_) )
+            {
+                lockedOut_ = false;
+            }
+
+            return lockedOut_;
+        }
+
+        EDGE_DEBOUNCER_INLINE bool accept(bool pressed, uint32_t nowMicros)
+        {
+            if (pressed == pressed_)
+            {
+                return false;
+            }
+
+            pressed_ = pressed;
+
+            if (pressed)
+            {
+                ++pressCount_;
+            }
+
+            eventMicros_ = nowMicros;
+            lockedOut_ = true;
+
+            return true;
+        }
+};
@@ -4,8 +4,12 @@
 #include <BLE2902.h>
 #include <BLEHIDDevice.h>
 #include <HIDTypes.h>
+#include <esp_timer.h>
+#include <atomic>
 
 #include "HIDDescriptor.h"
+#include "ReportSlot.h"
+#include "SeqLock.h"
 
 /**
  * Representation of a Gamepad that is connectable via Bluetooth Low Energy (BLE).
@@ -26,6 +30,83 @@ class GamepadBLE {
         // Type that is used for x- and y-axis values.
         typedef int16_t StickAxis_t;
 
+        /**
+         * Enum that defines when the input report is sent to the host.
+         * - ALWAYS: On every call of updateInputReport.
+         * - ON_CHANGE: Only if the report differs from the last report sent, or if the keep-alive interval has elapsed.
+         */
+        enum tReportMode { ALWAYS = 0, ON_CHANGE = 1 };
+
+        /**
+         * Enum that defines how the input report is passed to the BLE stack.
+         * - LIBRARY: Via setValue() and notify() of the report characteristic, which copy the report into heap-backed
+         *            strings and take a semaphore of the characteristic on each report.
+         * - DIRECT:  Straight to esp_ble_gatts_send_indicate() with the cached attribute handle, GATT interface and
+         *            connection ID. The value of the characteristic is only updated when the host reads it.
+         */
+        enum tNotifyPath { LIBRARY = 0, DIRECT = 1 };
+
+        /**
+         * Enum that defines the connection parameters requested from the host.
+         * - LOW_LATENCY:  Short connection interval without slave latency, so that each report is sent within
+         *                 a few milliseconds.
+         * - POWER_SAVING: Long connection interval with slave latency, i.e. the gamepad may skip connection events
+         *                 while it has nothing to send. A report is still sent at the next connection event.
+         */
+        enum tLinkProfile { LOW_LATENCY = 0, POWER_SAVING = 1 };
+
+        // Connection parameters per link profile: interval [1.25 ms], slave latency [connection events], supervision timeout [10 ms]
+        static const uint16_t kLowLatencyMinInterval = 6;     // 7.5 ms
+        static const uint16_t kLowLatencyMaxInterval = 12;    // 15 ms
+        static const uint16_t kLowLatencySlaveLatency = 0;
+        static const uint16_t kLowLatencyTimeout = 400;       // 4 s
+
+        static const uint16_t kPowerSavingMinInterval = 48;   // 60 ms
+        static const uint16_t kPowerSavingMaxInterval = 80;   // 100 ms
+        static const uint16_t kPowerSavingSlaveLatency = 4;
+        static const uint16_t kPowerSavingTimeout = 600;      // 6 s
+
+        // Delay of the connection parameter request after connecting, if the host does not authenticate earlier [us].
+        // Hosts tend to reject or ignore updates requested while they discover the services and pair.
+        static const uint32_t kConnParamsDelayMicros = 5000000;
+
+        // Delay of the single retry of a failed connection parameter request [us]
+        static const uint32_t kConnParamsRetryDelayMicros = 2000000;
+
+        // Maximum number of notifications of the notify path DIRECT that have been passed to the BLE stack, but not
+        // confirmed by ESP_GATTS_CONF_EVT yet. Further reports wait, so that the host is not sent a backlog of stale reports.
+        static const uint8_t kMaxReportsInFlight = 2;
+
+        // Number of connection intervals without any confirmation after which the notifications in flight are considered
+        // lost, e.g. because an ESP_GATTS_CONF_EVT has been missed. Otherwise the reports would wait forever.
+        static const uint8_t kReportsInFlightTimeoutIntervals = 4;
+
+        // Connection interval assumed until the host has reported one [us]
+        static const uint32_t kDefaultConnIntervalMicros = 50000;
+
+        // Number of sent reports over which the send statistics are summarized
+        static const uint16_t kSendStatsWindow = 256;
+
+        /**
+         * Cost of sending the input reports over one window of kSendStatsWindow reports.
+         */
+        typedef struct {
+            // Notify path used for all reports of the window
+            uint32_t path;
+
+            uint32_t numReports;
+
+            // CPU time spent in the send call [CPU cycles]
+            uint32_t avgCycles;
+            uint32_t maxCycles;
+
+            // Heap allocations during the send calls of the window (total) and during a single send call (max), e.g. of
+            // the message queued to the BLE task. Allocations of other tasks in the meantime add noise.
+            // Only counted in a build with ALLOC_STATS, see AllocCounter.
+            uint32_t numAllocs;
+            uint32_t maxAllocs;
+        } tSendStats;
+
         /**
          * Returns singleton instance of the gamepad class.
          */
@@ -69,8 +150,133 @@ class GamepadBLE {
         /**
          * Sends the input report to the connected host device via BLE.
          * Does nothing if no host is connected.
+         * In report mode ON_CHANGE, unchanged reports are suppressed.
+         * While the link is busy (see isLinkBusy()), the report is held back as the single pending report, replacing
+         * an older pending report. The pending report is sent by a later call as soon as the link is clear.
+         * Button edges must therefore only be applied to gamepadData_ while isReadyForButtonEdges() returns true.
+         * 
+         * @return True, if the report has been sent.
+         */
+        bool updateInputReport();
+
+        /**
+         * Returns true, if a report built now would be sent right away by updateInputReport() and cannot be
+         * replaced anymore, i.e. no report is pending and the link is not busy.
+         * Must be called by the task that calls updateInputReport().
+         */
+        bool isReadyForButtonEdges();
+
+        /**
+         * Defines when the input report is sent to the host. Default is ALWAYS.
+         */
+        void setReportMode(tReportMode mode);
+
+        /**
+         * Sets the minimum change of a stick axis value for a report to count as changed in report mode ON_CHANGE.
+         * A threshold of 0 treats any change as relevant. Button changes are always relevant.
          */
-        void updateInputReport();
+        void setAxisChangeThreshold(uint16_t threshold);
+
+        /**
+         * Sets the interval after which an unchanged report is sent anyway in report mode ON_CHANGE.
+         * 
+         * @param intervalMillis Keep-alive interval [ms].
+         */
+        void setKeepAliveInterval(uint32_t intervalMillis);
+
+        /**
+         * Returns the number of input reports that have been sent to the host.
+         */
+        inline uint32_t getReportsSent()
+        {
+            return reportsSent_;
+        }
+
+        /**
+         * Returns the number of input reports that have been suppressed because they did not change.
+         */
+        inline uint32_t getReportsSuppressed()
+        {
+            return reportsSuppressed_;
+        }
+
+        /**
+         * Selects how the input report is passed to the BLE stack. Can be called from any task. Default is DIRECT.
+         * Until the connection ID of a new connection is known, reports are sent via LIBRARY.
+         */
+        inline void setNotifyPath(tNotifyPath path)
+        {
+            notifyPath_.store(path, std::memory_order_relaxed);
+        }
+
+        inline tNotifyPath getNotifyPath()
+        {
+            return notifyPath_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Returns the number of pending reports that have been replaced by a newer one before they could be sent.
+         */
+        inline uint32_t getReportsReplaced()
+        {
+            return reportSlot_.getReplacedCount();
+        }
+
+        /**
+         * Returns the number of times the BLE stack has reported congestion. Can be called from any task.
+         */
+        inline uint32_t getCongestionCount()
+        {
+            return congestionCount_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Returns the accumulated time of all finished congestion periods [ms]. Can be called from any task.
+         */
+        inline uint32_t getCongestedMillis()
+        {
+            return congestedMillis_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Returns the number of notifications of the notify path DIRECT that have not been confirmed yet.
+         */
+        inline uint8_t getReportsInFlight()
+        {
+            return reportsInFlight_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Returns the number of times the notifications in flight have been given up, because they were not confirmed
+         * within kReportsInFlightTimeoutIntervals connection intervals.
+         */
+        inline uint32_t getReportsInFlightTimeouts()
+        {
+            return reportsInFlightTimeouts_;
+        }
+
+        /**
+         * Selects the connection parameters to be requested from the host. Can be called from any task, e.g. on
+         * each tick, since a request is only issued if the profile changes. On a new connection, the current profile
+         * is requested once authentication has completed, or after kConnParamsDelayMicros. A failed request is retried
+         * once. Default is LOW_LATENCY. The host decides on the actual parameters, which are logged whenever they change.
+         */
+        void setLinkProfile(tLinkProfile profile);
+
+        inline tLinkProfile getLinkProfile()
+        {
+            return linkProfile_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Returns the send statistics of the most recently completed window. Can be called from any task.
+         *
+         * @return Sequence number of the statistics, which changes whenever a new window has been completed.
+         */
+        inline uint32_t getSendStats(tSendStats &stats)
+        {
+            return sendStats_.read(stats);
+        }
 
         /**
          * Sends the battery level to the connected host device via BLE.
@@ -116,11 +322,103 @@ class GamepadBLE {
          */
         BLECharacteristic* pBatteryLevelCharacteristic_;
 
+        /**
+         * Client characteristic configuration descriptor of the report characteristic, i.e. whether the host
+         * has enabled notifications.
+         */
+        BLE2902* pInputCccd_ = nullptr;
+
+        /**
+         * Attribute handle of the report characteristic.
+         */
+        uint16_t inputReportHandle_ = 0;
+
         /**
          * Connection status. True, if gamepad is connected to a host.
          */
         bool connected_ = false;
 
+        std::atomic<tNotifyPath> notifyPath_{tNotifyPath::DIRECT};
+
+        /**
+         * GATT interface, connection ID and host address of the current connection, cached by gattsEventHandler().
+         * connCached_ is true while they are valid.
+         */
+        std::atomic<bool> connCached_{false};
+
+        std::atomic<uint8_t> gattsIf_{ESP_GATT_IF_NONE};
+
+        std::atomic<uint16_t> connId_{0};
+
+        typedef struct {
+            esp_bd_addr_t bda;
+        } tPeer;
+
+        SeqLock<tPeer> peer_;
+
+        std::atomic<tLinkProfile> linkProfile_{tLinkProfile::LOW_LATENCY};
+
+        /**
+         * Connection parameters as most recently reported by the BLE stack, owned by gapEventHandler().
+         */
+        uint16_t connInterval_ = 0;
+
+        uint16_t connLatency_ = 0;
+
+        uint16_t connTimeout_ = 0;
+
+        /**
+         * Requests the connection parameters of the given link profile from the connected host.
+         */
+        void requestConnParams(tLinkProfile profile);
+
+        /**
+         * One-shot timer that requests the parameters of the current link profile after connecting, or retries a failed request.
+         */
+        esp_timer_handle_t connParamsTimer_ = nullptr;
+
+        // True from connecting until the first request, setLinkProfile() leaves the request to connParamsTimer_ meanwhile
+        std::atomic<bool> connParamsDeferred_{false};
+
+        // A failed request has been retried, owned by the BLE task
+        bool connParamsRetried_ = false;
+
+        /**
+         * Callback of connParamsTimer_, called by the esp_timer task.
+         */
+        static void onConnParamsTimer(void *arg);
+
+        /**
+         * (Re)starts connParamsTimer_.
+         */
+        void scheduleConnParams(uint32_t delayMicros);
+
+        /**
+         * Copy of the report that has been sent most recently, from which the value of the report characteristic
+         * is synced when the host reads it.
+         */
+        SeqLock<tGamepadReportStruct> sentReport_;
+
+        /**
+         * Send statistics of the current window, owned by the task that calls updateInputReport().
+         */
+        tSendStats sendStatsWindow_ = {};
+
+        uint64_t sendCyclesSum_ = 0;
+
+        // Send statistics of the most recently completed window
+        SeqLock<tSendStats> sendStats_;
+
+        /**
+         * Passes a report to the BLE stack via the selected notify path and accounts for the cost.
+         */
+        void sendInputReport(const tGamepadReportStruct &report);
+
+        /**
+         * Adds the cost of sending one report to the statistics of the current window.
+         */
+        void accountSend(tNotifyPath path, uint32_t cycles, uint32_t allocs);
+
         /**
          * HID report that is provided to the connected host (Characteristic UUID 0x2A4D).
          * It contains the current values of the gamepad controls, i.e. sticks and buttons.
@@ -129,6 +427,72 @@ class GamepadBLE {
          * (Characteristic UUID 0x2A4A).
          */
         tGamepadReportStruct gamepadData_;
+
+        /**
+         * Copy of the HID report that has been sent to the host most recently.
+         */
+        tGamepadReportStruct lastSentReport_;
+
+        /**
+         * Time when the most recent HID report has been sent [ms].
+         */
+        uint32_t lastSentMillis_ = 0;
+
+        /**
+         * If true, the next report is sent regardless of the report mode, e.g. after a new connection.
+         */
+        bool forceReport_ = true;
+
+        tReportMode reportMode_ = tReportMode::ALWAYS;
+
+        uint16_t axisChangeThreshold_ = 0;
+
+        uint32_t keepAliveMillis_ = 1000;
+
+        uint32_t reportsSent_ = 0;
+
+        uint32_t reportsSuppressed_ = 0;
+
+        /**
+         * Report that is due, but held back because the link is busy, owned by the task that calls updateInputReport().
+         */
+        ReportSlot<tGamepadReportStruct> reportSlot_;
+
+        /**
+         * Congestion state of the BLE stack as reported by ESP_GATTS_CONGEST_EVT.
+         */
+        std::atomic<bool> congested_{false};
+
+        std::atomic<uint32_t> congestionCount_{0};
+
+        std::atomic<uint32_t> congestedMillis_{0};
+
+        // Start of the current congestion period [us], owned by gattsEventHandler()
+        int64_t congestionStartMicros_ = 0;
+
+        // Notifications of the notify path DIRECT not confirmed yet, incremented by sendInputReport(), decremented by gattsEventHandler()
+        std::atomic<uint8_t> reportsInFlight_{0};
+
+        // Time of the most recent send or confirmation of a notification of the notify path DIRECT [us]
+        std::atomic<uint32_t> inFlightChangeMicros_{0};
+
+        // Connection interval in effect [us], written by gapEventHandler()
+        std::atomic<uint32_t> connIntervalMicros_{kDefaultConnIntervalMicros};
+
+        // Owned by the task that calls updateInputReport()
+        uint32_t reportsInFlightTimeouts_ = 0;
+
+        /**
+         * Returns true, if a report passed to the BLE stack now would queue up behind older ones,
+         * i.e. if the stack is congested or kMaxReportsInFlight notifications are unconfirmed.
+         * Notifications that have not been confirmed within kReportsInFlightTimeoutIntervals connection intervals are given up.
+         */
+        bool isLinkBusy();
+
+        /**
+         * Returns true, if gamepadData_ differs from lastSentReport_ with respect to the axis change threshold.
+         */
+        bool isReportChanged();
         
         /**
          * Enum that defines the available methods for configuration and start of BLE advertisement.
@@ -173,10 +537,31 @@ class GamepadBLE {
         SemaphoreHandle_t espBleGapEventSemaphore_ = nullptr;
 
         /**
-         * GAP event handler used to synchronize on BLE GAP events of ESP-IDF during configuration of BLE advertisement.
+         * GAP event handler used to synchronize on BLE GAP events of ESP-IDF during configuration of BLE advertisement
+         * and to log the negotiated connection parameters.
          */
         static void gapEventHandler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
 
+        /**
+         * GATT server event handler that caches the GATT interface and connection ID for the notify path DIRECT.
+         * Called by the BLE task after the event has been handled by the BLE library.
+         */
+        static void gattsEventHandler(esp_gatts_cb_event_t event, esp_gatt_if_t gattsIf, esp_ble_gatts_cb_param_t *param);
+
+        /**
+         * Callback class that is registered at the report characteristic to sync its value when the host reads it.
+         */
+        class InputReportCallback : public BLECharacteristicCallbacks
+        {
+            public:
+                InputReportCallback(GamepadBLE* pGamepad);
+
+                void onRead(BLECharacteristic* pCharacteristic);
+
+            private:
+                GamepadBLE* pGamepad_;
+        };
+
         /**
          * Callback class that is registered at the BLE server to detect 'connect' and 'disconnect' events.
          */
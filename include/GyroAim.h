@@ -0,0 +1,206 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Converts the angular rate measured by a gyroscope into the deflection of a stick (gyro aim).
+ *
+ * Per sample, the bias of the gyroscope is subtracted and the rate is smoothed by a one-pole low-pass filter,
+ * which averages the samples of each read burst. The bias is learned while the device is held still: the rate of
+ * all axes must stay nearly constant and close to the current bias estimate. A small deadzone suppresses the
+ * remaining noise. The rate is mapped to the deflection in one of two modes:
+ * - RATE:       The deflection is proportional to the angular rate, i.e. turning the device turns the camera just
+ *               like deflecting the stick does, and holding the device still stops the camera.
+ * - INTEGRATED: The angular rate is integrated per sample into the deflection, i.e. the deflection follows the
+ *               angle by which the device has been turned (tilt to steer). The integral saturates at full deflection,
+ *               so that turning back takes effect right away, and leaks slowly towards the center, so that the
+ *               remaining drift of the bias does not accumulate.
+ *
+ * Integer (fixed-point) math only. The class does not depend on the Arduino framework.
+ */
+class GyroAim
+{
+    public:
+
+        // Number of gyroscope axes
+        static const uint8_t kNumAxes = 3;
+
+        // Number of output axes (stick x, stick y)
+        static const uint8_t kNumOutputs = 2;
+
+        // Output value at full deflection
+        static const int16_t kOutputMax = 32767;
+
+        // Maximum change of the rate between two samples of a device held still [raw LSB]
+        static const uint16_t kStillThreshold = 16;
+
+        // Number of consecutive still samples required to update the bias
+        static const uint8_t kStillSamples = 20;
+
+        // Weight of each still sample in the bias estimate: 1/16 for the first kFastBiasSamples, 1/1024 afterwards
+        static const uint8_t kFastBiasShift = 4;
+        static const uint8_t kSlowBiasShift = 10;
+        static const uint8_t kFastBiasSamples = 64;
+
+        // Default weight of each sample in the low-pass filter (1/4)
+        static const uint8_t kDefaultFilterShift = 2;
+
+        // Default angle for full deflection in mode INTEGRATED [degrees]
+        static const uint16_t kDefaultFullDeflectionDeg = 30;
+
+        // Default leak of the integral per sample in mode INTEGRATED as a power of two, i.e. the deflection returns
+        // to the center with a time constant of 2^shift samples
+        static const uint8_t kDefaultLeakShift = 10;
+
+        enum tMode { RATE = 0, INTEGRATED };
+
+        /**
+         * @param lsbPer10Dps Scale of the raw rate [LSB per 10 degrees per second], depends on the full scale range.
+         *
+         * @param sampleRateHz Rate of the samples passed to addSample() [Hz].
+         *
+         * @param gyroAxisX, gyroAxisY Gyroscope axis (0..2) that drives the stick x-axis and y-axis, respectively.
+         *
+         * @param invertX, invertY True, if the direction of the respective stick axis is inverted.
+         */
+        GyroAim(uint16_t lsbPer10Dps, uint16_t sampleRateHz, uint8_t gyroAxisX, bool invertX, uint8_t gyroAxisY, bool invertY);
+
+        /**
+         * Selects how the angular rate is mapped to the deflection. Default is RATE.
+         * Switching to INTEGRATED starts the integral at the center.
+         */
+        void setMode(tMode mode);
+
+        inline tMode getMode() const
+        {
+            return mode_;
+        }
+
+        /**
+         * Sets the sensitivity of mode RATE.
+         *
+         * @param fullDeflectionDps Angular rate that results in full deflection [degrees per second].
+         */
+        void setSensitivity(uint16_t fullDeflectionDps);
+
+        /**
+         * Sets the sensitivity of mode INTEGRATED.
+         *
+         * @param fullDeflectionDeg Angle that results in full deflection [degrees].
+         */
+        void setAngleSensitivity(uint16_t fullDeflectionDeg);
+
+        /**
+         * Sets the leak of the integral in mode INTEGRATED.
+         *
+         * @param shift Leak per sample is 1/2^shift of the integral (0 = no leak).
+         */
+        inline void setLeakShift(uint8_t shift)
+        {
+            leakShift_ = shift;
+        }
+
+        /**
+         * Sets the smoothing of the low-pass filter.
+         *
+         * @param shift Weight of each sample is 1/2^shift (0 = no smoothing).
+         */
+        inline void setFilterShift(uint8_t shift)
+        {
+            filterShift_ = shift;
+        }
+
+        /**
+         * Processes a sample of the gyroscope.
+         *
+         * @param rate Raw angular rate per gyroscope axis.
+         */
+        void addSample(const int16_t rate[kNumAxes]);
+
+        /**
+         * Returns the deflection of a stick axis (-kOutputMax..kOutputMax) according to the samples processed so far.
+         *
+         * @param output Stick axis (0 = x, 1 = y).
+         */
+        int16_t getDeflection(uint8_t output) const;
+
+        /**
+         * Returns the current bias estimate of a gyroscope axis [raw LSB].
+         */
+        inline int16_t getBias(uint8_t axis) const
+        {
+            return (int16_t) (biasQ8_[axis] >> 8);
+        }
+
+    private:
+
+        uint8_t gyroAxis_[kNumOutputs];
+
+        bool invert_[kNumOutputs];
+
+        // Rates within the deadzone result in zero deflection [raw LSB]
+        int32_t deadzone_;
+
+        // Maximum deviation of the rate from the bias estimate of a device held still [raw LSB]
+        int32_t maxBiasDeviation_;
+
+        int32_t lsbPer10Dps_;
+
+        int32_t sampleRateHz_;
+
+        tMode mode_ = RATE;
+
+        // Deflection per raw LSB with 16 fractional bits
+        int32_t gainQ16_ = 0;
+
+        // Integral that results in full deflection [raw LSB * samples]
+        int32_t fullIntegral_ = 1;
+
+        uint8_t filterShift_ = kDefaultFilterShift;
+
+        uint8_t leakShift_ = kDefaultLeakShift;
+
+        // Bias per gyroscope axis with 8 fractional bits
+        int32_t biasQ8_[kNumAxes] = {0};
+
+        // Number of bias updates (saturates at kFastBiasSamples)
+        uint8_t biasSamples_ = 0;
+
+        int16_t prevRate_[kNumAxes] = {0};
+
+        // Number of consecutive still samples (saturates at kStillSamples)
+        uint8_t stillSamples_ = 0;
+
+        // Filtered rate per output with 8 fractional bits
+        int32_t filterQ8_[kNumOutputs] = {0};
+
+        // Integral of the rate per output in mode INTEGRATED [raw LSB * samples]
+        int32_t integral_[kNumOutputs] = {0};
+
+        /**
+         * Returns the filtered rate of an output outside of the deadzone, shifted towards 0 by the deadzone [raw LSB].
+         */
+        int32_t getRateBeyondDeadzone(uint8_t output) const;
+};
@@ -0,0 +1,207 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <atomic>
+
+/**
+ * Monitors the health of an I2C bus and recovers it from errors.
+ *
+ * Each read transaction is classified. Failed transactions are retried immediately, as long as the retry budget
+ * (a token bucket) allows it. If a transaction still fails, further transactions are skipped for a backoff time
+ * that doubles with each consecutive failure. After several consecutive failures or if a line is held low, the
+ * bus is recovered: SCL is toggled until the slave releases SDA, a STOP condition is generated and the I2C
+ * driver is reinitialized. This frees a slave that hangs in the middle of a transfer.
+ *
+ * The counters can be read from any task. Transactions must be issued by one task at a time.
+ */
+class I2CBusHealth
+{
+    public:
+
+        /**
+         * Results of a transaction (classification of errors).
+         */
+        enum tResult {
+            OK = 0,
+            TRANSIENT,  // Read failed without an error reported by the I2C driver
+            SHORT_READ, // Fewer bytes than requested
+            ADDR_NACK,  // Slave did not acknowledge its address (absent or busy)
+            DATA_NACK,  // Slave did not acknowledge data
+            TIMEOUT,    // Transfer timed out, e.g. a slave stretches the clock forever
+            BUS_ERROR,  // Other error of the I2C driver, e.g. arbitration lost
+            BUS_STUCK,  // SDA or SCL is held low while the bus should be idle
+            BACKOFF,    // Transaction skipped due to backoff after errors
+            kNumResults
+        };
+
+        // Number of immediate retries of a failed transaction (if the retry budget allows it)
+        static const uint8_t kMaxRetries = 2;
+
+        // Capacity of the retry budget [retries]
+        static const uint8_t kRetryBudgetMax = 10;
+
+        // Time after which one retry is added to the budget [us]
+        static const uint32_t kRetryRefillMicros = 100000;
+
+        // Backoff after the first failed transaction, doubled with each further one [us]
+        static const uint32_t kBackoffMinMicros = 2000;
+
+        // Maximum backoff [us]
+        static const uint32_t kBackoffMaxMicros = 256000;
+
+        // Number of consecutive failed transactions after which the bus is recovered
+        static const uint8_t kRecoveryThreshold = 3;
+
+        // Timeout of a transfer [ms]
+        static const uint16_t kTimeoutMillis = 5;
+
+        // Register address that denotes a plain read without writing a register address first
+        static const int16_t kNoRegister = -1;
+
+        /**
+         * @param wire I2C driver of the bus.
+         *
+         * @param pinSda, pinScl GPIO pins of the bus.
+         *
+         * @param freq Clock frequency [Hz].
+         */
+        I2CBusHealth(TwoWire &wire, int pinSda, int pinScl, uint32_t freq);
+
+        /**
+         * Initializes the I2C driver.
+         */
+        void begin();
+
+        /**
+         * Reads data from a slave, including retries, backoff and recovery.
+         *
+         * @param addr Address of the slave.
+         *
+         * @param reg Register to start reading from (written before the read with a repeated start), or kNoRegister.
+         *
+         * @param pData Buffer for the data.
+         *
+         * @param numBytes Number of bytes to be read.
+         *
+         * @return Result of the transaction (OK, error class of the last attempt, or BACKOFF).
+         */
+        tResult read(uint8_t addr, int16_t reg, uint8_t *pData, uint8_t numBytes);
+
+        /**
+         * Writes a register of a slave, e.g. to configure it. Not retried, but counted and classified like reads.
+         *
+         * @return Result of the transaction (OK or error class).
+         */
+        tResult writeRegister(uint8_t addr, uint8_t reg, uint8_t value);
+
+        /**
+         * Reads data from a slave without writing a register address first.
+         */
+        inline tResult read(uint8_t addr, uint8_t *pData, uint8_t numBytes)
+        {
+            return read(addr, kNoRegister, pData, numBytes);
+        }
+
+        inline uint32_t getTransactionCount() const
+        {
+            return transactionCount_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Returns the number of transactions that failed after all retries (excluding skipped ones).
+         */
+        inline uint32_t getFailedTransactionCount() const
+        {
+            return failedTransactionCount_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Returns the number of attempts with the given result (including retries).
+         */
+        inline uint32_t getResultCount(tResult result) const
+        {
+            return resultCount_[result].load(std::memory_order_relaxed);
+        }
+
+        inline uint32_t getRetryCount() const
+        {
+            return retryCount_.load(std::memory_order_relaxed);
+        }
+
+        inline uint32_t getRecoveryCount() const
+        {
+            return recoveryCount_.load(std::memory_order_relaxed);
+        }
+
+    private:
+
+        TwoWire &wire_;
+
+        int pinSda_;
+
+        int pinScl_;
+
+        uint32_t freq_;
+
+        uint32_t consecutiveFailures_ = 0;
+
+        // Time until which transactions are skipped [us]
+        int64_t backoffUntilMicros_ = 0;
+
+        uint8_t retryBudget_ = kRetryBudgetMax;
+
+        int64_t lastRefillMicros_ = 0;
+
+        std::atomic<uint32_t> transactionCount_{0};
+
+        std::atomic<uint32_t> failedTransactionCount_{0};
+
+        std::atomic<uint32_t> resultCount_[kNumResults];
+
+        std::atomic<uint32_t> retryCount_{0};
+
+        std::atomic<uint32_t> recoveryCount_{0};
+
+        /**
+         * Performs a single attempt of a read transaction.
+         */
+        tResult attemptRead(uint8_t addr, int16_t reg, uint8_t *pData, uint8_t numBytes);
+
+        /**
+         * Determines the error class of a failed read from the state of the lines and the error of the I2C driver.
+         */
+        tResult classifyError(uint8_t addr, uint8_t error, uint8_t numBytesRead);
+
+        /**
+         * Takes a retry from the budget, if available.
+         */
+        bool takeRetry(int64_t nowMicros);
+
+        /**
+         * Frees the bus from a hung slave and reinitializes the I2C driver.
+         */
+        void recoverBus();
+};
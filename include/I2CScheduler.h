@@ -0,0 +1,278 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+#include "I2CBusHealth.h"
+
+/**
+ * Owns an I2C bus and executes the periodic and triggered read jobs of the devices attached to it.
+ *
+ * Devices register read jobs with a period and a priority. A task of the scheduler wakes up when the next job
+ * is due (or is triggered) and executes all due jobs back-to-back in one batch, highest priority first. The batch
+ * is limited by a time budget: a job that does not fit into the remaining budget according to its previous
+ * duration is deferred to the next batch. The job with the highest priority is always executed. Hence, the bus
+ * is never occupied by the scheduler for much longer than the budget, which bounds the time a task waits for an
+ * ad hoc access to the bus, see lock().
+ *
+ * The completion of each job is passed to a callback, which runs in the scheduler task.
+ *
+ * The scheduler measures the utilization of the bus, i.e. the fraction of time occupied by the batches and by
+ * ad hoc accesses, over windows of kUtilizationWindowMicros.
+ */
+class I2CScheduler
+{
+    public:
+
+        // Maximum number of jobs per bus
+        static const uint8_t kMaxJobs = 8;
+
+        // Maximum number of bytes read by a job
+        static const uint8_t kMaxJobBytes = 32;
+
+        // Window over which the utilization is measured [us]
+        static const uint32_t kUtilizationWindowMicros = 1000000;
+
+        // Returned by addJob() if no job could be added
+        static const int8_t kInvalidJobId = -1;
+
+        /**
+         * Completion of a job, passed to the callback of the job.
+         */
+        typedef struct {
+            // Result of the transaction
+            I2CBusHealth::tResult result;
+
+            // Data read (valid if result is OK)
+            const uint8_t *pData;
+
+            uint8_t numBytes;
+
+            // Start and end of the transaction [us, lower 32 bits of esp_timer_get_time()]
+            uint32_t startMicros;
+            uint32_t endMicros;
+
+            // The bus, which is locked while the callback runs, e.g. for transactions that depend on the data read
+            I2CBusHealth *pBus;
+        } tCompletion;
+
+        // Callback that processes the completion of a job
+        typedef void (*tJobCallback)(void *pContext, const tCompletion &completion);
+
+        /**
+         * Configuration of a read job.
+         */
+        typedef struct {
+            // Address of the slave
+            uint8_t addr;
+
+            // Register to read from, or I2CBusHealth::kNoRegister
+            int16_t reg;
+
+            // Number of bytes to read (1..kMaxJobBytes)
+            uint8_t numBytes;
+
+            // Jobs with higher priority are executed first within a batch
+            uint8_t priority;
+
+            // Period of the job [us], 0 = executed only when triggered
+            uint32_t periodMicros;
+
+            tJobCallback callback;
+
+            void *pContext;
+        } tJobConfig;
+
+        /**
+         * @param bus The bus to be scheduled.
+         *
+         * @param batchBudgetMicros Time budget of each batch [us].
+         */
+        I2CScheduler(I2CBusHealth &bus, uint32_t batchBudgetMicros);
+
+        /**
+         * Registers a read job. Must be called before start().
+         *
+         * @return ID of the job, or kInvalidJobId if the configuration is invalid or all jobs are in use.
+         */
+        int8_t addJob(const tJobConfig &config);
+
+        /**
+         * Creates the scheduler task.
+         *
+         * @param name Name of the task.
+         *
+         * @param priority Priority of the task. Should be higher than the priority of the tasks using the data,
+         *                 since the task blocks while a transaction is in progress and does little computation.
+         *
+         * @param core Core on which the task is executed.
+         */
+        void start(const char *name, UBaseType_t priority, BaseType_t core);
+
+        /**
+         * Sets the period of a job. Can be called from any task.
+         *
+         * @param periodMicros Period [us], 0 = executed only when triggered.
+         */
+        void setJobPeriod(int8_t jobId, uint32_t periodMicros);
+
+        /**
+         * Requests a single execution of a job as soon as possible. Can be called from any task.
+         */
+        void trigger(int8_t jobId);
+
+        /**
+         * Takes exclusive access to the bus for an ad hoc transaction outside of the jobs, e.g. by a library.
+         * Waits for the current batch to complete. The time until unlock() counts as bus utilization.
+         */
+        void lock();
+
+        /**
+         * Releases the exclusive access taken by lock().
+         */
+        void unlock();
+
+        inline I2CBusHealth& getBus()
+        {
+            return bus_;
+        }
+
+        /**
+         * Returns the bus utilization of the most recently completed window [1/1000].
+         */
+        inline uint16_t getUtilizationPermille() const
+        {
+            return utilizationPermille_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Returns the maximum duration of a batch or an ad hoc access within the most recently completed window [us].
+         */
+        inline uint32_t getMaxBusyMicros() const
+        {
+            return maxBusyMicros_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Returns the number of executions of a job.
+         */
+        inline uint32_t getJobRunCount(int8_t jobId) const
+        {
+            return jobs_[jobId].runCount.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Returns the number of times a due job has been deferred, because it did not fit into the batch budget.
+         */
+        inline uint32_t getJobDeferCount(int8_t jobId) const
+        {
+            return jobs_[jobId].deferCount.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Returns the number of periods of a job that have been skipped completely.
+         */
+        inline uint32_t getJobMissCount(int8_t jobId) const
+        {
+            return jobs_[jobId].missCount.load(std::memory_order_relaxed);
+        }
+
+        inline uint8_t getNumJobs() const
+        {
+            return numJobs_;
+        }
+
+    private:
+
+        /**
+         * State of a job.
+         */
+        typedef struct {
+            tJobConfig config;
+
+            std::atomic<uint32_t> periodMicros;
+
+            std::atomic<bool> triggered;
+
+            // Time when the job is due next (periodic jobs) [us]
+            int64_t dueMicros;
+
+            // Period on which dueMicros is based [us]
+            uint32_t gridPeriodMicros;
+
+            // Duration of the previous execution, used as estimate of the next one [us]
+            uint32_t lastDurationMicros;
+
+            std::atomic<uint32_t> runCount;
+
+            std::atomic<uint32_t> deferCount;
+
+            std::atomic<uint32_t> missCount;
+        } tJob;
+
+        I2CBusHealth &bus_;
+
+        uint32_t batchBudgetMicros_;
+
+        tJob jobs_[kMaxJobs];
+
+        uint8_t numJobs_ = 0;
+
+        TaskHandle_t taskHandle_ = nullptr;
+
+        // Serializes the batches and the ad hoc accesses
+        SemaphoreHandle_t mutex_ = nullptr;
+
+        // Start of the current ad hoc access [us]
+        int64_t lockStartMicros_ = 0;
+
+        // Utilization window, protected by mutex_
+        int64_t windowStartMicros_ = 0;
+
+        uint32_t windowBusyMicros_ = 0;
+
+        uint32_t windowMaxBusyMicros_ = 0;
+
+        std::atomic<uint16_t> utilizationPermille_{0};
+
+        std::atomic<uint32_t> maxBusyMicros_{0};
+
+        /**
+         * Executes the due jobs in one batch.
+         */
+        void runBatch();
+
+        /**
+         * Returns the time until the next periodic job is due [RTOS ticks].
+         */
+        TickType_t getWaitTicks();
+
+        /**
+         * Adds a period of bus occupation to the utilization window. Must be called with mutex_ taken.
+         */
+        void accountBusy(int64_t startMicros, int64_t endMicros);
+
+        static void schedulerTask(void *p);
+};
@@ -0,0 +1,117 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "LatencyHistogram.h"
+#include "SeqLock.h"
+
+/**
+ * Traces the age of the inputs contained in each input report at the time the report is sent.
+ *
+ * For each sent report, the age of the freshest and of the stalest input is recorded. The percentiles are
+ * computed over a rolling window of a fixed number of reports. At the end of each window, a summary is
+ * published and the histograms start over. Recording is done by the task that sends the reports, whereas
+ * the summary can be read by any task.
+ *
+ * The class does not depend on the Arduino framework.
+ */
+class InputLatencyTracer
+{
+    public:
+
+        /**
+         * Summary of the input ages over one window [us].
+         */
+        #pragma pack(push, 1)
+        typedef struct {
+            uint32_t numReports;
+            uint32_t freshestP50;
+            uint32_t freshestP99;
+            uint32_t freshestMax;
+            uint32_t stalestP50;
+            uint32_t stalestP99;
+            uint32_t stalestMax;
+        } tSummary;
+        #pragma pack(pop)
+
+        /**
+         * @param windowSize Number of reports per window.
+         */
+        InputLatencyTracer(uint32_t windowSize)
+        : windowSize_{windowSize}
+        {
+        }
+
+        /**
+         * Records the input ages of a report that has just been sent.
+         *
+         * @param freshestAgeMicros Age of the most recent input contained in the report.
+         *
+         * @param stalestAgeMicros Age of the oldest input contained in the report.
+         */
+        void recordReport(uint32_t freshestAgeMicros, uint32_t stalestAgeMicros)
+        {
+            freshest_.record(freshestAgeMicros);
+            stalest_.record(stalestAgeMicros);
+
+            if (freshest_.getCount() >= windowSize_)
+            {
+                tSummary summary;
+
+                summary.numReports  = freshest_.getCount();
+                summary.freshestP50 = freshest_.getPercentile(50);
+                summary.freshestP99 = freshest_.getPercentile(99);
+                summary.freshestMax = freshest_.getMax();
+                summary.stalestP50  = stalest_.getPercentile(50);
+                summary.stalestP99  = stalest_.getPercentile(99);
+                summary.stalestMax  = stalest_.getMax();
+
+                summary_.write(summary);
+
+                freshest_.reset();
+                stalest_.reset();
+            }
+        }
+
+        /**
+         * Returns the summary of the most recently completed window.
+         *
+         * @return Sequence number of the summary, which changes whenever a new summary is published.
+         */
+        inline uint32_t getSummary(tSummary &summary) const
+        {
+            return summary_.read(summary);
+        }
+
+    private:
+
+        uint32_t windowSize_;
+
+        LatencyHistogram freshest_;
+
+        LatencyHistogram stalest_;
+
+        SeqLock<tSummary> summary_;
+};
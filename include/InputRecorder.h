@@ -0,0 +1,147 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "InputTrace.h"
+
+/**
+ * Records an input trace into a ring of blocks, see InputTrace for the format.
+ *
+ * When the ring is full, the oldest block is overwritten, i.e. the recorder keeps the most recent
+ * NumBlocks * InputTrace::kBlockSize bytes of the trace. Since each block starts with a keyframe, the
+ * remaining blocks can still be decoded.
+ *
+ * The recorder is not thread-safe: the callers must serialize record() and the access to the blocks.
+ * The class does not depend on the Arduino framework.
+ *
+ * @tparam NumBlocks Number of blocks of the ring.
+ */
+template <uint16_t NumBlocks>
+class InputRecorder
+{
+    static_assert( NumBlocks > 0, "InputRecorder needs at least one block" );
+
+    public:
+
+        /**
+         * Discards the recorded trace.
+         */
+        void clear()
+        {
+            numBlocks_ = 0;
+            writeBlock_ = NumBlocks - 1;
+            writePos_ = InputTrace::kBlockSize;
+            recordCount_ = 0;
+            overwrittenBlockCount_ = 0;
+        }
+
+        /**
+         * Appends a record to the trace.
+         */
+        void record(const InputTrace::tRecord &record)
+        {
+            if (numBlocks_ == 0)
+            {
+                state_ = record;
+            }
+
+            if (writePos_ + InputTrace::kMaxRecordSize > InputTrace::kBlockSize)
+            {
+                startBlock();
+            }
+
+            writePos_ += InputTrace::encodeRecord(record, state_, &blocks_[writeBlock_][writePos_]);
+            ++recordCount_;
+        }
+
+        /**
+         * Returns the number of blocks in the ring.
+         */
+        inline uint16_t getNumBlocks() const
+        {
+            return numBlocks_;
+        }
+
+        /**
+         * Returns a block of the trace.
+         *
+         * @param blockIdx Index of the block (0 = oldest block, getNumBlocks() - 1 = block currently written).
+         */
+        inline const uint8_t* getBlock(uint16_t blockIdx) const
+        {
+            return blocks_[(writeBlock_ + NumBlocks + 1 - numBlocks_ + blockIdx) % NumBlocks];
+        }
+
+        /**
+         * Returns the number of records since the last call of clear(), including the overwritten ones.
+         */
+        inline uint32_t getRecordCount() const
+        {
+            return recordCount_;
+        }
+
+        inline uint32_t getOverwrittenBlockCount() const
+        {
+            return overwrittenBlockCount_;
+        }
+
+    private:
+
+        uint8_t blocks_[NumBlocks][InputTrace::kBlockSize];
+
+        uint16_t numBlocks_ = 0;
+
+        uint16_t writeBlock_ = NumBlocks - 1;
+
+        uint16_t writePos_ = InputTrace::kBlockSize;
+
+        // Input state after the latest record
+        InputTrace::tRecord state_ = {};
+
+        uint32_t recordCount_ = 0;
+
+        uint32_t overwrittenBlockCount_ = 0;
+
+        /**
+         * Starts the next block with a keyframe of the current state, overwriting the oldest block if the ring is full.
+         */
+        void startBlock()
+        {
+            writeBlock_ = (writeBlock_ + 1) % NumBlocks;
+
+            if (numBlocks_ < NumBlocks)
+            {
+                ++numBlocks_;
+            }
+            else
+            {
+                ++overwrittenBlockCount_;
+            }
+
+            memset(blocks_[writeBlock_], 0xFF, InputTrace::kBlockSize);
+            writePos_ = InputTrace::encodeKeyframe(state_, blocks_[writeBlock_]);
+        }
+};
@@ -0,0 +1,142 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Compact binary format of input traces, i.e. timestamped raw joystick samples and button levels.
+ *
+ * A trace consists of blocks of kBlockSize bytes, which can be decoded independently. Each block starts with a
+ * keyframe holding the absolute input state, followed by records that are delta encoded against the previous
+ * record (or the keyframe):
+ * - Header byte: record type in bits 7..6. JOYSTICK: button of the joystick in bit 0. BUTTONS: levels in bits 5..0.
+ * - Time since the previous record [us] as varint (7 bits per byte, least significant group first).
+ * - JOYSTICK only: change of the raw x- and y-value, each as zigzag-encoded varint.
+ * The unused bytes at the end of a block are 0xFF, which decodes as record type END.
+ *
+ * A joystick sample at a constant sample rate typically takes 4 bytes, a change of the button levels 3 bytes.
+ *
+ * The class does not depend on the Arduino framework.
+ */
+class InputTrace
+{
+    public:
+
+        // Version of the format, written to the header of a dump
+        static const uint8_t kFormatVersion = 1;
+
+        static const uint16_t kBlockSize = 256;
+
+        // Size of the keyframe at the start of each block: time (4 bytes), raw x, raw y, flags
+        static const uint8_t kKeyframeSize = 7;
+
+        // Maximum size of a record: header, time (5 bytes), raw x and y (2 bytes each)
+        static const uint8_t kMaxRecordSize = 10;
+
+        // Maximum number of buttons
+        static const uint8_t kMaxButtons = 6;
+
+        enum tRecordType { JOYSTICK = 0, BUTTONS = 1, END = 3 };
+
+        /**
+         * Input state after a record. The fields of the record type have changed, the others are carried over.
+         */
+        typedef struct {
+            // Time of the record [us, lower 32 bits of esp_timer_get_time()]
+            uint32_t micros;
+
+            uint8_t type;
+
+            // Raw values as read from the joystick unit
+            uint8_t rawX;
+            uint8_t rawY;
+            uint8_t joyPressed;
+
+            // Levels of the buttons (bit number = button index, 1 = pressed)
+            uint8_t btnLevels;
+        } tRecord;
+
+        /**
+         * Writes the keyframe of a block.
+         *
+         * @param state Input state at the start of the block.
+         *
+         * @return Number of bytes written (kKeyframeSize).
+         */
+        static uint8_t encodeKeyframe(const tRecord &state, uint8_t *pOut);
+
+        /**
+         * Writes a record.
+         *
+         * @param record Record to be written. Only the fields of its type are encoded.
+         *
+         * @param state Input state after the previous record, updated to the state after this record.
+         *
+         * @return Number of bytes written (at most kMaxRecordSize).
+         */
+        static uint8_t encodeRecord(const tRecord &record, tRecord &state, uint8_t *pOut);
+
+        /**
+         * Decodes the records of a block one by one.
+         */
+        class BlockReader
+        {
+            public:
+
+                BlockReader(const uint8_t *pBlock);
+
+                /**
+                 * Decodes the next record.
+                 *
+                 * @param record Input state after the record.
+                 *
+                 * @return False, if the end of the block has been reached.
+                 */
+                bool next(tRecord &record);
+
+            private:
+
+                const uint8_t *pBlock_;
+
+                uint16_t pos_;
+
+                tRecord state_;
+
+                bool readVarint(uint32_t &value);
+        };
+
+    private:
+
+        static uint8_t writeVarint(uint32_t value, uint8_t *pOut);
+
+        static inline uint32_t zigzag(int32_t value)
+        {
+            return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+        }
+
+        static inline int32_t unzigzag(uint32_t value)
+        {
+            return (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+        }
+};
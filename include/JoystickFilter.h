@@ -0,0 +1,121 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Filters for the raw joystick values kept in a ring buffer of recent samples.
+ *
+ * - MEDIAN:         Median of the newest samples. Rejects single outliers, e.g. corrupted I2C reads,
+ *                   while preserving steps of the stick position.
+ * - MOVING_AVERAGE: Rounded mean of the newest samples. Reduces ADC noise, but smears outliers.
+ *
+ * The class does not depend on the Arduino framework.
+ */
+class JoystickFilter
+{
+    public:
+
+        enum tFilterType { MEDIAN = 0, MOVING_AVERAGE = 1 };
+
+        // Maximum number of samples a filter can be applied to
+        static const uint8_t kMaxWindowSize = 16;
+
+        /**
+         * Applies the filter to the newest samples of a ring buffer.
+         *
+         * @param type Filter type.
+         *
+         * @param ring Ring buffer of samples.
+         *
+         * @param ringSize Number of entries of the ring buffer.
+         *
+         * @param newestIdx Index of the newest sample in the ring buffer.
+         *
+         * @param windowSize Number of samples to apply the filter to (1..kMaxWindowSize, at most ringSize).
+         *                   Larger values are limited accordingly.
+         *
+         * @return Filtered value.
+         */
+        static uint8_t apply(tFilterType type, const uint8_t ring[], uint8_t ringSize, uint8_t newestIdx, uint8_t windowSize)
+        {
+            uint8_t window[kMaxWindowSize];
+
+            if (windowSize > ringSize)
+            {
+                windowSize = ringSize;
+            }
+
+            if (windowSize > kMaxWindowSize)
+            {
+                windowSize = kMaxWindowSize;
+            }
+
+            if (windowSize == 0)
+            {
+                return ring[newestIdx];
+            }
+
+            // Copy the newest samples, walking backwards from the newest one
+            uint8_t idx = newestIdx;
+
+            for (uint8_t windowIdx = 0; windowIdx < windowSize; ++windowIdx)
+            {
+                window[windowIdx] = ring[idx];
+                idx = (idx == 0) ? (ringSize - 1) : (idx - 1);
+            }
+
+            if (type == tFilterType::MOVING_AVERAGE)
+            {
+                uint16_t sum = 0;
+
+                for (uint8_t windowIdx = 0; windowIdx < windowSize; ++windowIdx)
+                {
+                    sum += window[windowIdx];
+                }
+
+                return (sum + windowSize / 2) / windowSize;
+            }
+            else
+            {
+                // Insertion sort, which is fast for the few samples of the window
+                for (uint8_t i = 1; i < windowSize; ++i)
+                {
+                    uint8_t value = window[i];
+                    uint8_t j = i;
+
+                    while ( (j > 0) && (window[j - 1] > value) )
+                    {
+                        window[j] = window[j - 1];
+                        --j;
+                    }
+
+                    window[j] = value;
+                }
+
+                // Lower median for even window sizes
+                return window[(windowSize - 1) / 2];
+            }
+        }
+};
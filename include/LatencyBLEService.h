@@ -0,0 +1,35 @@
+#pragma once
+
+#include <BLECharacteristic.h>
+#include <BLEService.h>
+#include <BLEDescriptor.h>
+
+#include "InputLatencyTracer.h"
+
+/**
+ * Custom BLE service that provides the input-to-notify latency of the gamepad reports for diagnostic purposes.
+ */
+class LatencyBLEService {
+
+    public:
+
+        const BLEUUID kLatencyServiceUUID   {"5A3C0F6E-2B1D-4E8A-9C47-000000000001"};
+
+        const BLEUUID kInputLatencyUUID     {"5A3C0F6E-2B1D-4E8A-9C47-0000000000A1"};
+
+        LatencyBLEService();
+
+        void start(BLEServer*);
+
+        /**
+         * Sets the value of the read-only input latency characteristic.
+         * 
+         * @param summary : Input ages of the last completed window [us], see InputLatencyTracer::tSummary.
+         */
+        void setInputLatency(const InputLatencyTracer::tSummary &summary);
+
+    private:
+        BLEService*         latencyService_;
+
+        BLECharacteristic*  inputLatency_;
+};
@@ -0,0 +1,124 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Histogram of latency values with fixed, logarithmically scaled buckets.
+ *
+ * Bucket 0 counts the value 0, bucket i (i > 0) counts the values in the range [2^(i-1), 2^i - 1].
+ * Recording a value costs a count-leading-zeros instruction and two increments, so the histogram can be
+ * used on the hot path. Percentiles are resolved to the upper bound of the bucket, i.e. within a factor of 2.
+ */
+class LatencyHistogram
+{
+    public:
+
+        // Number of buckets, sufficient for the full range of uint32_t
+        static const uint8_t kNumBuckets = 33;
+
+        /**
+         * Adds a value to the histogram.
+         *
+         * @param value Latency, e.g. in microseconds.
+         */
+        inline void record(uint32_t value)
+        {
+            uint8_t bucketIdx = (value == 0) ? 0 : 32 - __builtin_clz(value);
+
+            ++buckets_[bucketIdx];
+            ++count_;
+
+            if (value > max_)
+            {
+                max_ = value;
+            }
+        }
+
+        /**
+         * Returns an upper bound for the given percentile of the recorded values.
+         *
+         * @param percent Percentile in the range 0..100.
+         */
+        uint32_t getPercentile(uint8_t percent) const
+        {
+            // Number of values that need to be below or equal to the percentile (rounded up)
+            uint64_t rank = ( (uint64_t) count_ * percent + 99 ) / 100;
+
+            uint32_t cumulated = 0;
+
+            for (uint8_t bucketIdx = 0; bucketIdx < kNumBuckets; ++bucketIdx)
+            {
+                cumulated += buckets_[bucketIdx];
+
+                if ( (cumulated >= rank) && (cumulated > 0) )
+                {
+                    uint32_t upperBound = (bucketIdx == 0) ? 0 : (uint32_t) ( ( (uint64_t) 1 << bucketIdx ) - 1 );
+
+                    // The exact maximum is a tighter bound for the highest bucket
+                    return (upperBound < max_) ? upperBound : max_;
+                }
+            }
+
+            return max_;
+        }
+
+        /**
+         * Returns the number of recorded values.
+         */
+        inline uint32_t getCount() const
+        {
+            return count_;
+        }
+
+        /**
+         * Returns the maximum recorded value.
+         */
+        inline uint32_t getMax() const
+        {
+            return max_;
+        }
+
+        /**
+         * Removes all recorded values.
+         */
+        void reset()
+        {
+            for (uint8_t bucketIdx = 0; bucketIdx < kNumBuckets; ++bucketIdx)
+            {
+                buckets_[bucketIdx] = 0;
+            }
+
+            count_ = 0;
+            max_ = 0;
+        }
+
+    private:
+
+        uint32_t buckets_[kNumBuckets] = {0};
+
+        uint32_t count_ = 0;
+
+        uint32_t max_ = 0;
+};
@@ -22,6 +22,26 @@
 
 #include <Arduino.h>
 #include <M5StickC.h>
+#include <atomic>
+
+#include "SeqLock.h"
+#include "JoystickFilter.h"
+#include "OneEuroFilter.h"
+#include "CenterCalibrator.h"
+#include "AxisMapper.h"
+#include "EdgeDebouncer.h"
+#include "BitSlicedDebouncer.h"
+#include "ButtonReportBuilder.h"
+#include "SpscQueue.h"
+#include "I2CBusHealth.h"
+#include "I2CScheduler.h"
+#include "InputTrace.h"
+#include "InputRecorder.h"
+
+// Number of blocks of the input recorder, which are allocated statically. Can be set by a build flag, e.g. -D INPUT_RECORDER_BLOCKS=64.
+#ifndef INPUT_RECORDER_BLOCKS
+#define INPUT_RECORDER_BLOCKS 8
+#endif
 
 class M5StickC_GamepadIO
 {
@@ -42,24 +62,376 @@ class M5StickC_GamepadIO
 
         static const uint8_t kI2CjoystickUnitNumBytes = 0x03;
 
+        // Time budget of a batch of transactions on the grove bus [us]
+        static const uint32_t kGroveBusBatchBudgetMicros = 1000;
+
+        // Priority of the joystick read job among the jobs on the grove bus
+        static const uint8_t kJoyJobPriority = 10;
+
+        /* Age of the newest joystick sample beyond the expected sample interval after which the joystick values are
+           considered stale [us]. The interval follows the period of process() or the sample rate, see setProcessPeriodMicros(). */
+        static const uint32_t kJoyStaleMarginMicros = 100000;
+
+        // Minimum change of a raw joystick value between two calls of process() that counts as user activity
+        static const uint8_t kActivityMotionThreshold = 2;
+
+        // Minimum deflection of the normalized joystick position that counts as user activity
+        static const uint16_t kActivityDeflectionThreshold = 2048;
+
+        // Index of each button in the button bit masks and arrays
+        static const uint8_t kBtnIdxBlue = 0;
+        static const uint8_t kBtnIdxRed  = 1;
+
+        static const uint8_t kBtnCount = 2;
+
+        // Bit mask with one bit per button (bit number = button index)
+        typedef BitSlicedDebouncer<kBtnCount>::tMask tBtnMask;
+
+        /**
+         * Capture modes of the buttons:
+         * - POLLED:    The button task samples the pins every kBtnTaskDelay and debounces the history of samples.
+         *              A press is reported after the contact has settled, i.e. after 15-25 ms.
+         * - INTERRUPT: Edge interrupts timestamp and report the first edge of a press immediately (leading-edge
+         *              debounce), bounces are rejected during a lockout window, see EdgeDebouncer.
+         */
+        enum tButtonCaptureMode { POLLED = 0, INTERRUPT = 1 };
+
+        // Lockout window of the leading-edge debounce, longer than the bouncing of the buttons [us]
+        static const uint32_t kBtnLockoutMicros = 10000;
+
+        // Capacity of the queue of button edges, covers many edges per report period
+        static const uint16_t kBtnEventQueueSize = 32;
+
+        // Number of blocks of the input recorder, i.e. the recording holds kRecorderBlocks * InputTrace::kBlockSize bytes
+        static const uint16_t kRecorderBlocks = INPUT_RECORDER_BLOCKS;
+
+        /**
+         * Edge of a button as detected by the debouncer.
+         */
+        typedef struct {
+            // Time of the edge [us, lower 32 bits of esp_timer_get_time()]
+            uint32_t micros;
+
+            uint8_t btnIdx;
+
+            // 1 = press, 0 = release
+            uint8_t pressed;
+        } tButtonEvent;
+
+        /**
+         * Acquisition modes of the joystick:
+         * - SYNCHRONOUS:  process() reads the joystick via I2C and waits for the transaction to complete.
+         * - ASYNCHRONOUS: process() consumes the sample completed in the background since the previous call
+         *                 and triggers the next I2C transaction on the grove bus scheduler. Thus, the bus wait
+         *                 overlaps with the work done after process(), e.g. sending the input report.
+         *                 The consumed sample is one call of process() old.
+         * - SAMPLED:      The grove bus scheduler reads the joystick periodically at the sample rate.
+         *                 process() applies the joystick filter to the newest samples, see setJoyFilter().
+         */
+        enum tAcquisitionMode { SYNCHRONOUS = 0, ASYNCHRONOUS = 1, SAMPLED = 2 };
+
+        // Number of raw joystick samples kept in the ring
+        static const uint8_t kJoyRingSize = 8;
+
+        // Default sample rate of mode SAMPLED [Hz]
+        static const uint16_t kDefaultJoySampleRateHz = 500;
+
+        // Nominal center of the joystick. The joystick unit provides values in a range of approx. 0..245
+        static const uint8_t kJoyNominalCenter = 122;
+
+        // Half range of the raw joystick values that is assumed until the actual range has been learned [raw steps]
+        static const uint8_t kJoyDefaultHalfRange = 100;
+
+        // Parameters of the smoothing filter: cutoff at rest 1 Hz, +30 Hz per raw step per ms, cutoff of the speed 1 Hz [Q8]
+        static const uint16_t kJoySmoothingMinCutoffQ8 = 256;
+        static const uint16_t kJoySmoothingBetaQ8 = 7680;
+        static const uint16_t kJoySmoothingDerivCutoffQ8 = 256;
+
+        // Maximum deviation of the learned center from the nominal center [raw steps]. About the radial dead zone of
+        // the stick curve (10 of 128 normalized steps at the default half range), so that a center that is off by more
+        // is more likely a held deflection than a drift.
+        static const uint8_t kCalibrationMaxOffset = 8;
+
+        // Time without button activity and with the stick at rest that is required to refine the center [us]
+        static const uint32_t kCalibrationRestMicros = 3000000;
+
+        // Maximum variance of the raw joystick values at rest [raw steps^2]
+        static const uint8_t kCalibrationMaxVariance = 2;
+
+        // Weight of each confirmed center in the center estimate (1/4)
+        static const uint8_t kCalibrationUpdateShift = 2;
+
+        // Number of consecutive rest periods with consistent means that are required to refine the center
+        static const uint8_t kCalibrationConfirmPeriods = 3;
+
+        // Minimum change of the center that is written to NVS [raw steps with 8 fractional bits]
+        static const uint16_t kCalibrationPersistMinDeltaQ8 = 64;
+
+        // Minimum time between two writes of the center to NVS [ms]
+        static const uint32_t kCalibrationPersistIntervalMillis = 60000;
+
+        /**
+         * Snapshot of all inputs of the gamepad.
+         * Written by process() and readable from any task via getInputState().
+         */
+        typedef struct {
+            // Bit mask of the currently pressed buttons (bit number = button index)
+            tBtnMask btnPressed;
+
+            // Number of "button down" events per button (wraps around). Allows to detect presses between two snapshots.
+            uint8_t btnPressCount[kBtnCount];
+
+            // Time when the button task detected the most recent button event [us, lower 32 bits of esp_timer_get_time()]
+            uint32_t btnEdgeMicros;
+
+            // Time when the joystick values have been read successfully [us, lower 32 bits of esp_timer_get_time()]
+            uint32_t joySampleMicros;
+
+            // Raw joystick values as read from the joystick unit
+            uint8_t joyRawX;
+            uint8_t joyRawY;
+
+            // Button press state of the joystick
+            uint8_t joyPressed;
+
+            // The joystick values are stale, because the joystick could not be read for the expected interval plus kJoyStaleMarginMicros
+            uint8_t joyStale;
+
+            // Normalized joystick positions, i.e. smoothed, calibrated and mapped onto the full stick axis range (-32767..32767)
+            int16_t joyNormX;
+            int16_t joyNormY;
+        } tInputState;
+
         static M5StickC_GamepadIO* getInstance();
 
         /**
          * Performs setup tasks to be able to acquire data from the control elements of the gamepasd.
+         * 
+         * @param taskCore Core on which the button task is executed.
          */
-        void start();
+        void start(BaseType_t taskCore);
+
+        /**
+         * Sets the capture mode of the buttons. Must be called before start().
+         */
+        inline void setButtonCaptureMode(tButtonCaptureMode mode)
+        {
+            if (!initialized_)
+            {
+                btnCaptureMode_ = mode;
+            }
+        }
 
         /**
          * Obtains input values from the control elements and updates the corresponding state variables.
          */
         void process();
 
+        /**
+         * Sets the acquisition mode of the joystick. Can be called from any task, takes effect on the next call of process().
+         */
+        void setAcquisitionMode(tAcquisitionMode mode);
+
+        inline tAcquisitionMode getAcquisitionMode()
+        {
+            return acquisitionMode_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Sets the rate at which the joystick is read in mode SAMPLED. Can be called from any task.
+         * The resolution of the sample period is one RTOS tick, i.e. the rate is rounded to the next feasible one.
+         *
+         * @param rateHz Sample rate [Hz].
+         */
+        void setJoySampleRate(uint16_t rateHz);
+
+        /**
+         * Sets the period at which process() is called, e.g. the tick period of the current rate tier.
+         * In modes SYNCHRONOUS and ASYNCHRONOUS, the joystick is read once per call, so the age at which the joystick
+         * values are considered stale grows with the period. Can be called from any task.
+         *
+         * @param periodMicros Period [us].
+         */
+        inline void setProcessPeriodMicros(uint32_t periodMicros)
+        {
+            processPeriodMicros_.store(periodMicros, std::memory_order_relaxed);
+        }
+
+        /**
+         * Sets the filter that is applied to the joystick samples in mode SAMPLED.
+         * Must be called by the task that calls process().
+         *
+         * @param type Filter type.
+         *
+         * @param windowSize Number of newest samples to apply the filter to (1..kJoyRingSize).
+         */
+        inline void setJoyFilter(JoystickFilter::tFilterType type, uint8_t windowSize)
+        {
+            joyFilterType_ = type;
+            joyFilterWindowSize_ = (windowSize > kJoyRingSize) ? kJoyRingSize : windowSize;
+        }
+
+        /**
+         * Enables or disables the smoothing of the joystick values between the raw read and the normalization,
+         * see OneEuroFilter. Can be called from any task, takes effect on the next call of process().
+         */
+        inline void setJoySmoothing(bool enabled)
+        {
+            joySmoothing_.store(enabled, std::memory_order_relaxed);
+        }
+
+        inline bool getJoySmoothing()
+        {
+            return joySmoothing_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Writes the learned joystick center and range to NVS (non-volatile storage), if they have changed significantly.
+         * Writes are coalesced to at most one per kCalibrationPersistIntervalMillis to limit flash wear,
+         * i.e. the function can be called frequently. It should be called by a low priority task, because
+         * writing to flash takes several milliseconds. Must only be called by a single task.
+         */
+        void persistCalibration();
+
+        /**
+         * Discards the learned joystick center and range and removes them from NVS, e.g. after a range has been learned
+         * from a faulty joystick unit. The calibration in use is reset on the next call of process().
+         * Must be called by the task that calls persistCalibration().
+         */
+        void resetCalibration();
+
+        /**
+         * Returns the duration of the I2C transaction of the joystick sample consumed by the last call of process() [us].
+         * In mode SYNCHRONOUS, process() waits for this time. In mode ASYNCHRONOUS, the time is spent in the background.
+         * Must be called by the task that calls process().
+         */
+        inline uint32_t getJoyReadMicros()
+        {
+            return joyReadMicros_;
+        }
+
+        /**
+         * Returns the health monitor of the I2C bus of the joystick unit. Its counters can be read from any task.
+         */
+        inline const I2CBusHealth& getJoyBusHealth()
+        {
+            return joyBus_;
+        }
+
+        /**
+         * Returns the scheduler of the grove bus, e.g. to add jobs of further devices before start()
+         * or to query the bus utilization.
+         */
+        inline I2CScheduler& getGroveBus()
+        {
+            return groveBus_;
+        }
+
+        /**
+         * Returns the ID of the joystick read job on the grove bus.
+         */
+        inline int8_t getJoyJobId()
+        {
+            return joyJobId_;
+        }
+
+        /**
+         * Returns a consistent snapshot of all inputs as of the last call of process().
+         * Can be called from any task without locking.
+         */
+        inline tInputState getInputState()
+        {
+            return inputState_.read();
+        }
+
+        /**
+         * Returns the current state of the button with the given index.
+         */
+        inline uint8_t isBtnPressed(uint8_t btnIdx)
+        {
+            return (inputState_.read().btnPressed >> btnIdx) & 1;
+        }
+
+        /**
+         * Returns 1, if the button with the given index has been pressed since the last call of this function.
+         * Must only be called by a single consumer task, which is usually the one that calls process().
+         */
+        inline uint8_t wasBtnPressed(uint8_t btnIdx)
+        {
+            uint8_t pressCount = inputState_.read().btnPressCount[btnIdx];
+
+            uint8_t result = (pressCount != btnPressCountSeen_[btnIdx]);
+
+            btnPressCountSeen_[btnIdx] = pressCount;
+
+            return result;
+        }
+
+        /**
+         * Returns 1 if the button with the given index is pressed or has been pressed since the last call.
+         * Must only be called by a single consumer task, see wasBtnPressed().
+         */
+        inline uint8_t getBtnActivation(uint8_t btnIdx)
+        {
+            // Evaluate both functions, so that the press is consumed even if the button is still held
+            uint8_t pressed = isBtnPressed(btnIdx);
+            uint8_t pressedBefore = wasBtnPressed(btnIdx);
+
+            return pressed || pressedBefore;
+        }
+
+        /**
+         * Returns the button states to be sent in the next input report.
+         * Applies at most one pending edge per button, so that every press appears in at least one report and
+         * every release in a later one, see ButtonReportBuilder. No edge is lost between two reports.
+         * Must be called once per input report by the task that builds the reports.
+         *
+         * @param applyEdge True, if the report is sent for sure. Otherwise, the pending edges are only collected and
+         *                  the button states of the previous call are returned, so that a report that is replaced
+         *                  before it is sent cannot swallow an edge.
+         */
+        tBtnMask getReportButtons(bool applyEdge);
+
+        /**
+         * Returns the number of taps that have been coalesced with a later tap, since they could not be reported in time.
+         */
+        inline uint32_t getCoalescedTapCount()
+        {
+            return btnReportBuilder_.getCoalescedTapCount();
+        }
+
+        /**
+         * Returns the number of button edges that have been lost because the event queue was full.
+         */
+        inline uint32_t getBtnEventOverflowCount()
+        {
+            return btnEventOverflowCount_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Starts or stops recording the raw joystick samples and button levels, see InputRecorder.
+         * Starting discards the previous recording. Can be called from any task.
+         */
+        void setInputRecording(bool enabled);
+
+        inline bool isInputRecording()
+        {
+            return inputRecording_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Writes the recording as text, one block per line in hexadecimal ("B <hex>"), framed by comment lines ("# ...").
+         * The dump can be replayed on a host computer by the tool replay_trace (tools/). Recording is paused during the dump.
+         * Must only be called by a single task at a time, which should have low priority, since the dump takes a while.
+         */
+        void dumpInputRecording(Print &out);
+
         /**
          * Returns the current state of the blue button.
          */
         inline uint8_t isBtnBluePressed()
         {
-            return btnBlueState_;
+            return isBtnPressed(kBtnIdxBlue);
         }
 
         /**
@@ -69,13 +441,7 @@ class M5StickC_GamepadIO
          */
         inline uint8_t wasBtnBluePressed()
         {
-            // Save flag value
-            uint8_t result = btnBlueFlag_;
-
-            // Reset flag
-            btnBlueFlag_ = 0;
-
-            return result;
+            return wasBtnPressed(kBtnIdxBlue);
         }
 
         /**
@@ -83,43 +449,46 @@ class M5StickC_GamepadIO
          */
         inline uint8_t getBtnBlueActivation()
         {
-            return isBtnBluePressed() || wasBtnBluePressed();
+            return getBtnActivation(kBtnIdxBlue);
         }
 
         inline uint8_t isBtnRedPressed()
         {
-            return btnRedState_;
+            return isBtnPressed(kBtnIdxRed);
         }
 
         inline uint8_t wasBtnRedPressed()
         {
-            // Save flag value
-            uint8_t result = btnRedState_;
-
-            // Reset flag
-            btnRedState_ = 0;
-
-            return result;
+            return wasBtnPressed(kBtnIdxRed);
         }
 
         inline uint8_t getBtnRedActivation()
         {
-            return isBtnRedPressed() || wasBtnRedPressed();
+            return getBtnActivation(kBtnIdxRed);
         }
 
-        inline int8_t getJoyNormX()
+        inline int16_t getJoyNormX()
         {
-            return joyNormX_;
+            return inputState_.read().joyNormX;
         }
 
-        inline int8_t getJoyNormY()
+        inline int16_t getJoyNormY()
         {
-            return joyNormY_;
+            return inputState_.read().joyNormY;
         }
 
         inline uint8_t isJoyPressed()
         {
-            return joyPressed_;
+            return inputState_.read().joyPressed;
+        }
+
+        /**
+         * Returns true, if the last call of process() detected user activity,
+         * i.e. joystick motion, a deflected joystick or a pressed button.
+         */
+        inline bool isActive()
+        {
+            return active_;
         }
 
         M5StickC_GamepadIO(const M5StickC_GamepadIO&) = delete;
@@ -141,24 +510,283 @@ class M5StickC_GamepadIO
         // Initialization flag
         bool initialized_ = false;
 
-        // Flag that blue button has been pressed, set by interrupt service routine
-        volatile uint8_t btnBlueFlag_ = 0;
+        std::atomic<tAcquisitionMode> acquisitionMode_{tAcquisitionMode::SYNCHRONOUS};
+
+        /**
+         * Result of one I2C transaction with the joystick unit.
+         */
+        typedef struct {
+            uint8_t valid;
+            uint8_t rawX;
+            uint8_t rawY;
+            uint8_t pressed;
+
+            // Time when the transaction has been completed [us]
+            uint32_t sampleMicros;
+
+            // Duration of the transaction [us]
+            uint32_t readMicros;
+        } tJoySample;
 
-        // Flag that red button has been pressed, set by interrupt service routine
-        volatile uint8_t btnRedFlag_ = 0;
+        /**
+         * Ring buffer of the newest raw joystick samples acquired in the background.
+         * Unsuccessful reads are not added to the ring, but counted.
+         */
+        typedef struct {
+            uint8_t rawX[kJoyRingSize];
+            uint8_t rawY[kJoyRingSize];
+
+            // Button press state of the joystick as of the newest sample
+            uint8_t pressed;
+
+            // Index of the newest sample
+            uint8_t newestIdx;
+
+            // Number of samples in the ring (saturates at kJoyRingSize)
+            uint8_t numSamples;
+
+            // Number of successful reads
+            uint32_t sampleCount;
+
+            // Time of the newest sample [us]
+            uint32_t sampleMicros;
+
+            // Duration of the most recent transaction [us]
+            uint32_t readMicros;
+        } tJoyRing;
+
+        // Samples acquired in the background, written only by the grove bus scheduler task
+        SeqLock<tJoyRing> joyRing_;
+
+        // Working copy of the ring, owned by the grove bus scheduler task
+        tJoyRing samplerRing_ = {};
 
-        // State of blue button
-        uint8_t btnBlueState_ = 0;
+        // Sample count of the ring as of the last call of process()
+        uint32_t joySampleCountSeen_ = 0;
 
-        // State of red button
-        uint8_t btnRedState_ = 0;
+        // Duration of the I2C transaction of the last consumed sample [us]
+        uint32_t joyReadMicros_ = 0;
 
+        // Filter applied in mode SAMPLED, owned by the task that calls process()
+        JoystickFilter::tFilterType joyFilterType_ = JoystickFilter::tFilterType::MEDIAN;
+
+        uint8_t joyFilterWindowSize_ = 5;
+
+        // Sample period of mode SAMPLED [us]
+        std::atomic<uint32_t> joySamplePeriodMicros_{0};
+
+        // Period at which process() is called, i.e. the sample period of the other modes [us]
+        std::atomic<uint32_t> processPeriodMicros_{0};
+
+        // I2C bus of the joystick unit (grove port)
+        I2CBusHealth joyBus_{Wire, kI2CpinSda, kI2CpinScl, kI2Cfreq};
+
+        // Owns the grove bus: executes the joystick read job, other accesses must lock the bus
+        I2CScheduler groveBus_{joyBus_, kGroveBusBatchBudgetMicros};
+
+        // ID of the joystick read job, periodic in mode SAMPLED and triggered by process() in mode ASYNCHRONOUS
+        int8_t joyJobId_ = I2CScheduler::kInvalidJobId;
+
+        /**
+         * Sets the period of the joystick read job according to the acquisition mode.
+         */
+        void updateJoyJobPeriod();
 
-        // Joystick center value for x-axis. The joystick unit provides values in a range of approx. 0..245
-        uint8_t joyRawCenterX_ = 122; // @TODO determine dynamically, e.g. no user action for x seconds and value within specified range
+        /**
+         * Returns the age of the newest joystick sample after which the joystick values are considered stale [us].
+         */
+        uint32_t getJoyStaleMicros();
+
+        /**
+         * Reads the joystick values via I2C and waits for the transaction to complete.
+         */
+        void readJoystick(tJoySample &sample);
+
+        /**
+         * Obtains a joystick sample according to the acquisition mode.
+         *
+         * @return False, if no new sample has been completed successfully since the previous call.
+         *         In mode SYNCHRONOUS, the sample is always returned and marked as invalid on errors.
+         */
+        bool acquireJoystick(tJoySample &sample);
+
+        /**
+         * Completes the joystick read job (mode SAMPLED or ASYNCHRONOUS): adds the sample to the ring and publishes the ring.
+         * Executed by the grove bus scheduler task.
+         */
+        static void onJoystickRead(void *pContext, const I2CScheduler::tCompletion &completion);
+
+        /**
+         * State of the buttons as determined by the button task.
+         */
+        typedef struct {
+            // Bit mask of the currently pressed buttons (bit number = button index)
+            tBtnMask btnPressed;
+
+            // Number of "button down" events per button (wraps around)
+            uint8_t btnPressCount[kBtnCount];
+
+            // Time when the most recent button event has been detected [us]
+            uint32_t btnEdgeMicros;
+        } tButtonState;
+
+        tButtonCaptureMode btnCaptureMode_ = tButtonCaptureMode::INTERRUPT;
+
+        // Button state, written only by the button task
+        SeqLock<tButtonState> buttonState_;
+
+        // Working copy of the button state, owned by the button task
+        tButtonState btnTaskState_ = {};
+
+        // Edges of all buttons, from the button task to the task that builds the reports
+        SpscQueue<tButtonEvent, kBtnEventQueueSize> btnEventQueue_;
+
+        // Number of edges lost because the queue was full
+        std::atomic<uint32_t> btnEventOverflowCount_{0};
+
+        // Overflow count as of the previous call of getReportButtons()
+        uint32_t btnEventOverflowSeen_ = 0;
+
+        // Button levels as of the most recent recorded sample, written only by the button task
+        std::atomic<uint8_t> recBtnLevels_{0};
+
+        // Button states of the reports, owned by the task that builds the reports
+        ButtonReportBuilder<kBtnCount> btnReportBuilder_;
+
+        /**
+         * Appends an edge to the button event queue. Must only be called by the button task.
+         */
+        inline void pushButtonEvent(uint8_t btnIdx, bool pressed, uint32_t micros)
+        {
+            if ( !btnEventQueue_.push({micros, btnIdx, pressed}) )
+            {
+                btnEventOverflowCount_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * Records a change of the button levels, if recording is enabled. Must only be called by the button task.
+         *
+         * @param levels Bit mask of the buttons whose pins are currently at the "pressed" level.
+         */
+        inline void recordButtonLevels(tBtnMask levels)
+        {
+            if (levels == recBtnLevels_.load(std::memory_order_relaxed))
+            {
+                return;
+            }
 
-        // Joystick center value for y-axis. The joystick unit provides values in a range of approx. 0..245
-        uint8_t joyRawCenterY_ = 122; // @TODO determine dynamically, e.g. no user action for x seconds and value within specified range
+            recBtnLevels_.store(levels, std::memory_order_relaxed);
+
+            InputTrace::tRecord record = {};
+            record.micros = (uint32_t) esp_timer_get_time();
+            record.type = InputTrace::BUTTONS;
+            record.btnLevels = levels;
+
+            recordInput(record);
+        }
+
+        /**
+         * Records a successful read of the joystick unit, if recording is enabled.
+         * Called by the task that reads the joystick, i.e. process() or the grove bus scheduler task.
+         */
+        inline void recordJoystick(const uint8_t *pData, uint32_t micros)
+        {
+            InputTrace::tRecord record;
+            record.micros = micros;
+            record.type = InputTrace::JOYSTICK;
+            record.rawX = pData[0];
+            record.rawY = pData[1];
+            record.joyPressed = pData[2];
+            record.btnLevels = recBtnLevels_.load(std::memory_order_relaxed);
+
+            recordInput(record);
+        }
+
+        /**
+         * Appends a record to the recording, if recording is enabled. Records of different tasks may be
+         * slightly out of order, since they are timestamped before taking the lock.
+         */
+        inline void recordInput(const InputTrace::tRecord &record)
+        {
+            if (!isInputRecording())
+            {
+                return;
+            }
+
+            portENTER_CRITICAL(&recMux_);
+            inputRecorder_.record(record);
+            portEXIT_CRITICAL(&recMux_);
+        }
+
+        // Recording of the raw inputs, protected by recMux_
+        InputRecorder<kRecorderBlocks> inputRecorder_;
+
+        portMUX_TYPE recMux_ = portMUX_INITIALIZER_UNLOCKED;
+
+        std::atomic<bool> inputRecording_{false};
+
+        // Snapshot of all inputs, written only by process()
+        SeqLock<tInputState> inputState_;
+
+        // Button press counts that have been consumed by wasBtnPressed(), owned by the consumer task
+        uint8_t btnPressCountSeen_[kBtnCount] = {0};
+
+        // Button press counts as of the previous call of process(), used for activity detection
+        uint8_t prevBtnPressCount_[kBtnCount] = {0};
+
+
+        // Map the raw joystick values onto the stick axis range (x, y), owned by the task that calls process()
+        AxisMapper joyMapper_[CenterCalibrator::kNumAxes] = {
+            {kJoyNominalCenter, kJoyDefaultHalfRange, false},
+            {kJoyNominalCenter, kJoyDefaultHalfRange, true}   // Up is positive on the joystick unit, but negative on the host
+        };
+
+        // Learns the joystick center while the stick is at rest, owned by the task that calls process()
+        CenterCalibrator centerCalibrator_{kJoyNominalCenter, kCalibrationMaxOffset, kCalibrationRestMicros,
+                                           kCalibrationMaxVariance, kCalibrationUpdateShift, kCalibrationConfirmPeriods};
+
+        /**
+         * Joystick calibration per axis (x, y).
+         */
+        typedef struct {
+            // Center with 8 fractional bits
+            uint16_t centerQ8[CenterCalibrator::kNumAxes];
+
+            // Raw extremes
+            uint8_t rawMin[CenterCalibrator::kNumAxes];
+            uint8_t rawMax[CenterCalibrator::kNumAxes];
+        } tCalibration;
+
+        // Learned calibration, written only by process()
+        SeqLock<tCalibration> calibration_;
+
+        // Calibration as stored in NVS, owned by the task that calls persistCalibration()
+        tCalibration persistedCalibration_ = {};
+
+        // Time of the last write to NVS [ms]
+        uint32_t lastPersistMillis_ = 0;
+
+        // Set by resetCalibration(), cleared by process() once the calibration in use has been reset
+        std::atomic<bool> calibrationResetPending_{false};
+
+        // True, if persistCalibration() has to adopt the reset calibration as stored, owned by the task that calls it
+        bool calibrationResetPersisted_ = false;
+
+        // NVS namespace and keys of the joystick calibration
+        static const char* const kCalibrationNamespace;
+        static const char* const kCalibrationKeys[CenterCalibrator::kNumAxes];
+        static const char* const kRangeKeys[CenterCalibrator::kNumAxes];
+
+        /**
+         * Loads the joystick calibration from NVS. Called by start().
+         */
+        void loadCalibration();
+
+        /**
+         * Publishes the current calibration for persistCalibration().
+         */
+        void publishCalibration();
 
         // Current x-position value of the joystick
         uint8_t joyRawX_ = 0;
@@ -169,138 +797,157 @@ class M5StickC_GamepadIO
         // Current button press state of the joystick
         uint8_t joyPressed_ = 0;
 
-        // Factor applied to joystick x-position. It is meant to be used for inversion.
-        uint8_t joyFactorX_ = 1;
+        // Time of the most recent successful joystick read [us]
+        uint32_t joySampleMicros_ = 0;
+
+        // No successful joystick read for the expected interval plus kJoyStaleMarginMicros
+        bool joyStale_ = true;
 
-        // Factor applied to joystick y-position. It is meant to be used for inversion.
-        uint8_t joyFactorY_ = -1;
+        // Previous x-position value of the joystick, used for activity detection
+        uint8_t prevJoyRawX_ = 0;
 
-        // Normalized joystick x-position, i.e. centered around zero and multiplied by factor
-        int8_t joyNormX_ = 0;
+        // Previous y-position value of the joystick, used for activity detection
+        uint8_t prevJoyRawY_ = 0;
+
+        // User activity detected by the last call of process()
+        bool active_ = false;
+
+        // Normalized joystick x-position, i.e. calibrated and mapped onto the full stick axis range
+        int16_t joyNormX_ = 0;
         
-        // Normalized joystick y-position, i.e. centered around zero and multiplied by factor
-        int8_t joyNormY_ = 0;
+        // Normalized joystick y-position, i.e. calibrated and mapped onto the full stick axis range
+        int16_t joyNormY_ = 0;
 
-        /**
-         * Function is activated by an interrupt that is attached to GPIO pin of blue button
-         */
-        /*inline static void IRAM_ATTR isrBtnBlue(void *p)
-        {
-            // Read current button state
-            uint8_t state = !digitalRead(kPinButtonBlue);
+        // Smooths the raw joystick values per axis (x, y) in all acquisition modes
+        OneEuroFilter joySmoothingFilter_[CenterCalibrator::kNumAxes] = {
+            {kJoySmoothingMinCutoffQ8, kJoySmoothingBetaQ8, kJoySmoothingDerivCutoffQ8},
+            {kJoySmoothingMinCutoffQ8, kJoySmoothingBetaQ8, kJoySmoothingDerivCutoffQ8}
+        };
 
-            // Store button state
-            ((M5StickC_GamepadIO*) p)->btnBlueState_ = state;
+        std::atomic<bool> joySmoothing_{true};
 
-            // Set flag to indicate that the butten has been pressed
-            if (state)
-                ((M5StickC_GamepadIO*) p)->btnBlueFlag_ = 1;
-        }*/
+        // Smoothed joystick values [raw steps, Q8]
+        uint16_t joySmoothedQ8_[CenterCalibrator::kNumAxes] = {kJoyNominalCenter << 8, kJoyNominalCenter << 8};
+
+        /* Note: The joystick members above are working variables of process() and must not be accessed by other tasks.
+           Other tasks obtain the values from the snapshot, see getInputState(). */
+
+        // Debounces the edges captured by the button interrupts (mode INTERRUPT), protected by btnMux_
+        EdgeDebouncer btnDebouncer_[kBtnCount] = { EdgeDebouncer{kBtnLockoutMicros}, EdgeDebouncer{kBtnLockoutMicros} };
+
+        // Protects the debouncers against concurrent access by the interrupt routines and the button task
+        portMUX_TYPE btnMux_ = portMUX_INITIALIZER_UNLOCKED;
 
         /**
-         * Function is activated by an interrupt that is attached to GPIO pin of red button
+         * Argument of the interrupt routine of a button.
+         * Resides in RAM, since the interrupt routine may run while the flash cache is disabled.
          */
-        /*inline static void IRAM_ATTR isrBtnRed(void *p)
-        {
-            // Read current button state
-            uint8_t state = !digitalRead(kPinButtonRed);
+        typedef struct {
+            M5StickC_GamepadIO *pGamepadIO;
+            uint8_t btnIdx;
+            uint8_t pin;
+        } tBtnIsrArg;
 
-            // Store button state
-            ((M5StickC_GamepadIO*) p)->btnRedState_ = state;
+        tBtnIsrArg btnIsrArg_[kBtnCount];
 
-            // Set flag to indicate that the butten has been pressed
-            if (state)
-                ((M5StickC_GamepadIO*) p)->btnRedFlag_ = 1;
-        }*/
+        // Handle of the button task, notified by the interrupt routines
+        TaskHandle_t buttonTaskHandle_ = nullptr;
 
-        static const uint8_t kBtnCount = 2;
+        /**
+         * Interrupt routine attached to the GPIO pin of each button (both edges).
+         * Reads and timestamps the level, debounces it and wakes up the button task on a change.
+         */
+        static void isrButton(void *p);
 
-        static const uint8_t kBtnPin[kBtnCount];
+        /**
+         * Takes over the debounced button states into the button state (mode INTERRUPT).
+         * Called by the button task on each notification by the interrupt routines and periodically.
+         */
+        void updateButtonStatesFromDebouncers();
 
-        static const uint8_t kBtnEvDown = 1;
-        static const uint8_t kBtnEvUp   = 2;
+        static const uint8_t kBtnPin[kBtnCount];
 
         static const TickType_t kBtnTaskDelay = 5 / portTICK_PERIOD_MS;
 
-        // Constants for detection of button actions
-        static const uint8_t kPatternMask  = 0b11100111;
-        static const uint8_t kPatternDown  = 0b00000111;
-        static const uint8_t kPatternUp    = 0b11100000;
+        // Debounces the sampled button states (mode POLLED), owned by the button task
+        BitSlicedDebouncer<kBtnCount> btnDebouncerPolled_;
 
         /**
          * Continuously reads and processes the button states from the digital IO pins at a frequency of about 200 Hz.
          * Updates button histories, performs debouncing, and detects button down and button up events.
+         * In mode INTERRUPT, takes over the debounced states whenever an interrupt routine reports a change.
          * This function is exectuted inside of a high priority task.
          */
         inline static void buttonTask(void *p)
         {   
+            M5StickC_GamepadIO *pGamepadIO = (M5StickC_GamepadIO*) p;
+
             while (true)
             {
-                // Initalize a static buffer for state history (on the first execution of this function)
-                static uint8_t btnHistories[kBtnCount] = {0};
+                if (pGamepadIO->btnCaptureMode_ == tButtonCaptureMode::INTERRUPT)
+                {
+                    // Wait for a change reported by an interrupt routine, but poll at least every kBtnTaskDelay
+                    ulTaskNotifyTake(pdTRUE, kBtnTaskDelay);
+
+                    pGamepadIO->updateButtonStatesFromDebouncers();
 
-                // Initalize a static buffer for storing button events (on the first execution of this function)
-                static uint8_t btnEvents[kBtnCount] = {0};
+                    continue;
+                }
+
+                // Sample all buttons into a bit mask
+                tBtnMask sample = 0;
 
-                // Loop over all buttons
                 for (uint8_t btnIdx = 0; btnIdx < kBtnCount; ++btnIdx)
                 {
-                    // Update history of the button by appending current state bit at the end
-                    btnHistories[btnIdx] = ( btnHistories[btnIdx] << 1 ) | ( !digitalRead( kBtnPin[btnIdx] ) );
-
-                    // Apply bit mask to cancel out irrelevant bits (i.e. where the signal may bounce)
-                    uint8_t btnHistMasked = btnHistories[btnIdx] & kPatternMask;
-
-                    // Check history for "button down" pattern
-                    if (btnHistMasked == kPatternDown)
-                    {
-                        btnEvents[btnIdx] = kBtnEvDown;
-                        btnHistories[btnIdx] = 0xFF;
-                    }
-                    else
-                        // Check history for "button up" pattern
-                        if (btnHistMasked == kPatternUp)
-                        {
-                            btnEvents[btnIdx] = kBtnEvUp;
-                            btnHistories[btnIdx] = 0x00;
-                        }
-                    
-                } // end of for loop over all buttons
-
-                // Update button flags and states based on the detected events
-                ((M5StickC_GamepadIO*) p)->updateButtonStates(btnEvents);
+                    sample |= (tBtnMask) ( !digitalRead( kBtnPin[btnIdx] ) ) << btnIdx;
+                }
+
+                pGamepadIO->recordButtonLevels(sample);
+
+                // Debounce all buttons at once and update the button states based on the detected events
+                pGamepadIO->btnDebouncerPolled_.update(sample);
+                pGamepadIO->updateButtonStates(pGamepadIO->btnDebouncerPolled_.getDownEvents(), pGamepadIO->btnDebouncerPolled_.getUpEvents());
 
                 // Let other tasks execute
                 vTaskDelay(kBtnTaskDelay);
             }
         }
 
-        inline void updateButtonStates(uint8_t btnEvents[])
+        /**
+         * Applies "button down" and "button up" events to the button state and publishes it.
+         *
+         * @param downEvents, upEvents Bit masks of the buttons with the respective event.
+         */
+        inline void updateButtonStates(tBtnMask downEvents, tBtnMask upEvents)
         {
-            // @TODO: Add semaphore to avoid race conditions?
+            bool changed = (downEvents | upEvents) != 0;
 
-            switch (btnEvents[0])
+            if (!changed)
             {
-                case kBtnEvDown:
-                    btnBlueFlag_  = 1;
-                    btnBlueState_ = 1;
-                    break;
-
-                case kBtnEvUp:
-                    btnBlueState_ = 0;
-                    break;
+                return;
             }
 
-            switch (btnEvents[1])
+            uint32_t nowMicros = (uint32_t) esp_timer_get_time();
+
+            btnTaskState_.btnPressed = (btnTaskState_.btnPressed | downEvents) & ~upEvents;
+
+            // Count and queue the presses, iterating over the set bits only
+            for (tBtnMask pending = downEvents; pending != 0; pending &= pending - 1)
             {
-                case kBtnEvDown:
-                    btnRedFlag_   = 1;
-                    btnRedState_  = 1;
-                    break;
-
-                case kBtnEvUp:
-                    btnRedState_  = 0;
-                    break;
+                uint8_t btnIdx = __builtin_ctz(pending);
+
+                ++btnTaskState_.btnPressCount[btnIdx];
+                pushButtonEvent(btnIdx, true, nowMicros);
             }
+
+            for (tBtnMask pending = upEvents; pending != 0; pending &= pending - 1)
+            {
+                pushButtonEvent(__builtin_ctz(pending), false, nowMicros);
+            }
+
+            // Publish the new state without blocking (the button task is the only writer)
+            btnTaskState_.btnEdgeMicros = nowMicros;
+
+            buttonState_.write(btnTaskState_);
         }
 };
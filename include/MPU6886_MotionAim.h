@@ -0,0 +1,204 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+#include "I2CScheduler.h"
+#include "GyroAim.h"
+#include "SeqLock.h"
+
+/**
+ * Provides gyro aim based on the built-in IMU (MPU6886) of the M5StickC, see GyroAim.
+ *
+ * The IMU writes its samples to its FIFO at kSampleRateHz. A periodic job on the internal I2C bus reads the
+ * FIFO level and drains the complete frames in a single burst read, instead of reading the sample registers
+ * once per sample. The samples are processed right away in the scheduler task of the bus, and the resulting
+ * stick deflection is published for the task that builds the input reports.
+ *
+ * The bus time and the CPU time of each job execution (slot) are measured.
+ */
+class MPU6886_MotionAim
+{
+    public:
+
+        // I2C address of the MPU6886
+        static const uint8_t kI2Caddr = 0x68;
+
+        // Output data rate of the IMU [Hz]
+        static const uint16_t kSampleRateHz = 200;
+
+        // Frame in the FIFO: accelerometer (6 bytes), temperature (2 bytes), gyroscope (6 bytes), big endian
+        static const uint8_t kFrameBytes = 14;
+
+        // Maximum number of frames per burst read, limited by the buffer of the I2C driver
+        static const uint8_t kMaxFramesPerRead = 8;
+
+        // Scale of the gyroscope at a full scale range of +/-1000 dps [LSB per 10 dps]
+        static const uint16_t kGyroLsbPer10Dps = 328;
+
+        // Default angular rate for full deflection [dps]
+        static const uint16_t kDefaultSensitivityDps = 180;
+
+        /**
+         * Stick deflection determined from the gyroscope.
+         */
+        typedef struct {
+            int16_t stickX;
+            int16_t stickY;
+
+            // Time of the newest sample [us, lower 32 bits of esp_timer_get_time()]
+            uint32_t sampleMicros;
+        } tAim;
+
+        /**
+         * Timing of the most recent and of the slowest job execution [us].
+         */
+        typedef struct {
+            uint32_t busMicros;
+            uint32_t cpuMicros;
+            uint32_t busMaxMicros;
+            uint32_t cpuMaxMicros;
+        } tSlotTiming;
+
+        /**
+         * @param bus Scheduler of the internal I2C bus.
+         *
+         * @param aim Conversion of the angular rate into the stick deflection.
+         */
+        MPU6886_MotionAim(I2CScheduler &bus, const GyroAim &aim);
+
+        /**
+         * Configures the IMU and registers the read job. Must be called before the bus scheduler is started.
+         *
+         * @param periodMicros Period of the read job (slot) [us].
+         *
+         * @param priority Priority of the read job.
+         *
+         * @return False, if the IMU could not be found.
+         */
+        bool start(uint32_t periodMicros, uint8_t priority);
+
+        /**
+         * Starts or stops reading the IMU. Can be called from any task.
+         */
+        void setEnabled(bool enabled);
+
+        /**
+         * Sets the angular rate for full deflection [dps]. Can be called from any task.
+         */
+        inline void setSensitivity(uint16_t fullDeflectionDps)
+        {
+            sensitivityDps_.store(fullDeflectionDps, std::memory_order_relaxed);
+        }
+
+        /**
+         * Selects how the angular rate is mapped to the deflection, see GyroAim. Can be called from any task.
+         */
+        inline void setMode(GyroAim::tMode mode)
+        {
+            mode_.store(mode, std::memory_order_relaxed);
+        }
+
+        inline GyroAim::tMode getMode() const
+        {
+            return mode_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Returns the most recent stick deflection. Can be called from any task.
+         */
+        inline tAim getAim() const
+        {
+            return aim_.read();
+        }
+
+        /**
+         * Returns the timing of the job executions. Can be called from any task.
+         */
+        inline tSlotTiming getSlotTiming() const
+        {
+            return slotTiming_.read();
+        }
+
+        inline uint32_t getFrameCount() const
+        {
+            return frameCount_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Returns the number of times the FIFO has overflowed and has been reset.
+         */
+        inline uint32_t getOverflowCount() const
+        {
+            return overflowCount_.load(std::memory_order_relaxed);
+        }
+
+        inline uint32_t getReadErrorCount() const
+        {
+            return readErrorCount_.load(std::memory_order_relaxed);
+        }
+
+    private:
+
+        I2CScheduler &bus_;
+
+        // Owned by the scheduler task after start()
+        GyroAim gyroAim_;
+
+        int8_t jobId_ = I2CScheduler::kInvalidJobId;
+
+        uint32_t periodMicros_ = 0;
+
+        std::atomic<uint16_t> sensitivityDps_{kDefaultSensitivityDps};
+
+        // Sensitivity applied to gyroAim_, owned by the scheduler task
+        uint16_t appliedSensitivityDps_ = 0;
+
+        std::atomic<GyroAim::tMode> mode_{GyroAim::RATE};
+
+        SeqLock<tAim> aim_;
+
+        SeqLock<tSlotTiming> slotTiming_;
+
+        // Working copy of the timing, owned by the scheduler task
+        tSlotTiming timing_ = {};
+
+        std::atomic<uint32_t> frameCount_{0};
+
+        std::atomic<uint32_t> overflowCount_{0};
+
+        std::atomic<uint32_t> readErrorCount_{0};
+
+        /**
+         * Writes the configuration of the IMU and enables the FIFO.
+         */
+        bool configure(I2CBusHealth &bus);
+
+        /**
+         * Completes the read of the FIFO level: drains the FIFO and processes the samples.
+         * Executed by the scheduler task of the bus.
+         */
+        static void onFifoCount(void *pContext, const I2CScheduler::tCompletion &completion);
+};
@@ -0,0 +1,109 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Adaptive low-pass filter for a stick axis (One Euro filter) in fixed-point math.
+ *
+ * The cutoff frequency of the low-pass filter rises with the speed of the signal: at rest, the cutoff is
+ * minCutoff and the jitter is smoothed heavily. During fast motion, the cutoff increases by beta per unit of
+ * speed, so the filter follows with little lag. The speed is the derivative of the signal, smoothed by a
+ * low-pass filter with a fixed cutoff.
+ *
+ * Values are raw stick positions with 8 fractional bits (Q8), the smoothing factors are in Q15. The time
+ * between two samples is taken from their timestamps, i.e. the filter adapts to irregular sample periods.
+ * Three 32-bit divisions per sample, no floating point and no 64-bit division.
+ *
+ * The class does not depend on the Arduino framework.
+ */
+class OneEuroFilter
+{
+    public:
+
+        // Maximum time between two samples that is taken into account [us]
+        static const uint32_t kMaxDtMicros = 65535;
+
+        // Maximum cutoff frequency [Hz, Q8]
+        static const uint32_t kMaxCutoffQ8 = 65535;
+
+        /**
+         * @param minCutoffQ8 Cutoff frequency at rest [Hz, Q8].
+         *
+         * @param betaQ8 Increase of the cutoff frequency per speed [Hz per (raw step / ms), Q8].
+         *
+         * @param derivCutoffQ8 Cutoff frequency of the speed [Hz, Q8].
+         */
+        OneEuroFilter(uint16_t minCutoffQ8, uint16_t betaQ8, uint16_t derivCutoffQ8);
+
+        /**
+         * Filters a sample.
+         *
+         * @param xQ8 Sample [raw steps, Q8].
+         *
+         * @param timestampMicros Time of the sample [us]. Wraps around.
+         *
+         * @return Filtered value [raw steps, Q8].
+         */
+        uint16_t filter(uint16_t xQ8, uint32_t timestampMicros);
+
+        /**
+         * Restarts the filter, i.e. the next sample is passed through unfiltered.
+         */
+        inline void reset()
+        {
+            initialized_ = false;
+        }
+
+        /**
+         * Returns the most recent filtered value [raw steps, Q8].
+         */
+        inline uint16_t getValueQ8() const
+        {
+            return (uint16_t) xHatQ8_;
+        }
+
+        /**
+         * Returns the smoothing factor of a low-pass filter with the given cutoff frequency and sample period [Q15].
+         */
+        static uint32_t computeAlphaQ15(uint32_t cutoffQ8, uint32_t dtMicros);
+
+    private:
+
+        uint16_t minCutoffQ8_;
+
+        uint16_t betaQ8_;
+
+        uint16_t derivCutoffQ8_;
+
+        bool initialized_ = false;
+
+        uint32_t lastMicros_ = 0;
+
+        // Filtered value [raw steps, Q8]
+        int32_t xHatQ8_ = 0;
+
+        // Filtered speed [raw steps per ms, Q8]
+        int32_t dxHatQ8_ = 0;
+};
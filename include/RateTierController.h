@@ -0,0 +1,119 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Selects the rate at which the gamepad controls are polled and reported, based on user activity.
+ *
+ * Tiers:
+ * - ACTIVE: The controls are in use, poll fast.
+ * - REST:   No activity for a short time.
+ * - IDLE:   No activity for a long time, poll slowly to save power.
+ *
+ * Hysteresis: Any activity switches to ACTIVE immediately, whereas the controller only falls back to a
+ * slower tier after the corresponding hold time without activity has elapsed. Thus, short pauses during
+ * use do not cause the rate to flap.
+ *
+ * The class does not depend on the Arduino framework.
+ */
+class RateTierController
+{
+    public:
+
+        enum tRateTier { ACTIVE = 0, REST = 1, IDLE = 2 };
+
+        static const uint8_t kNumTiers = 3;
+
+        /**
+         * Creates a controller that starts in tier REST.
+         *
+         * @param tierPeriodMicros Tick period of each tier in microseconds, indexed by tRateTier.
+         *
+         * @param restAfterMicros Time without activity after which tier ACTIVE falls back to REST.
+         *
+         * @param idleAfterMicros Time without activity after which tier REST falls back to IDLE.
+         */
+        RateTierController(const uint32_t tierPeriodMicros[kNumTiers], uint32_t restAfterMicros, uint32_t idleAfterMicros);
+
+        /**
+         * Updates the tier based on the activity that has been detected since the previous call.
+         *
+         * @param activity True, if the controls have been used.
+         *
+         * @param nowMicros Current time in microseconds.
+         *
+         * @return Current tier.
+         */
+        tRateTier update(bool activity, uint64_t nowMicros);
+
+        inline tRateTier getTier() const
+        {
+            return tier_;
+        }
+
+        /**
+         * Returns the tick period of the current tier in microseconds.
+         */
+        inline uint32_t getTickPeriodMicros() const
+        {
+            return tierPeriodMicros_[tier_];
+        }
+
+        /**
+         * Returns the accumulated time spent in the given tier in milliseconds (up to the previous update).
+         */
+        inline uint32_t getTimeInTierMillis(tRateTier tier) const
+        {
+            return timeInTierMicros_[tier] / 1000;
+        }
+
+        /**
+         * Returns the number of tier changes.
+         */
+        inline uint32_t getTierChangeCount() const
+        {
+            return tierChangeCount_;
+        }
+
+    private:
+
+        uint32_t tierPeriodMicros_[kNumTiers];
+
+        uint32_t restAfterMicros_;
+
+        uint32_t idleAfterMicros_;
+
+        tRateTier tier_ = tRateTier::REST;
+
+        // Time of the most recent activity in microseconds
+        uint64_t lastActivityMicros_ = 0;
+
+        // Time of the previous update in microseconds
+        uint64_t lastUpdateMicros_ = 0;
+
+        uint64_t timeInTierMicros_[kNumTiers] = {0};
+
+        uint32_t tierChangeCount_ = 0;
+};
@@ -0,0 +1,118 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Holds the single report that is due, but has not been sent yet because the link is busy (latest wins).
+ *
+ * A report offered while another one is pending replaces it, so the host only receives the freshest state
+ * instead of a backlog. States that must not be skipped, such as the edges of a button tap, may therefore only
+ * enter a report if it is sent right away, see isReadyForEdges().
+ *
+ * The class is not thread-safe. It does not depend on the Arduino framework.
+ *
+ * @tparam T Report type.
+ */
+template <typename T>
+class ReportSlot
+{
+    public:
+
+        /**
+         * Stores a due report, replacing the pending one.
+         *
+         * @return True, if a pending report has been replaced.
+         */
+        bool offer(const T &report)
+        {
+            bool replaced = pending_;
+
+            report_ = report;
+            pending_ = true;
+
+            if (replaced)
+            {
+                ++replacedCount_;
+            }
+
+            return replaced;
+        }
+
+        /**
+         * Removes the pending report, unless the link is busy.
+         *
+         * @return False, if no report is pending or the link is busy.
+         */
+        bool take(bool linkBusy, T &report)
+        {
+            if (!pending_ || linkBusy)
+            {
+                return false;
+            }
+
+            report = report_;
+            pending_ = false;
+
+            return true;
+        }
+
+        /**
+         * Discards the pending report, e.g. on disconnect.
+         */
+        inline void clear()
+        {
+            pending_ = false;
+        }
+
+        inline bool isPending() const
+        {
+            return pending_;
+        }
+
+        /**
+         * Returns true, if a report offered now would be sent right away and cannot be replaced,
+         * i.e. no report is pending and the link is not busy.
+         */
+        inline bool isReadyForEdges(bool linkBusy) const
+        {
+            return !pending_ && !linkBusy;
+        }
+
+        /**
+         * Returns the number of pending reports that have been replaced by a newer one.
+         */
+        inline uint32_t getReplacedCount() const
+        {
+            return replacedCount_;
+        }
+
+    private:
+
+        T report_ = {};
+
+        bool pending_ = false;
+
+        uint32_t replacedCount_ = 0;
+};
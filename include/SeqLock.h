@@ -0,0 +1,126 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+/**
+ * Sequence lock for handing a small struct from a single writer task to any number of reader tasks.
+ *
+ * The writer never blocks. A reader copies the data and repeats the copy only if the writer updated the
+ * data in the meantime, which requires the writer to be scheduled in the middle of the copy. Neither side
+ * takes a mutex, so the sequence lock can be used on the hot path and across cores.
+ *
+ * The data is stored in 32-bit atomic words, i.e. concurrent access is free of data races.
+ * The class does not depend on the Arduino framework.
+ *
+ * @tparam T Trivially copyable data type.
+ */
+template <typename T>
+class SeqLock
+{
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock requires a trivially copyable type");
+
+    public:
+
+        SeqLock()
+        {
+            T initial{};
+            write(initial);
+            seq_.store(0, std::memory_order_relaxed);
+        }
+
+        /**
+         * Publishes a new value. Must only be called by a single writer task.
+         */
+        void write(const T &value)
+        {
+            uint32_t buffer[kNumWords] = {0};
+            memcpy(buffer, &value, sizeof(T));
+
+            uint32_t seq = seq_.load(std::memory_order_relaxed);
+
+            // An odd sequence number marks the data as being written
+            seq_.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            for (uint8_t wordIdx = 0; wordIdx < kNumWords; ++wordIdx)
+            {
+                words_[wordIdx].store(buffer[wordIdx], std::memory_order_relaxed);
+            }
+
+            seq_.store(seq + 2, std::memory_order_release);
+        }
+
+        /**
+         * Copies a consistent snapshot of the most recently published value.
+         *
+         * @return Sequence number of the snapshot. It increases with every write.
+         */
+        uint32_t read(T &value) const
+        {
+            uint32_t buffer[kNumWords];
+            uint32_t seqBegin;
+            uint32_t seqEnd;
+
+            do
+            {
+                seqBegin = seq_.load(std::memory_order_acquire);
+
+                for (uint8_t wordIdx = 0; wordIdx < kNumWords; ++wordIdx)
+                {
+                    buffer[wordIdx] = words_[wordIdx].load(std::memory_order_relaxed);
+                }
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+                seqEnd = seq_.load(std::memory_order_relaxed);
+            }
+            while ( (seqBegin & 1) || (seqBegin != seqEnd) );
+
+            memcpy(&value, buffer, sizeof(T));
+
+            return seqBegin;
+        }
+
+        /**
+         * Returns a consistent snapshot of the most recently published value.
+         */
+        inline T read() const
+        {
+            T value;
+            read(value);
+
+            return value;
+        }
+
+    private:
+
+        static const uint8_t kNumWords = (sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+        std::atomic<uint32_t> seq_{0};
+
+        std::atomic<uint32_t> words_[kNumWords];
+};
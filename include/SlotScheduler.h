@@ -0,0 +1,250 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Periodic scheduler that paces a task in ticks and keeps track of slots of fixed duration.
+ * The slots are grouped into cycles where each cycle comprises a fixed number of slots.
+ *
+ * The task is woken up once per tick. The start time of each tick is an absolute deadline on a time grid
+ * (previous deadline + tick period). Hence, the execution time of a tick does not accumulate as drift.
+ * If a tick overruns, the next tick starts immediately. Grid points that have been missed completely are
+ * skipped and counted, i.e. the phase of the ticks remains stable.
+ *
+ * The tick period may be changed at runtime, e.g. to poll faster while the gamepad is in use. The slots
+ * are independent of the tick period: the slot number is derived from the deadline of the current tick,
+ * so sub functions that are bound to slots keep their timing regardless of the tick period.
+ *
+ * The class does not depend on the Arduino framework. Time is obtained and spent via the functions that
+ * are passed to the constructor, so the scheduler can also be driven by a fake clock on a host computer.
+ */
+class SlotScheduler
+{
+    public:
+
+        // Function type that returns a monotonic timestamp in microseconds
+        typedef uint64_t (*tClockFunc)();
+
+        // Function type that blocks the calling task until the given timestamp in microseconds has been reached
+        typedef void (*tSleepUntilFunc)(uint64_t wakeTimeMicros);
+
+        /**
+         * Creates a scheduler. Initially, the tick period equals the slot duration.
+         *
+         * @param slotMicros Duration of each slot in microseconds.
+         *
+         * @param numSlots Number of slots in each cycle.
+         *
+         * @param clock Function that provides the current time.
+         *
+         * @param sleepUntil Function that blocks until a given point in time.
+         */
+        SlotScheduler(uint32_t slotMicros, uint16_t numSlots, tClockFunc clock, tSleepUntilFunc sleepUntil);
+
+        /**
+         * Starts the first tick and the first slot of the first cycle at the current time.
+         */
+        void start();
+
+        /**
+         * Ends the current tick and blocks until the deadline of the next tick.
+         *
+         * @return Number of the current slot within the current cycle.
+         */
+        uint16_t waitForNextTick();
+
+        /**
+         * Sets the tick period. The new period applies from the deadline of the next tick onwards.
+         *
+         * @param periodMicros Tick period in microseconds.
+         */
+        inline void setTickPeriodMicros(uint32_t periodMicros)
+        {
+            tickPeriodMicros_ = periodMicros;
+        }
+
+        /**
+         * Returns the tick period in microseconds.
+         */
+        inline uint32_t getTickPeriodMicros() const
+        {
+            return tickPeriodMicros_;
+        }
+
+        /**
+         * Returns the duration of each slot in microseconds.
+         */
+        inline uint32_t getSlotMicros() const
+        {
+            return slotMicros_;
+        }
+
+        /**
+         * Returns the number of the current slot within the current cycle.
+         */
+        inline uint16_t getSlotNr() const
+        {
+            return slotNr_;
+        }
+
+        /**
+         * Returns true, if a sub function that is executed in every 'interval' slots in slot 'offset' is due
+         * in the current tick, i.e. if such a slot has begun since the previous tick.
+         *
+         * Example: isSlotDue(20, 1) corresponds to the slots 1, 21, 41 etc.
+         */
+        bool isSlotDue(uint16_t interval, uint16_t offset) const;
+
+        /**
+         * Returns the computation time of the previous tick in microseconds.
+         */
+        inline uint32_t getBusyMicros() const
+        {
+            return busyMicros_;
+        }
+
+        /**
+         * Returns the maximum computation time of a tick within the current cycle in microseconds.
+         */
+        inline uint32_t getBusyMaxInCycleMicros() const
+        {
+            return busyMaxInCycleMicros_;
+        }
+
+        /**
+         * Returns the overall maximum computation time of a tick in microseconds.
+         */
+        inline uint32_t getBusyMaxMicros() const
+        {
+            return busyMaxMicros_;
+        }
+
+        /**
+         * Returns the delay between the deadline and the actual start of the current tick in microseconds.
+         */
+        inline uint32_t getLatenessMicros() const
+        {
+            return latenessMicros_;
+        }
+
+        /**
+         * Returns the maximum deviation of the actual tick period from the nominal period within the current cycle.
+         */
+        inline uint32_t getJitterMaxInCycleMicros() const
+        {
+            return jitterMaxInCycleMicros_;
+        }
+
+        /**
+         * Returns the overall maximum deviation of the actual tick period from the nominal period.
+         */
+        inline uint32_t getJitterMaxMicros() const
+        {
+            return jitterMaxMicros_;
+        }
+
+        /**
+         * Returns true, if the previous tick exceeded its deadline.
+         */
+        inline bool hasOverrun() const
+        {
+            return overrun_;
+        }
+
+        /**
+         * Returns the number of ticks that exceeded their deadline.
+         */
+        inline uint32_t getOverrunCount() const
+        {
+            return overrunCount_;
+        }
+
+        /**
+         * Returns the number of ticks that have been skipped in order to keep the phase.
+         */
+        inline uint32_t getSkippedTickCount() const
+        {
+            return skippedTickCount_;
+        }
+
+    private:
+
+        tClockFunc clock_;
+
+        tSleepUntilFunc sleepUntil_;
+
+        // Duration of each slot in microseconds
+        uint32_t slotMicros_;
+
+        // Number of slots in each cycle
+        uint16_t numSlots_;
+
+        // Period of the ticks in microseconds
+        uint32_t tickPeriodMicros_;
+
+        // Number of the current slot of the current cycle
+        uint16_t slotNr_ = 0;
+
+        // Number of slots that have begun since start, including the current slot
+        uint64_t slotsBegun_ = 0;
+
+        // Value of slotsBegun_ during the previous tick
+        uint64_t prevSlotsBegun_ = 0;
+
+        // Time when the scheduler has been started in microseconds
+        uint64_t startMicros_ = 0;
+
+        // Deadline (i.e. nominal start time) of the current tick in microseconds
+        uint64_t deadlineMicros_ = 0;
+
+        // Actual start time of the current tick in microseconds
+        uint64_t tickStartMicros_ = 0;
+
+        uint32_t busyMicros_ = 0;
+
+        uint32_t busyMaxInCycleMicros_ = 0;
+
+        uint32_t busyMaxMicros_ = 0;
+
+        uint32_t latenessMicros_ = 0;
+
+        uint32_t jitterMaxInCycleMicros_ = 0;
+
+        uint32_t jitterMaxMicros_ = 0;
+
+        bool overrun_ = false;
+
+        uint32_t overrunCount_ = 0;
+
+        uint32_t skippedTickCount_ = 0;
+
+        /**
+         * Returns the number of slots in the range [0, n) which satisfy: slot % interval == offset.
+         */
+        static inline uint64_t countDueSlots(uint64_t n, uint16_t interval, uint16_t offset)
+        {
+            return (n > offset) ? (n - offset - 1) / interval + 1 : 0;
+        }
+};
@@ -0,0 +1,95 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+/**
+ * Bounded lock-free queue for handing elements from a single producer task to a single consumer task.
+ *
+ * Neither side blocks or takes a mutex. The producer fails if the queue is full, so the capacity needs to
+ * cover the elements produced between two consecutive drains by the consumer.
+ *
+ * The class does not depend on the Arduino framework.
+ *
+ * @tparam T Element type.
+ * @tparam N Capacity (power of 2).
+ */
+template <typename T, uint16_t N>
+class SpscQueue
+{
+    static_assert( (N > 0) && ((N & (N - 1)) == 0), "SpscQueue capacity must be a power of 2" );
+
+    public:
+
+        /**
+         * Appends an element. Must only be called by the producer task.
+         *
+         * @return False, if the queue is full.
+         */
+        bool push(const T &element)
+        {
+            uint16_t tail = tail_.load(std::memory_order_relaxed);
+
+            if ( (uint16_t) (tail - head_.load(std::memory_order_acquire)) >= N )
+            {
+                return false;
+            }
+
+            elements_[tail & (N - 1)] = element;
+            tail_.store(tail + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        /**
+         * Removes the oldest element. Must only be called by the consumer task.
+         *
+         * @return False, if the queue is empty.
+         */
+        bool pop(T &element)
+        {
+            uint16_t head = head_.load(std::memory_order_relaxed);
+
+            if ( head == tail_.load(std::memory_order_acquire) )
+            {
+                return false;
+            }
+
+            element = elements_[head & (N - 1)];
+            head_.store(head + 1, std::memory_order_release);
+
+            return true;
+        }
+
+    private:
+
+        T elements_[N];
+
+        // Position of the next element to be read, written only by the consumer
+        std::atomic<uint16_t> head_{0};
+
+        // Position of the next element to be written, written only by the producer
+        std::atomic<uint16_t> tail_{0};
+};
@@ -0,0 +1,270 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+
+/**
+ * Response curves for shaping the stick axes.
+ *
+ * Each curve is a lookup table (LUT) with one int16 output value per normalized stick position (-128..127).
+ * The table is indexed by the upper 8 bits of the calibrated stick axis value, and the lower 8 bits interpolate
+ * linearly between adjacent entries, i.e. shaping costs two indexed loads and a multiplication per axis.
+ * Hence the fractional resolution of the smoothed stick position is preserved. The tables are generated at
+ * compile time and reside in flash.
+ * A profile combines a table with an optional radial dead zone, which is applied to the vector of both axes
+ * before the table lookup (one square root per stick). Switching profiles only swaps a pointer.
+ *
+ * Curves (t = relative deflection 0..1 between the dead zone and the saturation point):
+ * - LINEAR:          y = t
+ * - QUADRATIC:       y = t^2, fine control near the center
+ * - EXPONENTIAL:     y = (e^(k*t) - 1) / (e^k - 1), even finer control near the center
+ * - RADIAL_DEADZONE: y = t, where t is taken along the direction of the stick vector, outside of a circular dead zone
+ * - ANTI_DEADZONE:   y = a + (1 - a) * t for t > 0, compensates a dead zone applied by the game
+ *
+ * Deflections beyond the saturation point yield the full output value.
+ *
+ * The class does not depend on the Arduino framework.
+ */
+class StickCurve
+{
+    public:
+
+        enum tProfile { LINEAR = 0, QUADRATIC, EXPONENTIAL, RADIAL_DEADZONE, ANTI_DEADZONE, kNumProfiles };
+
+        // Number of entries of each lookup table
+        static const uint16_t kLutSize = 256;
+
+        // Output value at full deflection
+        static const int16_t kOutputMax = 32767;
+
+        // Deflection at which the output saturates [normalized stick steps], i.e. at full deflection (range is calibrated)
+        static const uint8_t kSaturation = 127;
+
+        // Radius of the radial dead zone of profile RADIAL_DEADZONE [normalized stick steps]
+        static const uint8_t kRadialDeadzone = 10;
+
+        // Axial dead zone of profile ANTI_DEADZONE, which suppresses noise around the center [normalized stick steps]
+        static const uint8_t kAntiDeadzoneNoise = 4;
+
+        // Output offset of profile ANTI_DEADZONE relative to kOutputMax, in percent
+        static const uint8_t kAntiDeadzonePercent = 15;
+
+        // Steepness k of profile EXPONENTIAL
+        static const uint8_t kExponent = 3;
+
+        /**
+         * Lookup table, indexed by normalized stick position + 128.
+         */
+        typedef struct {
+            int16_t values[kLutSize];
+        } tLut;
+
+        /**
+         * Definition of a profile.
+         */
+        typedef struct {
+            const tLut *pLut;
+
+            // Radius of the radial dead zone (0 = none) [normalized stick steps]
+            uint8_t radialDeadzone;
+        } tProfileDef;
+
+        /**
+         * Returns the definition of the given profile.
+         */
+        static inline const tProfileDef* getProfile(tProfile profile)
+        {
+            return &kProfiles[profile];
+        }
+
+        /**
+         * Returns a short name of the given profile.
+         */
+        static const char* getProfileName(tProfile profile);
+
+        /**
+         * Shapes both axes of a stick.
+         *
+         * @param pProfile Profile to be applied.
+         *
+         * @param axisX, axisY Calibrated stick position (-32768..32767).
+         *
+         * @param outX, outY Shaped stick position (-32767..32767).
+         */
+        static inline void apply(const tProfileDef *pProfile, int16_t axisX, int16_t axisY, int16_t &outX, int16_t &outY)
+        {
+            if (pProfile->radialDeadzone > 0)
+            {
+                removeRadialDeadzone(pProfile->radialDeadzone, axisX, axisY);
+            }
+
+            outX = interpolate(pProfile->pLut, axisX);
+            outY = interpolate(pProfile->pLut, axisY);
+        }
+
+        /**
+         * Computes the output value of a profile's curve for a single axis using floating point math.
+         * Used at compile time to generate the tables, and at runtime as reference.
+         *
+         * @param profile Profile.
+         *
+         * @param x Normalized stick position (-128..127).
+         */
+        static constexpr int16_t computeValue(tProfile profile, int16_t x)
+        {
+            return (x < 0 ? -1 : 1) * (int16_t) ( curveValue(profile, relativeDeflection(x < 0 ? -x : x, axialDeadzone(profile))) * kOutputMax + 0.5 );
+        }
+
+        /**
+         * Computes the output value of a profile's curve for a single axis like computeValue(), but with single
+         * precision floating point math and expf(), i.e. the way a curve would be evaluated at runtime without the
+         * tables. Baseline of the benchmarks.
+         *
+         * @param profile Profile.
+         *
+         * @param x Normalized stick position (-128..127).
+         */
+        static int16_t computeValueFloat(tProfile profile, int16_t x);
+
+    private:
+
+        static const tLut kLuts[kNumProfiles];
+
+        static const tProfileDef kProfiles[kNumProfiles];
+
+        /**
+         * Interpolates linearly between the table entries adjacent to a calibrated stick axis value.
+         */
+        static inline int16_t interpolate(const tLut *pLut, int16_t axis)
+        {
+            // Index of the entry at or below the position (arithmetic shift), weight of the next entry in 1/256
+            uint8_t idx = (axis >> 8) + 128;
+            int32_t frac = axis & 0xFF;
+
+            int32_t lower = pLut->values[idx];
+
+            // The last entry has no successor, it is reached at full deflection only
+            if (idx == kLutSize - 1)
+            {
+                return lower;
+            }
+
+            return lower + (( (pLut->values[idx + 1] - lower) * frac + 0x80 ) >> 8);
+        }
+
+        /**
+         * Removes a circular dead zone from the stick vector: its magnitude m is mapped to (m - r) / (s - r) * s
+         * along its direction (r = radius, s = saturation point), so that the output rises from 0 at the circle
+         * on both axes and still saturates at full deflection.
+         *
+         * @param deadzone Radius of the dead zone [normalized stick steps].
+         */
+        static inline void removeRadialDeadzone(uint8_t deadzone, int16_t &axisX, int16_t &axisY)
+        {
+            const float saturation = kSaturation * 256.0f;
+            const float radius = deadzone * 256.0f;
+
+            uint32_t magnitudeSq = (uint32_t) ((int32_t) axisX * axisX) + (uint32_t) ((int32_t) axisY * axisY);
+
+            if (magnitudeSq < (uint32_t) (radius * radius))
+            {
+                axisX = 0;
+                axisY = 0;
+                return;
+            }
+
+            float magnitude = sqrtf((float) magnitudeSq);
+            float gain = (magnitude - radius) / magnitude * saturation / (saturation - radius);
+
+            axisX = clampAxis(axisX * gain);
+            axisY = clampAxis(axisY * gain);
+        }
+
+        /**
+         * Converts a rescaled axis value back to the range of a calibrated stick axis value.
+         */
+        static inline int16_t clampAxis(float axis)
+        {
+            return (axis >= 32767.0f) ? 32767 : ( (axis <= -32768.0f) ? -32768 : (int16_t) axis );
+        }
+
+        /**
+         * Returns the axial dead zone of the given profile's curve. The dead zone of profile RADIAL_DEADZONE is
+         * removed from the vector of both axes instead, see removeRadialDeadzone().
+         */
+        static constexpr uint8_t axialDeadzone(tProfile profile)
+        {
+            return (profile == ANTI_DEADZONE) ? kAntiDeadzoneNoise : 0;
+        }
+
+        /**
+         * Maps a magnitude to the relative deflection 0..1 between the dead zone and the saturation point.
+         */
+        static constexpr double relativeDeflection(int16_t magnitude, uint8_t deadzone)
+        {
+            return (magnitude <= deadzone) ? 0.0 :
+                   ( (magnitude >= kSaturation) ? 1.0 : (double) (magnitude - deadzone) / (kSaturation - deadzone) );
+        }
+
+        /**
+         * Evaluates the curve at relative deflection t.
+         */
+        static constexpr double curveValue(tProfile profile, double t)
+        {
+            return (profile == QUADRATIC)     ? t * t :
+                   (profile == EXPONENTIAL)   ? (exp(kExponent * t) - 1.0) / (exp(kExponent) - 1.0) :
+                   (profile == ANTI_DEADZONE) ? ( (t > 0.0) ? (kAntiDeadzonePercent + (100 - kAntiDeadzonePercent) * t) / 100.0 : 0.0 ) :
+                   t;
+        }
+
+        /**
+         * Exponential function evaluated by its Taylor series (the standard library's function is not constexpr).
+         */
+        static constexpr double exp(double x, uint8_t n = 1, double term = 1.0, double sum = 1.0)
+        {
+            return (n > 40) ? sum : exp(x, n + 1, term * x / n, sum + term * x / n);
+        }
+
+        /**
+         * Compile time generation of the lookup tables (index sequence as in C++14's std::index_sequence).
+         */
+        template <uint16_t... Is>
+        struct tIndexSeq {};
+
+        template <uint16_t N, uint16_t... Is>
+        struct tMakeIndexSeq : tMakeIndexSeq<N - 1, N - 1, Is...> {};
+
+        template <uint16_t... Is>
+        struct tMakeIndexSeq<0, Is...>
+        {
+            typedef tIndexSeq<Is...> type;
+        };
+
+        template <uint16_t... Is>
+        static constexpr tLut makeLut(tProfile profile, tIndexSeq<Is...>)
+        {
+            return tLut{ { computeValue(profile, (int16_t) Is - 128)... } };
+        }
+};
@@ -0,0 +1,140 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "AxisMapper.h"
+
+AxisMapper::AxisMapper(uint8_t center, uint8_t defaultHalfRange, bool invert)
+: center_{center}
+, invert_{invert}
+{
+    resetRange(defaultHalfRange);
+}
+
+void AxisMapper::setCenter(uint8_t center)
+{
+    center_ = center;
+
+    enforceMinHalfRange();
+}
+
+void AxisMapper::setRange(uint8_t rawMin, uint8_t rawMax)
+{
+    min_ = rawMin;
+    max_ = rawMax;
+
+    enforceMinHalfRange();
+}
+
+void AxisMapper::resetRange(uint8_t defaultHalfRange)
+{
+    min_ = (center_ > defaultHalfRange) ? (center_ - defaultHalfRange) : 0;
+    max_ = (center_ < 255 - defaultHalfRange) ? (center_ + defaultHalfRange) : 255;
+
+    highCount_ = 0;
+    highConfirmed_ = 0;
+    lowCount_ = 0;
+    lowConfirmed_ = 0;
+
+    enforceMinHalfRange();
+}
+
+bool AxisMapper::learn(uint8_t raw)
+{
+    bool changed = false;
+
+    // The least extreme sample of a run beyond an extreme is the confirmed extreme
+    if (raw > max_)
+    {
+        highConfirmed_ = ( (highCount_ == 0) || (raw < highConfirmed_) ) ? raw : highConfirmed_;
+
+        if (++highCount_ >= kLearnConfirmSamples)
+        {
+            max_ = highConfirmed_;
+            highCount_ = 0;
+            changed = true;
+        }
+    }
+    else
+    {
+        highCount_ = 0;
+    }
+
+    if (raw < min_)
+    {
+        lowConfirmed_ = ( (lowCount_ == 0) || (raw > lowConfirmed_) ) ? raw : lowConfirmed_;
+
+        if (++lowCount_ >= kLearnConfirmSamples)
+        {
+            min_ = lowConfirmed_;
+            lowCount_ = 0;
+            changed = true;
+        }
+    }
+    else
+    {
+        lowCount_ = 0;
+    }
+
+    return changed;
+}
+
+int16_t AxisMapper::mapQ8(uint16_t rawQ8) const
+{
+    uint32_t centerQ8 = (uint32_t) center_ << 8;
+    int32_t out;
+
+    if (rawQ8 == centerQ8)
+    {
+        // Also covers a center at the end of the raw range, where the half range is zero
+        out = 0;
+    }
+    else if (rawQ8 > centerQ8)
+    {
+        uint32_t deflectionQ8 = rawQ8 - centerQ8;
+        uint32_t halfRangeQ8 = (uint32_t) (max_ - center_) << 8;
+
+        out = (deflectionQ8 >= halfRangeQ8) ? kOutputMax : (int32_t) ( (deflectionQ8 * kOutputMax + halfRangeQ8 / 2) / halfRangeQ8 );
+    }
+    else
+    {
+        uint32_t deflectionQ8 = centerQ8 - rawQ8;
+        uint32_t halfRangeQ8 = (uint32_t) (center_ - min_) << 8;
+
+        out = (deflectionQ8 >= halfRangeQ8) ? -kOutputMax : -(int32_t) ( (deflectionQ8 * kOutputMax + halfRangeQ8 / 2) / halfRangeQ8 );
+    }
+
+    // The output range is symmetric, hence the inversion cannot overflow
+    return invert_ ? -out : out;
+}
+
+void AxisMapper::enforceMinHalfRange()
+{
+    if (max_ < center_ + kMinHalfRange)
+    {
+        max_ = (center_ < 255 - kMinHalfRange) ? (center_ + kMinHalfRange) : 255;
+    }
+
+    if (min_ + kMinHalfRange > center_)
+    {
+        min_ = (center_ > kMinHalfRange) ? (center_ - kMinHalfRange) : 0;
+    }
+}
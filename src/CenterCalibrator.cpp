@@ -0,0 +1,194 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "CenterCalibrator.h"
+
+CenterCalibrator::CenterCalibrator(uint8_t nominalCenter, uint8_t maxCenterOffset, uint32_t restMicros, uint8_t maxVariance, uint8_t updateShift,
+                                   uint8_t confirmPeriods)
+: nominalCenter_{nominalCenter}
+, maxCenterOffset_{maxCenterOffset}
+, restMicros_{restMicros}
+, maxVariance_{maxVariance}
+, updateShift_{updateShift}
+, confirmPeriods_{confirmPeriods}
+{
+    for (uint8_t axis = 0; axis < kNumAxes; ++axis)
+    {
+        centerQ8_[axis] = nominalCenter << 8;
+    }
+}
+
+bool CenterCalibrator::update(const uint8_t raw[kNumAxes], bool btnActive, uint64_t nowMicros)
+{
+    if (btnActive || (numSamples_ == 0))
+    {
+        restartRestPeriod(nowMicros);
+
+        if (btnActive)
+        {
+            return false;
+        }
+    }
+
+    ++numSamples_;
+
+    for (uint8_t axis = 0; axis < kNumAxes; ++axis)
+    {
+        sum_[axis] += raw[axis];
+        sumSq_[axis] += raw[axis] * raw[axis];
+
+        /* Variance check without division: n^2 * var = n * sumSq - sum^2
+           A moving stick ends the rest period, the current sample starts the next one. */
+        uint64_t varianceScaled = (uint64_t) numSamples_ * sumSq_[axis] - (uint64_t) sum_[axis] * sum_[axis];
+
+        if (varianceScaled > (uint64_t) maxVariance_ * numSamples_ * numSamples_)
+        {
+            restartRestPeriod(nowMicros);
+            ++numSamples_;
+
+            for (uint8_t restartAxis = 0; restartAxis < kNumAxes; ++restartAxis)
+            {
+                sum_[restartAxis] = raw[restartAxis];
+                sumSq_[restartAxis] = raw[restartAxis] * raw[restartAxis];
+            }
+
+            return false;
+        }
+    }
+
+    if (nowMicros - restStartMicros_ < restMicros_)
+    {
+        return false;
+    }
+
+    // Rest period completed
+    uint16_t meanQ8[kNumAxes];
+
+    for (uint8_t axis = 0; axis < kNumAxes; ++axis)
+    {
+        meanQ8[axis] = ( (sum_[axis] << 8) + numSamples_ / 2 ) / numSamples_;
+    }
+
+    restartRestPeriod(nowMicros);
+
+    if (!confirmRestMeans(meanQ8))
+    {
+        return false;
+    }
+
+    // Move the center towards the average of the consistent means
+    for (uint8_t axis = 0; axis < kNumAxes; ++axis)
+    {
+        int32_t deltaQ8 = (int32_t) (consistentSumQ8_[axis] / numConsistent_) - centerQ8_[axis];
+
+        // Round towards the mean, so that the estimate converges exactly
+        centerQ8_[axis] += (deltaQ8 + ( (deltaQ8 >= 0) ? ( (1 << updateShift_) - 1 ) : 0 )) >> updateShift_;
+    }
+
+    numConsistent_ = 0;
+    ++updateCount_;
+
+    return true;
+}
+
+bool CenterCalibrator::confirmRestMeans(const uint16_t meanQ8[kNumAxes])
+{
+    bool plausible = true;
+    bool consistent = true;
+
+    for (uint8_t axis = 0; axis < kNumAxes; ++axis)
+    {
+        plausible = plausible && isPlausible(meanQ8[axis]);
+
+        if (numConsistent_ > 0)
+        {
+            int32_t deviationQ8 = (int32_t) meanQ8[axis] - (int32_t) (consistentSumQ8_[axis] / numConsistent_);
+
+            consistent = consistent && (deviationQ8 <= kMaxConsistentDeviationQ8) && (-deviationQ8 <= kMaxConsistentDeviationQ8);
+        }
+    }
+
+    if (!plausible)
+    {
+        numConsistent_ = 0;
+        return false;
+    }
+
+    // A deviating mean starts a new series
+    if (!consistent)
+    {
+        numConsistent_ = 0;
+    }
+
+    if (numConsistent_ == 0)
+    {
+        for (uint8_t axis = 0; axis < kNumAxes; ++axis)
+        {
+            consistentSumQ8_[axis] = 0;
+        }
+    }
+
+    ++numConsistent_;
+
+    for (uint8_t axis = 0; axis < kNumAxes; ++axis)
+    {
+        consistentSumQ8_[axis] += meanQ8[axis];
+    }
+
+    return numConsistent_ >= confirmPeriods_;
+}
+
+bool CenterCalibrator::setCenterQ8(uint8_t axis, uint16_t centerQ8)
+{
+    if (!isPlausible(centerQ8))
+    {
+        return false;
+    }
+
+    centerQ8_[axis] = centerQ8;
+
+    return true;
+}
+
+void CenterCalibrator::restartRestPeriod(uint64_t nowMicros)
+{
+    restStartMicros_ = nowMicros;
+    numSamples_ = 0;
+
+    for (uint8_t axis = 0; axis < kNumAxes; ++axis)
+    {
+        sum_[axis] = 0;
+        sumSq_[axis] = 0;
+    }
+}
+
+bool CenterCalibrator::isPlausible(uint16_t centerQ8) const
+{
+    int32_t offsetQ8 = (int32_t) centerQ8 - (nominalCenter_ << 8);
+
+    if (offsetQ8 < 0)
+    {
+        offsetQ8 = -offsetQ8;
+    }
+
+    return offsetQ8 <= (maxCenterOffset_ << 8);
+}
@@ -0,0 +1,203 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "DeferredLog.h"
+
+const DeferredLog::tFormat DeferredLog::kFormats[DeferredLog::kNumFormats] = {
+    /* kFmtReportHex                */ { LEVEL_DEBUG, "Report data hex: %08x %08x %08x %02x [13 bytes]" },
+    /* kFmtInputTickDuration        */ { LEVEL_INFO,  "Input task: duration of tick in microseconds: %u (last), %u (max in cycle), %u (max overall)" },
+    /* kFmtInputTickJitter          */ { LEVEL_INFO,  "Input task: tick period jitter in microseconds: %u (max in cycle), %u (max overall); overruns: %u, skipped ticks: %u" },
+    /* kFmtRateTier                 */ { LEVEL_INFO,  "Rate tier: %u (0 = active, 1 = rest, 2 = idle); time in tiers in ms: %u (active), %u (rest), %u (idle); tier changes: %u" },
+    /* kFmtReportCounts             */ { LEVEL_INFO,  "Input reports: %u sent, %u suppressed" },
+    /* kFmtInputLatency             */ { LEVEL_INFO,  "Input age at notify over %u reports in us: freshest p50 <= %u, p99 <= %u, max = %u; stalest p50 <= %u, p99 <= %u, max = %u" },
+    /* kFmtHousekeepingSlotDuration */ { LEVEL_INFO,  "Housekeeping task: duration of slot in microseconds: %u (last), %u (max in cycle), %u (max overall)" },
+    /* kFmtRtcTimestamp             */ { LEVEL_INFO,  "RTC: %04u-%02u-%02u, %02u:%02u:%02u" },
+    /* kFmtPowerStatus              */ { LEVEL_INFO,  "vBat = %d mV, pBat = %d uW, iBat = %d uA, iChrg = %d uA, iDischrg = %d uA, clmb = %d uAh, clmbMax = %d uAh, vBusPres = %d" },
+    /* kFmtButtonEvents             */ { LEVEL_INFO,  "Button events: %u taps coalesced, %u queue overflows" },
+    /* kFmtJoystickBus              */ { LEVEL_INFO,  "Joystick I2C bus: %u transactions, %u failed; errors: %u addr NACK, %u data NACK, %u timeout, %u bus; %u retries, %u recoveries" },
+    /* kFmtI2CBusLoad               */ { LEVEL_INFO,  "I2C bus utilization in 1/1000: %u (grove), %u (internal); max busy in us: %u (grove), %u (internal); joystick job: %u runs, %u deferred, %u missed" },
+    /* kFmtMotionAim                */ { LEVEL_INFO,  "Gyro aim per slot in us: bus %u (last), %u (max); CPU %u (last), %u (max); %u frames, %u FIFO overflows, %u read errors" },
+    /* kFmtReportSend               */ { LEVEL_INFO,  "Report send path %u (0 = library, 1 = direct) over %u reports: %u CPU cycles (avg), %u (max); %u heap allocations (total, counted with ALLOC_STATS only), %u (max)" },
+    /* kFmtConnParams               */ { LEVEL_INFO,  "Connection parameters: status %u, interval %u us, slave latency %u, supervision timeout %u ms (requested profile %u: 0 = low latency, 1 = power saving)" },
+    /* kFmtReportCongestion         */ { LEVEL_INFO,  "Report congestion: %u reports replaced while pending, %u in flight, %u confirmation timeouts; %u congestion periods, %u ms congested" },
+};
+
+
+DeferredLog* DeferredLog::getInstance()
+{
+    static DeferredLog instance{};
+
+    return &instance;
+}
+
+DeferredLog::DeferredLog()
+{
+    // Initially, the sequence number of each cell equals its position, i.e. all cells are free
+    for (uint32_t cellIdx = 0; cellIdx < kCapacity; ++cellIdx)
+    {
+        cells_[cellIdx].seq.store(cellIdx, std::memory_order_relaxed);
+    }
+}
+
+void DeferredLog::start(BaseType_t taskCore)
+{
+    xTaskCreatePinnedToCore(DeferredLog::logTask, "Deferred log task", 4096, this, tskIDLE_PRIORITY, NULL, taskCore);
+}
+
+bool DeferredLog::log(tFormatId formatId, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5, uint32_t a6, uint32_t a7)
+{
+    uint32_t pos = enqueuePos_.load(std::memory_order_relaxed);
+    tCell *pCell;
+
+    // Reserve a free cell
+    while (true)
+    {
+        pCell = &cells_[pos & (kCapacity - 1)];
+
+        uint32_t seq = pCell->seq.load(std::memory_order_acquire);
+        int32_t diff = (int32_t) (seq - pos);
+
+        if (diff == 0)
+        {
+            // Cell is free, try to claim it
+            if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // Ring buffer is full
+            droppedCount_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else
+        {
+            // Another task claimed the cell in the meantime
+            pos = enqueuePos_.load(std::memory_order_relaxed);
+        }
+    }
+
+    tEntry &entry = pCell->entry;
+
+    entry.timestampMicros = (uint32_t) esp_timer_get_time();
+    entry.formatId = formatId;
+    entry.args[0] = a0;
+    entry.args[1] = a1;
+    entry.args[2] = a2;
+    entry.args[3] = a3;
+    entry.args[4] = a4;
+    entry.args[5] = a5;
+    entry.args[6] = a6;
+    entry.args[7] = a7;
+
+    // Mark the cell as filled
+    pCell->seq.store(pos + 1, std::memory_order_release);
+
+    return true;
+}
+
+bool DeferredLog::pop(tEntry &entry)
+{
+    tCell &cell = cells_[dequeuePos_ & (kCapacity - 1)];
+
+    uint32_t seq = cell.seq.load(std::memory_order_acquire);
+
+    if ( (int32_t) (seq - (dequeuePos_ + 1)) < 0 )
+    {
+        return false; // empty
+    }
+
+    entry = cell.entry;
+
+    // Mark the cell as free for the next round
+    cell.seq.store(dequeuePos_ + kCapacity, std::memory_order_release);
+
+    ++dequeuePos_;
+
+    return true;
+}
+
+void DeferredLog::emit(const tEntry &entry)
+{
+    char text[256];
+
+    if (entry.formatId >= kNumFormats)
+    {
+        log_e("Invalid deferred log format ID: %d", entry.formatId);
+        return;
+    }
+
+    const tFormat &format = kFormats[entry.formatId];
+
+    // Unused arguments are ignored by snprintf
+    snprintf(text, sizeof(text), format.format,
+        entry.args[0], entry.args[1], entry.args[2], entry.args[3],
+        entry.args[4], entry.args[5], entry.args[6], entry.args[7]);
+
+    switch (format.level)
+    {
+        case LEVEL_ERROR:
+            log_e("[%u us] %s", entry.timestampMicros, text);
+            break;
+
+        case LEVEL_WARN:
+            log_w("[%u us] %s", entry.timestampMicros, text);
+            break;
+
+        case LEVEL_INFO:
+            log_i("[%u us] %s", entry.timestampMicros, text);
+            break;
+
+        default:
+            log_d("[%u us] %s", entry.timestampMicros, text);
+            break;
+    }
+}
+
+void DeferredLog::logTask(void *p)
+{
+    DeferredLog *pLog = (DeferredLog*) p;
+
+    uint32_t droppedReported = 0;
+
+    tEntry entry;
+
+    while (true)
+    {
+        while (pLog->pop(entry))
+        {
+            pLog->emit(entry);
+        }
+
+        // Report messages that have been dropped since the last report
+        uint32_t dropped = pLog->getDroppedCount();
+
+        if (dropped != droppedReported)
+        {
+            log_w("%u deferred log messages dropped (%u in total).", dropped - droppedReported, dropped);
+            droppedReported = dropped;
+        }
+
+        vTaskDelay(kLogTaskDelay);
+    }
+}
@@ -22,6 +22,8 @@
 
 #include <Arduino.h>
 #include "GamepadBLE.h"
+#include "DeferredLog.h"
+#include "AllocCounter.h"
 
 GamepadBLE* GamepadBLE::getInstance()
 {
@@ -33,6 +35,7 @@ GamepadBLE* GamepadBLE::getInstance()
 GamepadBLE::GamepadBLE()
 : pHIDdevice_{nullptr}
 , gamepadData_{}
+, lastSentReport_{}
 {
 }
 
@@ -136,7 +139,25 @@ void GamepadBLE::start(BLEServer* pServer, const tDeviceInfo &deviceInfo) {
     pInputCharacteristicId1_ = pHIDdevice_->inputReport(1); // report ID 0x01
 
     // Enable server-initiated notifications for the report characteristic
-    ((BLE2902*) pInputCharacteristicId1_->getDescriptorByUUID(BLEUUID((uint16_t) 0x2902)))->setNotifications(true);
+    pInputCccd_ = (BLE2902*) pInputCharacteristicId1_->getDescriptorByUUID(BLEUUID((uint16_t) 0x2902));
+    pInputCccd_->setNotifications(true);
+
+    // Sync the value of the report characteristic when the host reads it (notify path DIRECT does not set it)
+    pInputCharacteristicId1_->setCallbacks(new InputReportCallback(this));
+
+    // Cache the GATT interface and connection ID of each new connection for notify path DIRECT
+    BLEDevice::setCustomGattsHandler(gattsEventHandler);
+
+    // Listen for GAP events, e.g. updates of the connection parameters
+    BLEDevice::setCustomGapHandler(gapEventHandler);
+
+    // Requests the connection parameters once the host has settled after connecting
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.callback = onConnParamsTimer;
+    timerArgs.arg = this;
+    timerArgs.name = "connParams";
+
+    esp_timer_create(&timerArgs, &connParamsTimer_);
 
     // Register callback object to listen for connect and disconnect events
     pServer->setCallbacks(new ConnectionEventCallback(this));
@@ -153,6 +174,9 @@ void GamepadBLE::start(BLEServer* pServer, const tDeviceInfo &deviceInfo) {
     // Start the service
     pHIDdevice_->startServices();
 
+    // The attribute handle has been assigned on creation of the characteristic
+    inputReportHandle_ = pInputCharacteristicId1_->getHandle();
+
     log_d("Device name: %s", deviceInfo.deviceName.c_str());
 
     // Setup the BLE advertisement data for the HID gamepad device
@@ -210,8 +234,7 @@ void GamepadBLE::setupAdvertisementDataEspIdf(const std::string &deviceName)
     // Create the semaphore that will be used for synchronization on BLE GAP events
     espBleGapEventSemaphore_ = xSemaphoreCreateBinary();
 
-    // Register the custom Gap event handler of the gamepad class
-    BLEDevice::setCustomGapHandler(gapEventHandler);
+    // Note: The custom GAP event handler of the gamepad class has been registered by start()
 
     /*** Define advertisement data using ESP-IDF library struct ***/
     esp_ble_adv_data_t   advDataIDF;
@@ -259,9 +282,6 @@ void GamepadBLE::setupAdvertisementDataEspIdf(const std::string &deviceName)
     // Synchronize on the event 'ESP_GAP_BLE_SCAN_RSP_DATA_SET_COMPLETE_EVT'
     xSemaphoreTake(espBleGapEventSemaphore_, portMAX_DELAY);
 
-    // Unregister the custom Gap event handler
-    BLEDevice::setCustomGapHandler(nullptr);
-
     /*** Set advertisement configuration parameters using ESP-IDF library struct ***/    
 	advParamsIdf_.adv_int_min       = 0x20;
 	advParamsIdf_.adv_int_max       = 0x40;
@@ -293,7 +313,7 @@ void GamepadBLE::startAdvertising()
             esp_ble_gap_start_advertising(&advParamsIdf_);
 
             // Synchronize on the event 'ESP_GAP_BLE_ADV_START_COMPLETE_EVT' (possibly unnecessary)
-            // Presently, 'gapEventHandler' is only used for synchronisation in 'setupAdvertisementDataEspIdf'
+            // Presently, 'gapEventHandler' only synchronizes 'setupAdvertisementDataEspIdf' on advertisement events
             /*
             if (espBleGapEventSemaphore_ != nullptr)
             {
@@ -310,34 +330,286 @@ void GamepadBLE::startAdvertising()
     }
 }
 
-void GamepadBLE::updateInputReport() {
+void GamepadBLE::setReportMode(tReportMode mode) {
+    reportMode_ = mode;
+}
+
+void GamepadBLE::setAxisChangeThreshold(uint16_t threshold) {
+    axisChangeThreshold_ = threshold;
+}
+
+void GamepadBLE::setKeepAliveInterval(uint32_t intervalMillis) {
+    keepAliveMillis_ = intervalMillis;
+}
+
+bool GamepadBLE::isReportChanged() {
+
+    const uint8_t* pCur  = (const uint8_t*) &gamepadData_;
+    const uint8_t* pLast = (const uint8_t*) &lastSentReport_;
+
+    // Buttons in front of the stick axes as well as triggers and hat switches behind them need to match exactly
+    const size_t axesBegin = offsetof(tGamepadReportStruct, stickLX);
+    const size_t axesEnd   = offsetof(tGamepadReportStruct, btnLT);
+
+    if ( (memcmp(pCur, pLast, axesBegin) != 0) || (memcmp(pCur + axesEnd, pLast + axesEnd, sizeof(gamepadData_) - axesEnd) != 0) )
+    {
+        return true;
+    }
+
+    // Stick axes count as changed if the difference exceeds the threshold
+    const StickAxis_t curAxes[]  = { gamepadData_.stickLX,    gamepadData_.stickLY,    gamepadData_.stickRX,    gamepadData_.stickRY    };
+    const StickAxis_t lastAxes[] = { lastSentReport_.stickLX, lastSentReport_.stickLY, lastSentReport_.stickRX, lastSentReport_.stickRY };
+
+    for (uint8_t axisIdx = 0; axisIdx < 4; ++axisIdx)
+    {
+        int32_t delta = (int32_t) curAxes[axisIdx] - lastAxes[axisIdx];
+
+        if ( (delta != 0) && (abs(delta) >= axisChangeThreshold_) )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool GamepadBLE::updateInputReport() {
 
     log_v(">>");
 
+    bool sendReport = false;
+
     if (connected_)
     {
-        pInputCharacteristicId1_->setValue( (uint8_t*) &gamepadData_, sizeof(gamepadData_));
-        pInputCharacteristicId1_->notify();        
+        uint32_t nowMillis = millis();
+
+        bool reportDue = forceReport_
+            || (reportMode_ == tReportMode::ALWAYS)
+            || (nowMillis - lastSentMillis_ >= keepAliveMillis_)
+            || isReportChanged();
+
+        if (reportDue)
+        {
+            // Latest wins: the host only needs the freshest state
+            reportSlot_.offer(gamepadData_);
+            forceReport_ = false;
+        }
+        else
+        {
+            ++reportsSuppressed_;
+        }
+
+        tGamepadReportStruct report;
+
+        sendReport = reportSlot_.isPending() && reportSlot_.take(isLinkBusy(), report);
+
+        if (sendReport)
+        {
+            sendInputReport(report);
+
+            lastSentReport_ = report;
+            lastSentMillis_ = nowMillis;
+
+            ++reportsSent_;
+        }
+    }
+    else
+    {
+        reportSlot_.clear();
     }
 
-    // Debug output
+    // Debug output (formatted later on by the deferred log task)
     if (gamepadData_.btn09) {
-        uint8_t* pData = (uint8_t*) &gamepadData_;
+        const uint8_t* pData = (const uint8_t*) &gamepadData_;
 
-        // Convert report to hex string
-        std::string hexStr = "";
-        char hexByteStr[4];
+        // Pack the 13 bytes of the report into words such that the hex output shows the bytes in their order
+        uint32_t words[3];
 
-        for (int i = 0; i < sizeof(gamepadData_); i++)
+        for (uint8_t wordIdx = 0; wordIdx < 3; ++wordIdx)
         {
-            sprintf(hexByteStr, "%02x ", pData[i]);
-            hexStr.append(hexByteStr);
+            const uint8_t* pWord = pData + 4 * wordIdx;
+            words[wordIdx] = (pWord[0] << 24) | (pWord[1] << 16) | (pWord[2] << 8) | pWord[3];
         }
 
-        log_d("Report data hex: %s[%d bytes]", hexStr.c_str(), sizeof(gamepadData_));
+        DeferredLog::getInstance()->log(DeferredLog::kFmtReportHex, words[0], words[1], words[2], pData[12]);
     }
 
     log_v("<<");
+
+    return sendReport;
+}
+
+bool GamepadBLE::isReadyForButtonEdges()
+{
+    return reportSlot_.isReadyForEdges(connected_ && isLinkBusy());
+}
+
+bool GamepadBLE::isLinkBusy()
+{
+    if (congested_.load(std::memory_order_relaxed))
+    {
+        return true;
+    }
+
+    if (reportsInFlight_.load(std::memory_order_relaxed) < kMaxReportsInFlight)
+    {
+        return false;
+    }
+
+    uint32_t timeoutMicros = kReportsInFlightTimeoutIntervals * connIntervalMicros_.load(std::memory_order_relaxed);
+
+    if ((uint32_t) esp_timer_get_time() - inFlightChangeMicros_.load(std::memory_order_relaxed) <= timeoutMicros)
+    {
+        return true;
+    }
+
+    // No confirmation for several connection intervals, the notifications or their confirmations have been lost
+    reportsInFlight_.store(0, std::memory_order_relaxed);
+    ++reportsInFlightTimeouts_;
+
+    return false;
+}
+
+void GamepadBLE::sendInputReport(const tGamepadReportStruct &report)
+{
+    tNotifyPath path = connCached_.load(std::memory_order_acquire) ? getNotifyPath() : tNotifyPath::LIBRARY;
+
+    uint32_t allocsBefore = AllocCounter::getCount();
+    uint32_t startCycles = ESP.getCycleCount();
+
+    if (path == tNotifyPath::DIRECT)
+    {
+        // Like BLECharacteristic::notify(), respect the client configuration
+        if (pInputCccd_->getNotifications())
+        {
+            // The BLE stack copies the report into its message queue
+            esp_err_t err = esp_ble_gatts_send_indicate(
+                gattsIf_.load(std::memory_order_relaxed), connId_.load(std::memory_order_relaxed),
+                inputReportHandle_, sizeof(report), (uint8_t*) &report, false);
+
+            if (err == ESP_OK)
+            {
+                inFlightChangeMicros_.store((uint32_t) esp_timer_get_time(), std::memory_order_relaxed);
+                reportsInFlight_.fetch_add(1, std::memory_order_relaxed);
+            }
+            else
+            {
+                log_e("esp_ble_gatts_send_indicate failed: %d", (int) err);
+            }
+        }
+    }
+    else
+    {
+        pInputCharacteristicId1_->setValue( (uint8_t*) &report, sizeof(report));
+        pInputCharacteristicId1_->notify();
+    }
+
+    uint32_t cycles = ESP.getCycleCount() - startCycles;
+    uint32_t allocs = AllocCounter::getCount() - allocsBefore;
+
+    sentReport_.write(report);
+
+    accountSend(path, cycles, allocs);
+}
+
+void GamepadBLE::accountSend(tNotifyPath path, uint32_t cycles, uint32_t allocs)
+{
+    tSendStats &window = sendStatsWindow_;
+
+    // A window covers a single path
+    if ( (window.numReports > 0) && (window.path != path) )
+    {
+        window.numReports = 0;
+    }
+
+    if (window.numReports == 0)
+    {
+        window.path = path;
+        window.maxCycles = 0;
+        window.numAllocs = 0;
+        window.maxAllocs = 0;
+        sendCyclesSum_ = 0;
+    }
+
+    ++window.numReports;
+    sendCyclesSum_ += cycles;
+    window.numAllocs += allocs;
+
+    if (cycles > window.maxCycles)
+    {
+        window.maxCycles = cycles;
+    }
+
+    if (allocs > window.maxAllocs)
+    {
+        window.maxAllocs = allocs;
+    }
+
+    if (window.numReports >= kSendStatsWindow)
+    {
+        window.avgCycles = (uint32_t) (sendCyclesSum_ / window.numReports);
+
+        sendStats_.write(window);
+
+        window.numReports = 0;
+    }
+}
+
+void GamepadBLE::setLinkProfile(tLinkProfile profile)
+{
+    if ( (linkProfile_.exchange(profile, std::memory_order_relaxed) != profile) && connCached_.load(std::memory_order_acquire)
+        && !connParamsDeferred_.load(std::memory_order_relaxed) )
+    {
+        requestConnParams(profile);
+    }
+}
+
+void GamepadBLE::onConnParamsTimer(void *arg)
+{
+    GamepadBLE *pGamepad = (GamepadBLE*) arg;
+
+    pGamepad->connParamsDeferred_.store(false, std::memory_order_relaxed);
+
+    if (pGamepad->connCached_.load(std::memory_order_acquire))
+    {
+        pGamepad->requestConnParams(pGamepad->getLinkProfile());
+    }
+}
+
+void GamepadBLE::scheduleConnParams(uint32_t delayMicros)
+{
+    esp_timer_stop(connParamsTimer_);
+    esp_timer_start_once(connParamsTimer_, delayMicros);
+}
+
+void GamepadBLE::requestConnParams(tLinkProfile profile)
+{
+    esp_ble_conn_update_params_t params;
+
+    memcpy(params.bda, peer_.read().bda, sizeof(esp_bd_addr_t));
+
+    if (profile == tLinkProfile::LOW_LATENCY)
+    {
+        params.min_int = kLowLatencyMinInterval;
+        params.max_int = kLowLatencyMaxInterval;
+        params.latency = kLowLatencySlaveLatency;
+        params.timeout = kLowLatencyTimeout;
+    }
+    else
+    {
+        params.min_int = kPowerSavingMinInterval;
+        params.max_int = kPowerSavingMaxInterval;
+        params.latency = kPowerSavingSlaveLatency;
+        params.timeout = kPowerSavingTimeout;
+    }
+
+    // Asynchronous, the outcome is reported by ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT
+    esp_err_t err = esp_ble_gap_update_conn_params(&params);
+
+    if (err != ESP_OK)
+    {
+        log_e("esp_ble_gap_update_conn_params failed: %d", (int) err);
+    }
 }
 
 void GamepadBLE::updateBatteryLevel(uint8_t level) {
@@ -359,6 +631,20 @@ bool GamepadBLE::isConnected()
 }
 
 
+GamepadBLE::InputReportCallback::InputReportCallback(GamepadBLE* pGamepad)
+{
+    pGamepad_ = pGamepad;
+}
+
+void GamepadBLE::InputReportCallback::onRead(BLECharacteristic* pCharacteristic)
+{
+    /* Note: This function is called by the bluetooth task before the value is returned to the host */
+
+    tGamepadReportStruct report = pGamepad_->sentReport_.read();
+
+    pCharacteristic->setValue( (uint8_t*) &report, sizeof(report));
+}
+
 GamepadBLE::ConnectionEventCallback::ConnectionEventCallback(GamepadBLE* pGamepad)
 {
     pGamepad_ = pGamepad;
@@ -371,6 +657,9 @@ void GamepadBLE::ConnectionEventCallback::onConnect(BLEServer* pServer)
     // Enable server-initiated notifications
     // ((BLE2902*) pGamepad_->pInputCharacteristicId1_->getDescriptorByUUID(BLEUUID((uint16_t) 0x2902)))->setNotifications(true);
 
+    // Send the complete state to the new host with the next report
+    pGamepad_->forceReport_ = true;
+
     pGamepad_->connected_ = true;
 
     log_v("<<");
@@ -397,6 +686,51 @@ void GamepadBLE::gapEventHandler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_pa
 
     log_d("gapEventHandler [event no: %d]", (int) event);
 
+    if (event == ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT)
+    {
+        GamepadBLE *pGamepad = getInstance();
+        const auto &update = param->update_conn_params;
+
+        // Log rejected requests and every change of the parameters in effect
+        if ( (update.status != ESP_BT_STATUS_SUCCESS) || (update.conn_int != pGamepad->connInterval_)
+            || (update.latency != pGamepad->connLatency_) || (update.timeout != pGamepad->connTimeout_) )
+        {
+            DeferredLog::getInstance()->log(DeferredLog::kFmtConnParams,
+                update.status, update.conn_int * 1250, update.latency, update.timeout * 10, pGamepad->getLinkProfile());
+        }
+
+        if (update.status == ESP_BT_STATUS_SUCCESS)
+        {
+            pGamepad->connInterval_ = update.conn_int;
+            pGamepad->connLatency_ = update.latency;
+            pGamepad->connTimeout_ = update.timeout;
+            pGamepad->connParamsRetried_ = false;
+
+            pGamepad->connIntervalMicros_.store(update.conn_int * 1250, std::memory_order_relaxed);
+        }
+        else if ( !pGamepad->connParamsRetried_ && pGamepad->connCached_.load(std::memory_order_acquire) )
+        {
+            pGamepad->connParamsRetried_ = true;
+            pGamepad->scheduleConnParams(kConnParamsRetryDelayMicros);
+        }
+
+        return;
+    }
+
+    if (event == ESP_GAP_BLE_AUTH_CMPL_EVT)
+    {
+        GamepadBLE *pGamepad = getInstance();
+
+        // Pairing or encryption is done, request the parameters now instead of waiting for the timer
+        if ( param->ble_security.auth_cmpl.success && pGamepad->connParamsDeferred_.load(std::memory_order_relaxed) )
+        {
+            esp_timer_stop(pGamepad->connParamsTimer_);
+            onConnParamsTimer(pGamepad);
+        }
+
+        return;
+    }
+
     if (getInstance()->espBleGapEventSemaphore_ != nullptr)
     {
         switch (event)
@@ -426,3 +760,96 @@ void GamepadBLE::gapEventHandler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_pa
         }
     }
 }
+
+void GamepadBLE::gattsEventHandler(esp_gatts_cb_event_t event, esp_gatt_if_t gattsIf, esp_ble_gatts_cb_param_t *param)
+{
+    /* Note: This function is called by the bluetooth task, not by the gamepad application task */
+
+    GamepadBLE *pGamepad = getInstance();
+
+    switch (event)
+    {
+        case ESP_GATTS_CONNECT_EVT:
+        {
+            tPeer peer;
+            memcpy(peer.bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+
+            pGamepad->gattsIf_.store(gattsIf, std::memory_order_relaxed);
+            pGamepad->connId_.store(param->connect.conn_id, std::memory_order_relaxed);
+            pGamepad->peer_.write(peer);
+            pGamepad->connCached_.store(true, std::memory_order_release);
+
+            /* The host picks the initial parameters (often a 30-50 ms interval), ask for the current profile instead.
+               Not right away, since hosts tend to reject the request while they discover the services and pair. */
+            pGamepad->connParamsRetried_ = false;
+            pGamepad->connParamsDeferred_.store(true, std::memory_order_relaxed);
+            pGamepad->scheduleConnParams(kConnParamsDelayMicros);
+            break;
+        }
+
+        case ESP_GATTS_DISCONNECT_EVT:
+            pGamepad->connCached_.store(false, std::memory_order_relaxed);
+
+            esp_timer_stop(pGamepad->connParamsTimer_);
+            pGamepad->connParamsDeferred_.store(false, std::memory_order_relaxed);
+
+            // Unconfirmed notifications are dropped with the connection
+            pGamepad->reportsInFlight_.store(0, std::memory_order_relaxed);
+            pGamepad->connIntervalMicros_.store(kDefaultConnIntervalMicros, std::memory_order_relaxed);
+
+            if (pGamepad->congested_.exchange(false, std::memory_order_relaxed))
+            {
+                pGamepad->congestedMillis_.fetch_add((esp_timer_get_time() - pGamepad->congestionStartMicros_) / 1000, std::memory_order_relaxed);
+            }
+
+            // Log the parameters of the next connection in any case (GAP events are handled by the same task)
+            pGamepad->connInterval_ = 0;
+            pGamepad->connLatency_ = 0;
+            pGamepad->connTimeout_ = 0;
+            break;
+
+        case ESP_GATTS_CONGEST_EVT:
+        {
+            bool congested = param->congest.congested;
+
+            if (pGamepad->congested_.exchange(congested, std::memory_order_relaxed) != congested)
+            {
+                int64_t nowMicros = esp_timer_get_time();
+
+                if (congested)
+                {
+                    pGamepad->congestionStartMicros_ = nowMicros;
+                    pGamepad->congestionCount_.fetch_add(1, std::memory_order_relaxed);
+                }
+                else
+                {
+                    pGamepad->congestedMillis_.fetch_add((nowMicros - pGamepad->congestionStartMicros_) / 1000, std::memory_order_relaxed);
+                }
+            }
+            break;
+        }
+
+        case ESP_GATTS_CONF_EVT:
+        {
+            // Confirmation of a notification of the report characteristic (also sent for notifications of the library path)
+            if (param->conf.handle != pGamepad->inputReportHandle_)
+            {
+                break;
+            }
+
+            pGamepad->inFlightChangeMicros_.store((uint32_t) esp_timer_get_time(), std::memory_order_relaxed);
+
+            uint8_t inFlight = pGamepad->reportsInFlight_.load(std::memory_order_relaxed);
+
+            while ( (inFlight > 0)
+                && !pGamepad->reportsInFlight_.compare_exchange_weak(inFlight, inFlight - 1, std::memory_order_relaxed) )
+            {
+                // Retry with the updated count
+            }
+            break;
+        }
+
+        default:
+            break; // do nothing
+    }
+}
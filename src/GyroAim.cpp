@@ -0,0 +1,169 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "GyroAim.h"
+
+#include <stdlib.h>
+
+GyroAim::GyroAim(uint16_t lsbPer10Dps, uint16_t sampleRateHz, uint8_t gyroAxisX, bool invertX, uint8_t gyroAxisY, bool invertY)
+: gyroAxis_{gyroAxisX, gyroAxisY}
+, invert_{invertX, invertY}
+, deadzone_{lsbPer10Dps / 10}           // 1 dps
+, maxBiasDeviation_{lsbPer10Dps}        // 10 dps, above the zero rate offset of common gyroscopes
+, lsbPer10Dps_{lsbPer10Dps}
+, sampleRateHz_{sampleRateHz}
+{
+    setAngleSensitivity(kDefaultFullDeflectionDeg);
+}
+
+void GyroAim::setMode(tMode mode)
+{
+    if (mode != mode_)
+    {
+        for (uint8_t output = 0; output < kNumOutputs; ++output)
+        {
+            integral_[output] = 0;
+        }
+
+        mode_ = mode;
+    }
+}
+
+void GyroAim::setSensitivity(uint16_t fullDeflectionDps)
+{
+    int32_t fullDeflectionLsb = ((int32_t) fullDeflectionDps * lsbPer10Dps_) / 10 - deadzone_;
+
+    gainQ16_ = (fullDeflectionLsb > 0) ? (int32_t) (((int64_t) kOutputMax << 16) / fullDeflectionLsb) : 0;
+}
+
+void GyroAim::setAngleSensitivity(uint16_t fullDeflectionDeg)
+{
+    // Angle [degrees] = integral / (lsbPer10Dps / 10) / sampleRateHz
+    int32_t fullIntegral = (int32_t) fullDeflectionDeg * lsbPer10Dps_ * sampleRateHz_ / 10;
+
+    fullIntegral_ = (fullIntegral > 0) ? fullIntegral : 1;
+
+    for (uint8_t output = 0; output < kNumOutputs; ++output)
+    {
+        integral_[output] = 0;
+    }
+}
+
+void GyroAim::addSample(const int16_t rate[kNumAxes])
+{
+    // The device is considered still if the rate is nearly constant and close to the bias on all axes
+    bool still = true;
+
+    for (uint8_t axis = 0; axis < kNumAxes; ++axis)
+    {
+        still = still
+            && (abs(rate[axis] - prevRate_[axis]) <= kStillThreshold)
+            && (abs(rate[axis] - (biasQ8_[axis] >> 8)) <= maxBiasDeviation_);
+
+        prevRate_[axis] = rate[axis];
+    }
+
+    // Converge fast at first, then track the slow drift of the bias only
+    if (!still)
+    {
+        stillSamples_ = 0;
+    }
+    else if (stillSamples_ < kStillSamples)
+    {
+        ++stillSamples_;
+    }
+    else
+    {
+        uint8_t shift = (biasSamples_ < kFastBiasSamples) ? kFastBiasShift : kSlowBiasShift;
+
+        for (uint8_t axis = 0; axis < kNumAxes; ++axis)
+        {
+            biasQ8_[axis] += (((int32_t) rate[axis] << 8) - biasQ8_[axis]) >> shift;
+        }
+
+        if (biasSamples_ < kFastBiasSamples)
+        {
+            ++biasSamples_;
+        }
+    }
+
+    for (uint8_t output = 0; output < kNumOutputs; ++output)
+    {
+        uint8_t axis = gyroAxis_[output];
+        int32_t rateQ8 = ((int32_t) rate[axis] << 8) - biasQ8_[axis];
+
+        if (invert_[output])
+        {
+            rateQ8 = -rateQ8;
+        }
+
+        filterQ8_[output] += (rateQ8 - filterQ8_[output]) >> filterShift_;
+
+        if (mode_ == INTEGRATED)
+        {
+            // Leak towards the center (rounded away from 0, so that the integral reaches it), then saturate
+            int32_t rounding = (integral_[output] > 0) ? (1 << leakShift_) - 1 : -((1 << leakShift_) - 1);
+            int32_t leak = (leakShift_ > 0) ? (integral_[output] + rounding) / (1 << leakShift_) : 0;
+            int32_t integral = integral_[output] - leak + getRateBeyondDeadzone(output);
+
+            integral_[output] = (integral > fullIntegral_) ? fullIntegral_ : ( (integral < -fullIntegral_) ? -fullIntegral_ : integral );
+        }
+    }
+}
+
+int32_t GyroAim::getRateBeyondDeadzone(uint8_t output) const
+{
+    int32_t rate = filterQ8_[output] / 256;
+
+    if (abs(rate) <= deadzone_)
+    {
+        return 0;
+    }
+
+    return rate + ( (rate > 0) ? -deadzone_ : deadzone_ );
+}
+
+int16_t GyroAim::getDeflection(uint8_t output) const
+{
+    int32_t out;
+
+    if (mode_ == INTEGRATED)
+    {
+        out = (int32_t) ((int64_t) integral_[output] * kOutputMax / fullIntegral_);
+    }
+    else
+    {
+        out = (int32_t) (((int64_t) getRateBeyondDeadzone(output) * gainQ16_) >> 16);
+    }
+
+    if (out > kOutputMax)
+    {
+        return kOutputMax;
+    }
+
+    if (out < -kOutputMax)
+    {
+        return -kOutputMax;
+    }
+
+    return (int16_t) out;
+}
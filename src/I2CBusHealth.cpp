@@ -0,0 +1,258 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "I2CBusHealth.h"
+
+// Half period of the clock pulses generated during bus recovery (about 100 kHz)
+static const uint32_t kRecoveryHalfPeriodMicros = 5;
+
+// Number of clock pulses that frees any slave in the middle of a byte
+static const uint8_t kRecoveryClockPulses = 9;
+
+I2CBusHealth::I2CBusHealth(TwoWire &wire, int pinSda, int pinScl, uint32_t freq)
+: wire_(wire)
+, pinSda_{pinSda}
+, pinScl_{pinScl}
+, freq_{freq}
+{
+    for (uint8_t result = 0; result < kNumResults; ++result)
+    {
+        resultCount_[result].store(0, std::memory_order_relaxed);
+    }
+}
+
+void I2CBusHealth::begin()
+{
+    wire_.begin(pinSda_, pinScl_, freq_);
+    wire_.setTimeOut(kTimeoutMillis);
+}
+
+I2CBusHealth::tResult I2CBusHealth::read(uint8_t addr, int16_t reg, uint8_t *pData, uint8_t numBytes)
+{
+    int64_t nowMicros = esp_timer_get_time();
+
+    if (nowMicros < backoffUntilMicros_)
+    {
+        resultCount_[BACKOFF].fetch_add(1, std::memory_order_relaxed);
+
+        return BACKOFF;
+    }
+
+    transactionCount_.fetch_add(1, std::memory_order_relaxed);
+
+    tResult result = attemptRead(addr, reg, pData, numBytes);
+
+    for (uint8_t retry = 0; (result != OK) && (result != BUS_STUCK) && (retry < kMaxRetries) && takeRetry(nowMicros); ++retry)
+    {
+        retryCount_.fetch_add(1, std::memory_order_relaxed);
+
+        result = attemptRead(addr, reg, pData, numBytes);
+    }
+
+    if (result == OK)
+    {
+        if (consecutiveFailures_ >= kRecoveryThreshold)
+        {
+            log_i("I2C bus is healthy again.");
+        }
+
+        consecutiveFailures_ = 0;
+        backoffUntilMicros_ = 0;
+
+        return OK;
+    }
+
+    failedTransactionCount_.fetch_add(1, std::memory_order_relaxed);
+
+    ++consecutiveFailures_;
+
+    // A stuck bus does not recover by waiting
+    if ( (result == BUS_STUCK) || (consecutiveFailures_ % kRecoveryThreshold == 0) )
+    {
+        log_w("I2C bus error (class %u, %u consecutive failures), recovering the bus.", result, consecutiveFailures_);
+        recoverBus();
+    }
+
+    // Exponential backoff
+    uint8_t shift = (consecutiveFailures_ > 8) ? 8 : (uint8_t) (consecutiveFailures_ - 1);
+    uint32_t backoffMicros = kBackoffMinMicros << shift;
+
+    if (backoffMicros > kBackoffMaxMicros)
+    {
+        backoffMicros = kBackoffMaxMicros;
+    }
+
+    backoffUntilMicros_ = esp_timer_get_time() + backoffMicros;
+
+    return result;
+}
+
+I2CBusHealth::tResult I2CBusHealth::writeRegister(uint8_t addr, uint8_t reg, uint8_t value)
+{
+    transactionCount_.fetch_add(1, std::memory_order_relaxed);
+
+    wire_.beginTransmission(addr);
+    wire_.write(reg);
+    wire_.write(value);
+
+    uint8_t error = wire_.endTransmission();
+
+    tResult result = (error == I2C_ERROR_OK) ? OK : classifyError(addr, error, 0);
+
+    resultCount_[result].fetch_add(1, std::memory_order_relaxed);
+
+    if (result != OK)
+    {
+        failedTransactionCount_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return result;
+}
+
+I2CBusHealth::tResult I2CBusHealth::attemptRead(uint8_t addr, int16_t reg, uint8_t *pData, uint8_t numBytes)
+{
+    tResult result;
+
+    if (reg != kNoRegister)
+    {
+        // Write the register address, followed by a repeated start (reported as I2C_ERROR_CONTINUE by the driver)
+        wire_.beginTransmission(addr);
+        wire_.write((uint8_t) reg);
+
+        uint8_t error = wire_.endTransmission(false);
+
+        if ( (error != I2C_ERROR_OK) && (error != I2C_ERROR_CONTINUE) )
+        {
+            result = classifyError(addr, error, 0);
+            resultCount_[result].fetch_add(1, std::memory_order_relaxed);
+
+            return result;
+        }
+    }
+
+    uint8_t numBytesRead = wire_.requestFrom(addr, numBytes);
+
+    if (numBytesRead == numBytes)
+    {
+        for (uint8_t byteIdx = 0; byteIdx < numBytes; ++byteIdx)
+        {
+            pData[byteIdx] = wire_.read();
+        }
+
+        result = OK;
+    }
+    else
+    {
+        // Discard partial data
+        while (wire_.available())
+        {
+            wire_.read();
+        }
+
+        result = classifyError(addr, wire_.lastError(), numBytesRead);
+    }
+
+    resultCount_[result].fetch_add(1, std::memory_order_relaxed);
+
+    return result;
+}
+
+I2CBusHealth::tResult I2CBusHealth::classifyError(uint8_t addr, uint8_t error, uint8_t numBytesRead)
+{
+    // Both lines are pulled up while the bus is idle
+    if ( !digitalRead(pinSda_) || !digitalRead(pinScl_) )
+    {
+        return BUS_STUCK;
+    }
+
+    switch (error)
+    {
+        case I2C_ERROR_OK:
+            return (numBytesRead > 0) ? SHORT_READ : TRANSIENT;
+
+        case I2C_ERROR_ACK:
+            // The driver does not tell which byte was not acknowledged, so probe the slave with an empty write
+            wire_.beginTransmission(addr);
+
+            return (wire_.endTransmission() == I2C_ERROR_OK) ? DATA_NACK : ADDR_NACK;
+
+        case I2C_ERROR_TIMEOUT:
+            return TIMEOUT;
+
+        default:
+            return BUS_ERROR;
+    }
+}
+
+bool I2CBusHealth::takeRetry(int64_t nowMicros)
+{
+    // Refill the budget according to the elapsed time
+    if (nowMicros - lastRefillMicros_ >= kRetryRefillMicros)
+    {
+        uint32_t refill = (nowMicros - lastRefillMicros_) / kRetryRefillMicros;
+
+        retryBudget_ = (retryBudget_ + refill > kRetryBudgetMax) ? kRetryBudgetMax : (retryBudget_ + refill);
+        lastRefillMicros_ += (int64_t) refill * kRetryRefillMicros;
+    }
+
+    if (retryBudget_ == 0)
+    {
+        return false;
+    }
+
+    --retryBudget_;
+
+    return true;
+}
+
+void I2CBusHealth::recoverBus()
+{
+    // Take over the lines as GPIOs (open drain, the pull-ups of the bus provide the high level)
+    pinMode(pinSda_, INPUT_PULLUP);
+    pinMode(pinScl_, OUTPUT_OPEN_DRAIN);
+    digitalWrite(pinScl_, HIGH);
+    delayMicroseconds(kRecoveryHalfPeriodMicros);
+
+    // Clock out the byte a slave may be sending until it releases SDA
+    for (uint8_t pulse = 0; (pulse < kRecoveryClockPulses) && !digitalRead(pinSda_); ++pulse)
+    {
+        digitalWrite(pinScl_, LOW);
+        delayMicroseconds(kRecoveryHalfPeriodMicros);
+        digitalWrite(pinScl_, HIGH);
+        delayMicroseconds(kRecoveryHalfPeriodMicros);
+    }
+
+    // Generate a STOP condition: SDA rises while SCL is high
+    pinMode(pinSda_, OUTPUT_OPEN_DRAIN);
+    digitalWrite(pinScl_, LOW);
+    digitalWrite(pinSda_, LOW);
+    delayMicroseconds(kRecoveryHalfPeriodMicros);
+    digitalWrite(pinScl_, HIGH);
+    delayMicroseconds(kRecoveryHalfPeriodMicros);
+    digitalWrite(pinSda_, HIGH);
+    delayMicroseconds(kRecoveryHalfPeriodMicros);
+
+    // Reattach the lines to the I2C controller
+    begin();
+
+    recoveryCount_.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,278 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "I2CScheduler.h"
+
+// Tolerance for a job to be due, aligns the periods with the RTOS ticks [us]
+static const int64_t kDueToleranceMicros = portTICK_PERIOD_MS * 1000 / 2;
+
+I2CScheduler::I2CScheduler(I2CBusHealth &bus, uint32_t batchBudgetMicros)
+: bus_(bus)
+, batchBudgetMicros_{batchBudgetMicros}
+{
+    for (uint8_t jobId = 0; jobId < kMaxJobs; ++jobId)
+    {
+        tJob &job = jobs_[jobId];
+
+        job.periodMicros.store(0, std::memory_order_relaxed);
+        job.triggered.store(false, std::memory_order_relaxed);
+        job.dueMicros = 0;
+        job.gridPeriodMicros = 0;
+        job.lastDurationMicros = 0;
+        job.runCount.store(0, std::memory_order_relaxed);
+        job.deferCount.store(0, std::memory_order_relaxed);
+        job.missCount.store(0, std::memory_order_relaxed);
+    }
+
+    mutex_ = xSemaphoreCreateMutex();
+}
+
+int8_t I2CScheduler::addJob(const tJobConfig &config)
+{
+    if ( (taskHandle_ != nullptr) || (numJobs_ >= kMaxJobs) ||
+         (config.numBytes == 0) || (config.numBytes > kMaxJobBytes) || (config.callback == nullptr) )
+    {
+        return kInvalidJobId;
+    }
+
+    tJob &job = jobs_[numJobs_];
+
+    job.config = config;
+    job.periodMicros.store(config.periodMicros, std::memory_order_relaxed);
+
+    return numJobs_++;
+}
+
+void I2CScheduler::start(const char *name, UBaseType_t priority, BaseType_t core)
+{
+    if (taskHandle_ != nullptr)
+    {
+        return;
+    }
+
+    windowStartMicros_ = esp_timer_get_time();
+
+    xTaskCreatePinnedToCore(I2CScheduler::schedulerTask, name, 3072, this, priority, &taskHandle_, core);
+}
+
+void I2CScheduler::setJobPeriod(int8_t jobId, uint32_t periodMicros)
+{
+    jobs_[jobId].periodMicros.store(periodMicros, std::memory_order_relaxed);
+
+    // Wake up the task, which may be waiting for a job with the previous period
+    if (taskHandle_ != nullptr)
+    {
+        xTaskNotifyGive(taskHandle_);
+    }
+}
+
+void I2CScheduler::trigger(int8_t jobId)
+{
+    jobs_[jobId].triggered.store(true, std::memory_order_release);
+
+    if (taskHandle_ != nullptr)
+    {
+        xTaskNotifyGive(taskHandle_);
+    }
+}
+
+void I2CScheduler::lock()
+{
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+
+    lockStartMicros_ = esp_timer_get_time();
+}
+
+void I2CScheduler::unlock()
+{
+    accountBusy(lockStartMicros_, esp_timer_get_time());
+
+    xSemaphoreGive(mutex_);
+}
+
+void I2CScheduler::schedulerTask(void *p)
+{
+    I2CScheduler *pScheduler = (I2CScheduler*) p;
+
+    while (true)
+    {
+        // Wait for the next periodic job or for a trigger
+        ulTaskNotifyTake(pdTRUE, pScheduler->getWaitTicks());
+
+        pScheduler->runBatch();
+    }
+}
+
+TickType_t I2CScheduler::getWaitTicks()
+{
+    int64_t nowMicros = esp_timer_get_time();
+    int64_t waitMicros = -1;
+
+    for (uint8_t jobId = 0; jobId < numJobs_; ++jobId)
+    {
+        uint32_t periodMicros = jobs_[jobId].periodMicros.load(std::memory_order_relaxed);
+
+        if (periodMicros == 0)
+        {
+            continue;
+        }
+
+        // A job with a new period is due immediately, see runBatch()
+        int64_t jobWaitMicros = (periodMicros == jobs_[jobId].gridPeriodMicros) ? (jobs_[jobId].dueMicros - nowMicros) : 0;
+
+        if ( (waitMicros < 0) || (jobWaitMicros < waitMicros) )
+        {
+            waitMicros = (jobWaitMicros > 0) ? jobWaitMicros : 0;
+        }
+    }
+
+    if (waitMicros < 0)
+    {
+        return portMAX_DELAY;
+    }
+
+    // Wait at least one tick, so that jobs deferred by the budget do not starve the tasks of lower priority
+    TickType_t waitTicks = (waitMicros + kDueToleranceMicros) / (portTICK_PERIOD_MS * 1000);
+
+    return (waitTicks > 0) ? waitTicks : 1;
+}
+
+void I2CScheduler::runBatch()
+{
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+
+    int64_t batchStartMicros = esp_timer_get_time();
+
+    // Collect the due jobs, ordered by descending priority
+    uint8_t dueJobIds[kMaxJobs];
+    uint8_t numDueJobs = 0;
+
+    for (uint8_t jobId = 0; jobId < numJobs_; ++jobId)
+    {
+        tJob &job = jobs_[jobId];
+        uint32_t periodMicros = job.periodMicros.load(std::memory_order_relaxed);
+
+        // Start a new grid after a change of the period
+        if (periodMicros != job.gridPeriodMicros)
+        {
+            job.gridPeriodMicros = periodMicros;
+            job.dueMicros = batchStartMicros;
+        }
+
+        bool due = job.triggered.load(std::memory_order_acquire)
+            || ( (periodMicros > 0) && (job.dueMicros - batchStartMicros <= kDueToleranceMicros) );
+
+        if (!due)
+        {
+            continue;
+        }
+
+        uint8_t pos = numDueJobs++;
+
+        while ( (pos > 0) && (jobs_[dueJobIds[pos - 1]].config.priority < job.config.priority) )
+        {
+            dueJobIds[pos] = dueJobIds[pos - 1];
+            --pos;
+        }
+
+        dueJobIds[pos] = jobId;
+    }
+
+    uint8_t data[kMaxJobBytes];
+
+    for (uint8_t dueIdx = 0; dueIdx < numDueJobs; ++dueIdx)
+    {
+        tJob &job = jobs_[dueJobIds[dueIdx]];
+
+        int64_t startMicros = esp_timer_get_time();
+
+        // The job remains due and is executed in the next batch
+        if ( (dueIdx > 0) && (startMicros - batchStartMicros + job.lastDurationMicros > batchBudgetMicros_) )
+        {
+            job.deferCount.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        job.triggered.store(false, std::memory_order_relaxed);
+
+        // Advance the due time on the grid of the period, skipping the periods that have been missed completely
+        uint32_t periodMicros = job.periodMicros.load(std::memory_order_relaxed);
+
+        if (periodMicros > 0)
+        {
+            job.dueMicros += periodMicros;
+
+            if (job.dueMicros <= startMicros)
+            {
+                uint32_t missedPeriods = (startMicros - job.dueMicros) / periodMicros + 1;
+
+                job.dueMicros += (int64_t) missedPeriods * periodMicros;
+                job.missCount.fetch_add(missedPeriods, std::memory_order_relaxed);
+            }
+        }
+
+        tCompletion completion;
+
+        completion.result = bus_.read(job.config.addr, job.config.reg, data, job.config.numBytes);
+        completion.pData = data;
+        completion.numBytes = job.config.numBytes;
+        completion.startMicros = (uint32_t) startMicros;
+        completion.endMicros = (uint32_t) esp_timer_get_time();
+        completion.pBus = &bus_;
+
+        job.config.callback(job.config.pContext, completion);
+
+        job.lastDurationMicros = (uint32_t) (esp_timer_get_time() - startMicros);
+        job.runCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (numDueJobs > 0)
+    {
+        accountBusy(batchStartMicros, esp_timer_get_time());
+    }
+
+    xSemaphoreGive(mutex_);
+}
+
+void I2CScheduler::accountBusy(int64_t startMicros, int64_t endMicros)
+{
+    uint32_t busyMicros = (uint32_t) (endMicros - startMicros);
+
+    windowBusyMicros_ += busyMicros;
+
+    if (busyMicros > windowMaxBusyMicros_)
+    {
+        windowMaxBusyMicros_ = busyMicros;
+    }
+
+    int64_t windowMicros = endMicros - windowStartMicros_;
+
+    if (windowMicros >= kUtilizationWindowMicros)
+    {
+        utilizationPermille_.store((uint16_t) ((uint64_t) windowBusyMicros_ * 1000 / windowMicros), std::memory_order_relaxed);
+        maxBusyMicros_.store(windowMaxBusyMicros_, std::memory_order_relaxed);
+
+        windowStartMicros_ = endMicros;
+        windowBusyMicros_ = 0;
+        windowMaxBusyMicros_ = 0;
+    }
+}
@@ -0,0 +1,156 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "InputTrace.h"
+
+uint8_t InputTrace::writeVarint(uint32_t value, uint8_t *pOut)
+{
+    uint8_t numBytes = 0;
+
+    while (value >= 0x80)
+    {
+        pOut[numBytes++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+
+    pOut[numBytes++] = (uint8_t) value;
+
+    return numBytes;
+}
+
+uint8_t InputTrace::encodeKeyframe(const tRecord &state, uint8_t *pOut)
+{
+    pOut[0] = (uint8_t) state.micros;
+    pOut[1] = (uint8_t) (state.micros >> 8);
+    pOut[2] = (uint8_t) (state.micros >> 16);
+    pOut[3] = (uint8_t) (state.micros >> 24);
+    pOut[4] = state.rawX;
+    pOut[5] = state.rawY;
+    pOut[6] = (state.joyPressed ? 1 : 0) | ((state.btnLevels & ((1 << kMaxButtons) - 1)) << 1);
+
+    return kKeyframeSize;
+}
+
+uint8_t InputTrace::encodeRecord(const tRecord &record, tRecord &state, uint8_t *pOut)
+{
+    uint8_t numBytes = 1;
+
+    if (record.type == JOYSTICK)
+    {
+        pOut[0] = (JOYSTICK << 6) | (record.joyPressed ? 1 : 0);
+        numBytes += writeVarint(record.micros - state.micros, &pOut[numBytes]);
+        numBytes += writeVarint(zigzag((int32_t) record.rawX - state.rawX), &pOut[numBytes]);
+        numBytes += writeVarint(zigzag((int32_t) record.rawY - state.rawY), &pOut[numBytes]);
+
+        state.rawX = record.rawX;
+        state.rawY = record.rawY;
+        state.joyPressed = record.joyPressed ? 1 : 0;
+    }
+    else
+    {
+        pOut[0] = (BUTTONS << 6) | (record.btnLevels & ((1 << kMaxButtons) - 1));
+        numBytes += writeVarint(record.micros - state.micros, &pOut[numBytes]);
+
+        state.btnLevels = record.btnLevels & ((1 << kMaxButtons) - 1);
+    }
+
+    state.micros = record.micros;
+    state.type = record.type;
+
+    return numBytes;
+}
+
+InputTrace::BlockReader::BlockReader(const uint8_t *pBlock)
+: pBlock_{pBlock}
+, pos_{kKeyframeSize}
+{
+    state_.micros = pBlock[0] | (pBlock[1] << 8) | (pBlock[2] << 16) | ((uint32_t) pBlock[3] << 24);
+    state_.type = END;
+    state_.rawX = pBlock[4];
+    state_.rawY = pBlock[5];
+    state_.joyPressed = pBlock[6] & 1;
+    state_.btnLevels = pBlock[6] >> 1;
+}
+
+bool InputTrace::BlockReader::readVarint(uint32_t &value)
+{
+    value = 0;
+
+    for (uint8_t shift = 0; (pos_ < kBlockSize) && (shift < 35); shift += 7)
+    {
+        uint8_t byte = pBlock_[pos_++];
+
+        value |= (uint32_t) (byte & 0x7F) << shift;
+
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool InputTrace::BlockReader::next(tRecord &record)
+{
+    if (pos_ >= kBlockSize)
+    {
+        return false;
+    }
+
+    uint8_t header = pBlock_[pos_++];
+    uint8_t type = header >> 6;
+    uint32_t deltaMicros;
+
+    if ( ((type != JOYSTICK) && (type != BUTTONS)) || !readVarint(deltaMicros) )
+    {
+        pos_ = kBlockSize;
+        return false;
+    }
+
+    if (type == JOYSTICK)
+    {
+        uint32_t deltaX;
+        uint32_t deltaY;
+
+        if ( !readVarint(deltaX) || !readVarint(deltaY) )
+        {
+            pos_ = kBlockSize;
+            return false;
+        }
+
+        state_.rawX = (uint8_t) (state_.rawX + unzigzag(deltaX));
+        state_.rawY = (uint8_t) (state_.rawY + unzigzag(deltaY));
+        state_.joyPressed = header & 1;
+    }
+    else
+    {
+        state_.btnLevels = header & ((1 << kMaxButtons) - 1);
+    }
+
+    state_.micros += deltaMicros;
+    state_.type = type;
+
+    record = state_;
+
+    return true;
+}
@@ -0,0 +1,66 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <Arduino.h>
+#include "LatencyBLEService.h"
+#include "BLE2901.h"
+
+LatencyBLEService::LatencyBLEService()
+: latencyService_{nullptr}
+, inputLatency_{nullptr}
+{
+}
+
+void LatencyBLEService::start(BLEServer *pServer)
+{
+    log_v(">>");
+
+    latencyService_ = pServer->createService(kLatencyServiceUUID);
+
+    // Characteristic: Input latency (7 x uint32: number of reports, freshest p50/p99/max, stalest p50/p99/max)
+    {
+        inputLatency_ = latencyService_->createCharacteristic(kInputLatencyUUID, BLECharacteristic::PROPERTY_READ);
+
+        BLE2901 *pBle2901 = new BLE2901("Input age at notify [us]: reports, freshest p50/p99/max, stalest p50/p99/max");
+
+        inputLatency_->addDescriptor(pBle2901);
+
+        InputLatencyTracer::tSummary summary = {};
+        setInputLatency(summary);
+    }
+
+    log_v("Starting latency service.");
+
+    latencyService_->start();
+
+    log_v("<<");
+}
+
+/**
+ * Sets the value of the read-only input latency characteristic.
+ * 
+ * @param summary : Input ages of the last completed window [us], see InputLatencyTracer::tSummary.
+ */
+void LatencyBLEService::setInputLatency(const InputLatencyTracer::tSummary &summary)
+{
+    inputLatency_->setValue( (uint8_t*) &summary, sizeof(summary) );
+}
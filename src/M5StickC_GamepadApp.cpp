@@ -24,12 +24,25 @@
 #include <Arduino.h>
 #include <M5StickC.h>
 #include <Wire.h>
+#include <esp_timer.h>
+#include <atomic>
 
 #include "GamepadBLE.h"
 #include "M5StickC_GamepadIO.h"
 
 #include "AXP192_BLEService.h"
 #include "M5StickC_PowerManagement.h"
+#include "SlotScheduler.h"
+#include "LatencyHistogram.h"
+#include "RateTierController.h"
+#include "InputLatencyTracer.h"
+#include "LatencyBLEService.h"
+#include "DeferredLog.h"
+#include "StickCurve.h"
+#include "OneEuroFilter.h"
+#include "I2CBusHealth.h"
+#include "I2CScheduler.h"
+#include "MPU6886_MotionAim.h"
 
 // Bluetooth icon in RGB565 format and 16x24 size
 static const uint16_t image_data_icon_bluetooth[384] = {
@@ -85,9 +98,120 @@ AXP192_BLEService axp192Ble;
 // Object providing utility functions for accessing power management data
 M5StickC_PowerManagement axp192PowMan;
 
+// Number of sent input reports per window of the input latency statistics
+static const uint32_t kInputLatencyWindowSize = 1000;
+
+// Object tracing the age of the inputs at the time an input report is sent
+InputLatencyTracer inputLatencyTracer(kInputLatencyWindowSize);
+
+// Time of the button event contained in the most recently sent input report [us]
+uint32_t lastReportedBtnEdgeMicros = 0;
+
+#ifdef LATENCYBLE
+// Object providing the input latency statistics via BLE
+LatencyBLEService latencyBle;
+#endif
+
 
 /**
- * The execution of the loop function is structured into cycles where each cycle comprises a fixed number of slots.
+ * The work is distributed across two tasks that are pinned to different cores:
+ * - The input task acquires the gamepad controls and sends the input report to the host.
+ * - The housekeeping task updates the display, processes power management data and prints diagnostics.
+ * Thus, slow display and I2C operations of the housekeeping task cannot delay the next joystick sample.
+ * The BLE stack runs on core 0 as well, but with a higher priority than the housekeeping task.
+ */
+
+// Core and priority of the input task (the button task of M5StickC_GamepadIO runs on the same core)
+static const BaseType_t kInputTaskCore = 1;
+static const UBaseType_t kInputTaskPriority = configMAX_PRIORITIES - 2;
+
+// Core and priority of the housekeeping task
+static const BaseType_t kHousekeepingTaskCore = 0;
+static const UBaseType_t kHousekeepingTaskPriority = 2;
+
+/**
+ * Power management data is read and processed by a separate worker task with the lowest priority.
+ * The worker publishes the results via a mailbox (queue of length 1) to the housekeeping task.
+ */
+
+// Core and priority of the power management worker task
+static const BaseType_t kPowerTaskCore = 0;
+static const UBaseType_t kPowerTaskPriority = 1;
+
+// Period of the power management worker task [ms]
+static const uint32_t kPowerTaskPeriodMillis = 2500;
+
+/**
+ * Power management data published by the power management worker task.
+ */
+typedef struct {
+    uint8_t batLevelPercent;
+    float   batVoltage;
+    float   batPower;
+    float   batChargeCurrent;
+    float   coulombData;
+    uint8_t currentDirection;
+    uint8_t acInPresent;
+    uint8_t acInAvailable;
+    uint8_t vBusPresent;
+    uint8_t vBusAvailable;
+} tPowerStatus;
+
+// Mailbox holding the most recent power management data
+QueueHandle_t powerStatusMailbox = nullptr;
+
+/**
+ * The internal I2C bus connects the AXP192, the RTC and the MPU6886. It is owned by a scheduler, which executes
+ * the periodic read jobs of the devices. The M5StickC library accesses the AXP192 and the RTC directly, hence
+ * these accesses are bracketed by internalBus.lock() and internalBus.unlock().
+ */
+
+// I2C configuration of the internal bus
+static const int kI2CinternalPinSda = 21;
+static const int kI2CinternalPinScl = 22;
+static const uint32_t kI2CinternalFreq = 400000;
+
+// Time budget of a batch of transactions on the internal bus [us]
+static const uint32_t kInternalBusBatchBudgetMicros = 2000;
+
+// Core and priority of the scheduler task of the internal bus
+static const BaseType_t kInternalBusTaskCore = 0;
+static const UBaseType_t kInternalBusTaskPriority = configMAX_PRIORITIES - 3;
+
+I2CBusHealth internalBusHealth(Wire1, kI2CinternalPinSda, kI2CinternalPinScl, kI2CinternalFreq);
+
+I2CScheduler internalBus(internalBusHealth, kInternalBusBatchBudgetMicros);
+
+/**
+ * Gyro aim: the angular rate measured by the IMU drives the right stick.
+ */
+
+// Period of the IMU read job, i.e. one FIFO burst per slot [us]
+static const uint32_t kMotionAimPeriodMicros = 10000;
+
+// Priority of the IMU read job on the internal bus
+static const uint8_t kMotionAimJobPriority = 10;
+
+// Age of the gyro aim after which the right stick is centered [us]
+static const uint32_t kMotionAimStaleMicros = 100000;
+
+// Gyroscope axes that drive the right stick (depends on how the gamepad is held): yaw turns left/right, pitch up/down
+static const uint8_t kMotionAimGyroAxisX = 2;
+static const bool kMotionAimInvertX = true;
+static const uint8_t kMotionAimGyroAxisY = 1;
+static const bool kMotionAimInvertY = false;
+
+MPU6886_MotionAim motionAim(internalBus, GyroAim(MPU6886_MotionAim::kGyroLsbPer10Dps, MPU6886_MotionAim::kSampleRateHz,
+    kMotionAimGyroAxisX, kMotionAimInvertX, kMotionAimGyroAxisY, kMotionAimInvertY));
+
+// Gyro aim on/off, toggled by the housekeeping task (serial command 'g'). Serial command 'm' toggles the mode.
+std::atomic<bool> gyroAimEnabled{false};
+
+// The gyro aim deflected the right stick in the last call of processGamepadControls(), used for activity detection
+bool gyroAimActive = false;
+
+/**
+ * The execution of each task is structured into cycles where each cycle comprises a fixed number of slots.
  * The numner of the slot determines which sub functions are executed.
  * Some sub functions are executed in every slot, others are executed e.g. only in the last slot of each cycle.
  */
@@ -95,38 +219,172 @@ M5StickC_PowerManagement axp192PowMan;
 // Number of slots in each cycle
 static const uint16_t kNumSlots = 200;
 
-// Number of the current slot of the current cycle
-uint16_t curSlotNr = 0;
-
-// Nominal duration of each slot in microseconds. Time that is not used up in a slot is spent by calling the delay function.
+// Duration of each slot in microseconds
 static const uint32_t slotTimeMicros = 25000;
 
 /**
- * Statistical data the helps to analyse computation times of the loop function.
+ * The input task polls and reports the gamepad controls once per tick. The tick period adapts to the user activity.
+ * The housekeeping task executes one tick per slot.
+ * Time that is not used up in a tick is spent sleeping until the next tick.
+ */
+
+// Tick period for each rate tier in microseconds: ACTIVE, REST, IDLE
+static const uint32_t kTierPeriodMicros[RateTierController::kNumTiers] = { 5000, 25000, 100000 };
+
+// Time without activity until the tick period falls back from ACTIVE to REST
+static const uint32_t kRestAfterMicros = 1000000;
+
+// Time without activity until the tick period falls back to IDLE
+static const uint32_t kIdleAfterMicros = 30000000;
+
+/**
+ * Returns the time since boot in microseconds.
  */
+uint64_t clockMicros()
+{
+    return esp_timer_get_time();
+}
 
-// Start time of loop function in microseconds
-uint64_t timeStartMicros = 0;
+/**
+ * One-shot timer that wakes up a sleeping task at a precise point in time, one per task that calls sleepUntilMicros().
+ */
+typedef struct {
+    esp_timer_handle_t timer;
+    TaskHandle_t task;
+} tWakeTimer;
 
-// End time of loop function in microseconds
-uint64_t timeEndMicros = 0;
+tWakeTimer inputWakeTimer = {};
+tWakeTimer housekeepingWakeTimer = {};
 
-// Duration of loop function in microseconds
-uint32_t timeDeltaMicros = 0;
+/**
+ * Callback of a wake timer, executed by the esp_timer task.
+ */
+void onWakeTimer(void *p)
+{
+    xTaskNotifyGive(((tWakeTimer*) p)->task);
+}
+
+/**
+ * Blocks the calling task until the given point in time.
+ * The whole time is spent in the blocked state so that other tasks can run (or the core can idle). The task is
+ * woken up by an esp_timer, i.e. with a resolution of microseconds instead of RTOS ticks.
+ * The task must not receive task notifications from elsewhere while sleeping.
+ *
+ * @param wakeTimer Wake timer of the calling task, created on the first call.
+ *
+ * @param wakeTimeMicros Time since boot in microseconds.
+ */
+void sleepUntilMicros(tWakeTimer &wakeTimer, uint64_t wakeTimeMicros)
+{
+    int64_t remainingMicros = (int64_t) wakeTimeMicros - esp_timer_get_time();
 
-// Maximum duration of a slot within the current cycle
-uint32_t timeDeltaMaxInCycleMicros = 0;
+    // The deadline may have passed already, e.g. if the task has been preempted after the overrun check
+    if (remainingMicros <= 0)
+    {
+        return;
+    }
 
-// Overall maximum duration of a slot throughout all cycles
-uint32_t timeDeltaMaxMicros = 0;
+    if (wakeTimer.timer == nullptr)
+    {
+        esp_timer_create_args_t args = {};
+        args.callback = onWakeTimer;
+        args.arg = &wakeTimer;
+        args.name = "wake";
+
+        wakeTimer.task = xTaskGetCurrentTaskHandle();
+        esp_timer_create(&args, &wakeTimer.timer);
+    }
 
+    // Discard a notification of a timer that expired after the previous wake-up
+    esp_timer_stop(wakeTimer.timer);
+    ulTaskNotifyTake(pdTRUE, 0);
 
-// Buffer for storing string outputs
-char strOut[200];
+    esp_timer_start_once(wakeTimer.timer, remainingMicros);
+
+    // The tick timeout is a fallback in case the notification is lost, it cannot fire before the deadline
+    TickType_t timeoutTicks = (TickType_t) (remainingMicros / 1000 / portTICK_PERIOD_MS + 2);
+
+    while ( (esp_timer_get_time() < (int64_t) wakeTimeMicros) && (ulTaskNotifyTake(pdTRUE, timeoutTicks) > 0) )
+    {
+        // Woken up early, keep sleeping until the timer expires
+    }
+}
+
+void sleepUntilMicrosInput(uint64_t wakeTimeMicros)
+{
+    sleepUntilMicros(inputWakeTimer, wakeTimeMicros);
+}
+
+void sleepUntilMicrosHousekeeping(uint64_t wakeTimeMicros)
+{
+    sleepUntilMicros(housekeepingWakeTimer, wakeTimeMicros);
+}
+
+// Schedulers that pace the tasks in ticks and slots and keep statistics about computation time and jitter
+SlotScheduler inputScheduler(slotTimeMicros, kNumSlots, clockMicros, sleepUntilMicrosInput);
+SlotScheduler housekeepingScheduler(slotTimeMicros, kNumSlots, clockMicros, sleepUntilMicrosHousekeeping);
+
+// Selects the tick period of the scheduler depending on the user activity
+RateTierController rateTierController(kTierPeriodMicros, kRestAfterMicros, kIdleAfterMicros);
+
+/**
+ * Latency histograms of the sub functions that are executed in the slots.
+ * Send 'p' via the serial monitor to print the histograms, send 'r' to reset them.
+ * Send 'a' to switch to the next joystick acquisition mode (the histograms are reset), so that the computation
+ * time of processGamepadControls can be compared between synchronous, asynchronous and sampled joystick reads.
+ * Send 'c' to switch to the next stick response curve, send 'b' to compare the computation time of the
+ * curve lookup tables with the equivalent floating point math.
+ */
+
+// Sub functions whose computation time is measured
+enum tSubtask {
+    kSubtaskGamepadControls = 0, kSubtaskJoystickRead, kSubtaskInputTick,
+    kSubtaskDisplayFast, kSubtaskDisplaySlow, kSubtaskPowerStatus, kSubtaskHousekeepingTick,
+    kSubtaskAxp,
+    kNumSubtasks
+};
+
+// Names of the sub functions for the output
+static const char* const kSubtaskNames[kNumSubtasks] = {
+    "processGamepadControls", "joystick I2C read", "input tick (total)",
+    "updateDisplayFast", "updateDisplaySlow", "updatePowerStatus", "housekeeping tick (total)",
+    "processAxp (worker)"
+};
+
+// Computation time histogram of each sub function in microseconds
+LatencyHistogram subtaskLatency[kNumSubtasks];
+
+// Minimum change of a stick axis value (range -32768..32767) that causes an input report to be sent.
+// Two raw joystick steps of the default range (1 step = 32767 / 100 = 327), i.e. single step noise is suppressed.
+// A wider learned range makes the steps smaller, so the threshold covers more steps there.
+static const uint16_t kAxisChangeThreshold = 2 * AxisMapper::kOutputMax / M5StickC_GamepadIO::kJoyDefaultHalfRange;
+
+// Interval after which an unchanged input report is sent anyway [ms]
+static const uint32_t kReportKeepAliveMillis = 1000;
+
+// Rate at which the joystick is sampled in the background [Hz]
+static const uint16_t kJoySampleRateHz = 500;
+
+// Number of joystick samples the median is taken of (i.e. a delay of 2 samples = 4 ms at 500 Hz)
+static const uint8_t kJoyFilterWindowSize = 5;
+
+// Names of the joystick acquisition modes for the output
+static const char* const kAcquisitionModeNames[] = { "synchronous", "asynchronous", "sampled" };
+
+/**
+ * Response curve applied to the left stick. Selected by the housekeeping task (serial command 'c'),
+ * applied by the input task.
+ */
+std::atomic<const StickCurve::tProfileDef*> pStickProfile{StickCurve::getProfile(StickCurve::tProfile::RADIAL_DEADZONE)};
 
 // BLE server object of this device
 BLEServer *pServer = nullptr;
 
+// Task functions, see below
+void inputTask(void *p);
+void housekeepingTask(void *p);
+void powerTask(void *p);
+
 /**
  * Initializes the BLE device and BLE server. 
  */
@@ -144,10 +402,15 @@ void setup()
 {
     M5.begin();
 
+    // Take over the internal bus initialized by the M5StickC library
+    internalBusHealth.begin();
+
+    DeferredLog::getInstance()->start(kHousekeepingTaskCore);
+
     axp192PowMan.start();
 
     pGamepadIO = M5StickC_GamepadIO::getInstance();
-    pGamepadIO->start();
+    pGamepadIO->start(kInputTaskCore);
 
     M5.Lcd.setTextFont(4);
     M5.Lcd.setCursor(70, 0, 4);
@@ -158,10 +421,24 @@ void setup()
     pGamepadBle = GamepadBLE::getInstance();
     pGamepadBle->start(pServer, kGamepadDeviceInfo);
 
+    // Send reports only on relevant changes, plus a keep-alive once per second
+    pGamepadBle->setReportMode(GamepadBLE::tReportMode::ON_CHANGE);
+    pGamepadBle->setAxisChangeThreshold(kAxisChangeThreshold);
+    pGamepadBle->setKeepAliveInterval(kReportKeepAliveMillis);
+
+    // Sample the joystick in the background at a high rate and use the median of the newest samples
+    pGamepadIO->setJoySampleRate(kJoySampleRateHz);
+    pGamepadIO->setJoyFilter(JoystickFilter::tFilterType::MEDIAN, kJoyFilterWindowSize);
+    pGamepadIO->setAcquisitionMode(M5StickC_GamepadIO::tAcquisitionMode::SAMPLED);
+
     #ifdef AXP192BLE
     axp192Ble.start(pServer);
     #endif
 
+    #ifdef LATENCYBLE
+    latencyBle.start(pServer);
+    #endif
+
     // Yield and let other tasks initialize
     delay(200);
 
@@ -171,14 +448,27 @@ void setup()
     log_d("Free PSRAM: %d", ESP.getFreePsram());
 
     log_d("IDF version: %s", ESP.getSdkVersion());
+
+    // Start the tasks that perform the actual work
+    powerStatusMailbox = xQueueCreate(1, sizeof(tPowerStatus));
+
+    // Jobs must be registered before the scheduler starts. Gyro aim stays off until it is turned on (serial command 'g').
+    if ( motionAim.start(kMotionAimPeriodMicros, kMotionAimJobPriority) )
+    {
+        motionAim.setEnabled(gyroAimEnabled.load(std::memory_order_relaxed));
+    }
+
+    internalBus.start("Internal I2C bus task", kInternalBusTaskPriority, kInternalBusTaskCore);
+
+    xTaskCreatePinnedToCore(powerTask, "Power management task", 4096, nullptr, kPowerTaskPriority, nullptr, kPowerTaskCore);
+    xTaskCreatePinnedToCore(inputTask, "Gamepad input task", 4096, nullptr, kInputTaskPriority, nullptr, kInputTaskCore);
+    xTaskCreatePinnedToCore(housekeepingTask, "Gamepad housekeeping task", 8192, nullptr, kHousekeepingTaskPriority, nullptr, kHousekeepingTaskCore);
 }
 
 /**
- * Prints the current RTC date and time (real time clock) into a char array.
- * 
- * @param str Buffer for storing the output.
+ * Logs the current RTC date and time (real time clock).
  */
-void rtcTimestampToStr(char* str)
+void logRtcTimestamp()
 {
     RTC_TimeTypeDef RTC_TimeStruct;
     RTC_DateTypeDef RTC_DateStruct;
@@ -186,7 +476,7 @@ void rtcTimestampToStr(char* str)
     M5.Rtc.GetTime(&RTC_TimeStruct);
     M5.Rtc.GetData(&RTC_DateStruct);
     
-    sprintf(str, "%04d-%02d-%02d, %02d:%02d:%02d",
+    DeferredLog::getInstance()->log(DeferredLog::kFmtRtcTimestamp,
         RTC_DateStruct.Year, RTC_DateStruct.Month, RTC_DateStruct.Date,
         RTC_TimeStruct.Hours, RTC_TimeStruct.Minutes, RTC_TimeStruct.Seconds);
 }
@@ -194,67 +484,180 @@ void rtcTimestampToStr(char* str)
 /**
  * Processes power management data.
  * Among other things determines the battery level of the gamepad.
+ * Executed by the power management worker task, which is the only task that accesses the AXP192 and the RTC.
  */
 void processAxp()
 {
+    internalBus.lock();
+
     // Read and process AXP192 data
     axp192PowMan.readAndProcessData();
     
-    // Debug output
-    char rtcTimestampStr[40];
-    rtcTimestampToStr(rtcTimestampStr);
+    // Debug output (values converted to fixed-point integers in micro units for the deferred log)
+    logRtcTimestamp();
+
+    internalBus.unlock();
+
+    DeferredLog::getInstance()->log(DeferredLog::kFmtPowerStatus,
+        (int32_t) (axp192PowMan.getBatVoltage() * 1000.0f),
+        (int32_t) (axp192PowMan.getBatPower() * 1000.0f),
+        (int32_t) (axp192PowMan.getBatCurrent() * 1000.0f),
+        (int32_t) (axp192PowMan.getBatChargeCurrent() * 1000.0f),
+        (int32_t) (axp192PowMan.getBatDischargeCurrent() * 1000.0f),
+        (int32_t) (axp192PowMan.getCoulombData() * 1000.0f),
+        (int32_t) (axp192PowMan.getCoulombCounterMaxValue() * 1000.0f),
+        axp192PowMan.isVBusPresent());
+
+    // Publish the results, overwriting data that has not been consumed yet
+    tPowerStatus status;
+
+    status.batLevelPercent  = (uint8_t) axp192PowMan.getBatteryLevelPercent();
+    status.batVoltage       = axp192PowMan.getBatVoltage();
+    status.batPower         = axp192PowMan.getBatPower();
+    status.batChargeCurrent = axp192PowMan.getBatChargeCurrent();
+    status.coulombData      = axp192PowMan.getCoulombData();
+    status.currentDirection = axp192PowMan.getCurrentDirection();
+    status.acInPresent      = axp192PowMan.isACInPresent();
+    status.acInAvailable    = axp192PowMan.isACInAvailable();
+    status.vBusPresent      = axp192PowMan.isVBusPresent();
+    status.vBusAvailable    = axp192PowMan.isVBusAvailable();
+
+    xQueueOverwrite(powerStatusMailbox, &status);
+}
+
+/**
+ * Takes new power management data from the mailbox, if available, and provides it to the host.
+ */
+void updatePowerStatus()
+{
+    tPowerStatus status;
 
-    axp192PowMan.printStatusToString(strOut);
-    log_i("%s: %s", rtcTimestampStr, strOut);
+    if ( xQueueReceive(powerStatusMailbox, &status, 0) != pdTRUE )
+    {
+        return; // no new data
+    }
 
     // Set battery level of gamepad
-    uint8_t batLvlPerc = (uint8_t) axp192PowMan.getBatteryLevelPercent();
-    pGamepadBle->updateBatteryLevel(batLvlPerc);
+    pGamepadBle->updateBatteryLevel(status.batLevelPercent);
 
     #ifdef AXP192BLE
     // Update AXP192 BLE service data
-    axp192Ble.setBatVoltage( axp192PowMan.getBatVoltage() );
-    axp192Ble.setBatPower( axp192PowMan.getBatPower() );
-    axp192Ble.setBatChargeCurrent( axp192PowMan.getBatChargeCurrent() );
-    axp192Ble.setCoulombData( axp192PowMan.getCoulombData() );
-    axp192Ble.setCurrentDirection( axp192PowMan.getCurrentDirection() );
-    axp192Ble.setACInPresent( axp192PowMan.isACInPresent() );
-    axp192Ble.setACInAvailable( axp192PowMan.isACInPresent() );
-    axp192Ble.setVBusPresent( axp192PowMan.isVBusPresent() );
-    axp192Ble.setVBusAvailable( axp192PowMan.isVBusAvailable() );
+    axp192Ble.setBatVoltage( status.batVoltage );
+    axp192Ble.setBatPower( status.batPower );
+    axp192Ble.setBatChargeCurrent( status.batChargeCurrent );
+    axp192Ble.setCoulombData( status.coulombData );
+    axp192Ble.setCurrentDirection( status.currentDirection );
+    axp192Ble.setACInPresent( status.acInPresent );
+    axp192Ble.setACInAvailable( status.acInAvailable );
+    axp192Ble.setVBusPresent( status.vBusPresent );
+    axp192Ble.setVBusAvailable( status.vBusAvailable );
     #endif
 }
 
+/**
+ * Records the age of the freshest and the stalest input contained in the input report that has just been sent.
+ * Inputs are the joystick sample and, if it has not been reported before, the most recent button event.
+ * 
+ * @param input Snapshot of the inputs the report has been created from.
+ */
+void traceInputLatency(const M5StickC_GamepadIO::tInputState &input)
+{
+    uint32_t nowMicros = (uint32_t) clockMicros();
+
+    uint32_t freshestAgeMicros = nowMicros - input.joySampleMicros;
+    uint32_t stalestAgeMicros = freshestAgeMicros;
+
+    if (input.btnEdgeMicros != lastReportedBtnEdgeMicros)
+    {
+        uint32_t btnAgeMicros = nowMicros - input.btnEdgeMicros;
+
+        if (btnAgeMicros < freshestAgeMicros)
+        {
+            freshestAgeMicros = btnAgeMicros;
+        }
+        else
+        {
+            stalestAgeMicros = btnAgeMicros;
+        }
+
+        lastReportedBtnEdgeMicros = input.btnEdgeMicros;
+    }
+
+    inputLatencyTracer.recordReport(freshestAgeMicros, stalestAgeMicros);
+}
+
 void processGamepadControls()
 {
     pGamepadIO->process();
 
-    // Transform positions to output range
-    GamepadBLE::StickAxis_t joyScaledX = pGamepadIO->getJoyNormX() << 8;
-    GamepadBLE::StickAxis_t joyScaledY = pGamepadIO->getJoyNormY() << 8;
+    // Duration of the I2C transaction, which is only part of this function's computation time in mode SYNCHRONOUS
+    subtaskLatency[kSubtaskJoystickRead].record(pGamepadIO->getJoyReadMicros());
+
+    // Consistent snapshot of all inputs
+    M5StickC_GamepadIO::tInputState input = pGamepadIO->getInputState();
+
+    // Transform positions to output range by applying the response curve
+    GamepadBLE::StickAxis_t joyScaledX;
+    GamepadBLE::StickAxis_t joyScaledY;
+
+    StickCurve::apply(pStickProfile.load(std::memory_order_relaxed), input.joyNormX, input.joyNormY, joyScaledX, joyScaledY);
+
+    // Neutralize the stick while the joystick cannot be read, instead of repeating its last position
+    if (input.joyStale)
+    {
+        joyScaledX = 0;
+        joyScaledY = 0;
+    }
 
     // Set left stick axis values
     pGamepadBle->setLeftStick(joyScaledX, joyScaledY);
 
     // Set stick button state
-    pGamepadBle->setLeftStickButton( pGamepadIO->isJoyPressed() );
+    pGamepadBle->setLeftStickButton( input.joyPressed && !input.joyStale );
+
+    // Set right stick axis values from the gyro aim, centered if it is disabled or stale
+    MPU6886_MotionAim::tAim aim = motionAim.getAim();
+
+    bool aimValid = gyroAimEnabled.load(std::memory_order_relaxed)
+        && ((uint32_t) esp_timer_get_time() - aim.sampleMicros <= kMotionAimStaleMicros);
+
+    if (!aimValid)
+    {
+        aim.stickX = 0;
+        aim.stickY = 0;
+    }
+
+    pGamepadBle->setRightStick(aim.stickX, aim.stickY);
+
+    gyroAimActive = (aim.stickX != 0) || (aim.stickY != 0);
 
-    // Set A and B button
-    pGamepadBle->setButtonA( pGamepadIO->getBtnBlueActivation() );
-    pGamepadBle->setButtonB( pGamepadIO->getBtnRedActivation()  );
+    // Set A and B button (every tap is reported, even if it is shorter than the report period).
+    // Edges only enter reports that cannot be replaced by a later one while the link is busy.
+    M5StickC_GamepadIO::tBtnMask buttons = pGamepadIO->getReportButtons( pGamepadBle->isReadyForButtonEdges() );
+
+    pGamepadBle->setButtonA( (buttons >> M5StickC_GamepadIO::kBtnIdxBlue) & 1 );
+    pGamepadBle->setButtonB( (buttons >> M5StickC_GamepadIO::kBtnIdxRed)  & 1 );
 
     // Send data to host device
-    pGamepadBle->updateInputReport();
+    if ( pGamepadBle->updateInputReport() )
+    {
+        traceInputLatency(input);
+    }
 }
 
 void updateDisplayFast()
 {
+    // Snapshot of the inputs published by the input task
+    M5StickC_GamepadIO::tInputState input = pGamepadIO->getInputState();
+
     M5.Lcd.setCursor(100, 50, 4);
-    M5.Lcd.printf("X:%d      ", pGamepadIO->getJoyNormX());
+    M5.Lcd.printf("X:%d      ", input.joyNormX);
     M5.Lcd.setCursor(100, 80, 4);
-    M5.Lcd.printf("Y:%d      ", pGamepadIO->getJoyNormY());
+    M5.Lcd.printf("Y:%d      ", input.joyNormY);
     M5.Lcd.setCursor(100, 110, 4);
-    M5.Lcd.printf("%d%d%d", pGamepadIO->isJoyPressed(), pGamepadIO->isBtnBluePressed(), pGamepadIO->isBtnRedPressed());
+    M5.Lcd.printf("%d%d%d", input.joyPressed,
+        (input.btnPressed >> M5StickC_GamepadIO::kBtnIdxBlue) & 1,
+        (input.btnPressed >> M5StickC_GamepadIO::kBtnIdxRed) & 1);
 }
 
 void updateDisplaySlow()
@@ -297,86 +700,513 @@ void updateDisplaySlow()
     }
 }
 
-void loop()
+/**
+ * Executes a sub function and records its computation time.
+ * 
+ * @param subtask Tag of the sub function.
+ * @param func Sub function to be executed.
+ */
+inline void runProfiled(tSubtask subtask, void (*func)())
 {
-    // Store start time of loop() to compute duration later on
-    timeStartMicros = micros();
+    uint64_t startMicros = clockMicros();
+
+    func();
+
+    subtaskLatency[subtask].record(clockMicros() - startMicros);
+}
 
-    log_v(">>");
+/**
+ * Prints the computation time histograms of all sub functions.
+ */
+void printSubtaskLatency()
+{
+    for (uint8_t subtask = 0; subtask < kNumSubtasks; ++subtask)
+    {
+        const LatencyHistogram &hist = subtaskLatency[subtask];
 
-    // In the first slot of a cycle, reset the "max slot duration per cycle"
-    if (curSlotNr == 0) {
-        timeDeltaMaxInCycleMicros = 0;
+        log_i("%-22s n = %u, p50 <= %u us, p99 <= %u us, max = %u us",
+            kSubtaskNames[subtask], hist.getCount(), hist.getPercentile(50), hist.getPercentile(99), hist.getMax());
     }
+}
 
-    /* ----- Read gamepad controls and send to host ------ */
-    
-    // Do in every slot
-    processGamepadControls();
+/**
+ * Prints the input latency statistics of the most recently completed window and updates the BLE characteristic.
+ */
+void printInputLatency()
+{
+    InputLatencyTracer::tSummary summary;
+    inputLatencyTracer.getSummary(summary);
 
-    /* ----- Update display ----- */
+    DeferredLog::getInstance()->log(DeferredLog::kFmtInputLatency,
+        summary.numReports,
+        summary.freshestP50, summary.freshestP99, summary.freshestMax,
+        summary.stalestP50, summary.stalestP99, summary.stalestMax);
 
-    // Do every second slot
-    if (curSlotNr % 2 == 0)
+    #ifdef LATENCYBLE
+    latencyBle.setInputLatency(summary);
+    #endif
+}
+
+/**
+ * Resets the computation time histograms of all sub functions.
+ */
+void resetSubtaskLatency()
+{
+    for (uint8_t subtask = 0; subtask < kNumSubtasks; ++subtask)
     {
-        updateDisplayFast();
+        subtaskLatency[subtask].reset();
     }
+}
+
+/**
+ * Measures the computation time of shaping all stick positions with each response curve,
+ * once via the lookup table and once via single precision floating point math.
+ * Blocks the calling task for up to a few hundred milliseconds.
+ */
+void benchmarkStickCurve()
+{
+    static const uint8_t kNumRepetitions = 4;
 
-    // Do every 20 slots in slot 1, 21 etc.
-    if (curSlotNr % 20 == 1)
+    // Prevents the compiler from optimizing the computations away
+    volatile int16_t sink;
+
+    for (uint8_t profile = 0; profile < StickCurve::kNumProfiles; ++profile)
     {
-        updateDisplaySlow();
+        const StickCurve::tProfileDef *pProfile = StickCurve::getProfile((StickCurve::tProfile) profile);
+        int16_t outX, outY;
+
+        uint64_t startMicros = clockMicros();
+
+        for (uint8_t rep = 0; rep < kNumRepetitions; ++rep)
+        {
+            for (int16_t x = -128; x < 128; ++x)
+            {
+                StickCurve::apply(pProfile, x * 256, 0, outX, outY);
+                sink = outX;
+            }
+        }
+
+        uint32_t lutMicros = clockMicros() - startMicros;
+
+        startMicros = clockMicros();
+
+        for (uint8_t rep = 0; rep < kNumRepetitions; ++rep)
+        {
+            for (int16_t x = -128; x < 128; ++x)
+            {
+                sink = StickCurve::computeValueFloat((StickCurve::tProfile) profile, x);
+            }
+        }
+
+        uint32_t floatMicros = clockMicros() - startMicros;
+
+        log_i("Stick curve %-16s %u evaluations: LUT %u us, float math %u us",
+            StickCurve::getProfileName((StickCurve::tProfile) profile), kNumRepetitions * StickCurve::kLutSize, lutMicros, floatMicros);
     }
 
-    /* ----- Update battery status ----- */
+    (void) sink;
+}
+
+/**
+ * Compares the smoothed joystick path with the unsmoothed one on a synthetic trace sampled at 500 Hz: the stick
+ * rests with +/-1 raw step of noise, moves by 100 raw steps within 50 ms and rests again.
+ * Reports the computation time per sample in CPU cycles, the jitter at rest (peak-to-peak) and the lag of the
+ * motion (samples until 90 % of the motion have been covered). Blocks the calling task for a few milliseconds.
+ */
+void benchmarkJoySmoothing()
+{
+    static const uint16_t kNumSamples = 600;
+    static const uint16_t kMotionStart = 300;
+    static const uint16_t kMotionSamples = 25;
+    static const uint8_t kMotionSteps = 4;
+    static const uint8_t kRestPos = 122;
+    static const uint32_t kSamplePeriodMicros = 2000;
+
+    static uint16_t trace[kNumSamples];
+
+    // Noise from a linear congruential generator, so that every run uses the same trace
+    uint32_t lcg = 12345;
 
-    // Do in slot 3 every 100 slots
-    if (curSlotNr % 100 == 3)
+    for (uint16_t sampleIdx = 0; sampleIdx < kNumSamples; ++sampleIdx)
     {
-        processAxp();
+        lcg = lcg * 1103515245 + 12345;
+
+        uint16_t motion = (sampleIdx < kMotionStart) ? 0 :
+            ( (sampleIdx < kMotionStart + kMotionSamples) ? (sampleIdx - kMotionStart + 1) * kMotionSteps : kMotionSamples * kMotionSteps );
+
+        trace[sampleIdx] = (kRestPos + motion + (int8_t) ((lcg >> 16) % 3) - 1) << 8;
     }
 
-    /* ----- Print statistics about computation time ----- */
-    
-    // Do in last slot of each cycle (stats of the last slot itself are not accounted for)
-    if (curSlotNr == kNumSlots - 1)
-    {
-        sprintf(strOut, "Duration of loop execution in microseconds: %d (last), %d (max in cylce), %d (max overall)",
-                timeDeltaMicros,
-                timeDeltaMaxInCycleMicros,
-                timeDeltaMaxMicros);
+    OneEuroFilter filter(M5StickC_GamepadIO::kJoySmoothingMinCutoffQ8, M5StickC_GamepadIO::kJoySmoothingBetaQ8,
+                         M5StickC_GamepadIO::kJoySmoothingDerivCutoffQ8);
+
+    static uint16_t smoothed[kNumSamples];
 
-        log_i("%s", strOut);
+    uint32_t startCycles = ESP.getCycleCount();
+
+    for (uint16_t sampleIdx = 0; sampleIdx < kNumSamples; ++sampleIdx)
+    {
+        smoothed[sampleIdx] = filter.filter(trace[sampleIdx], sampleIdx * kSamplePeriodMicros);
     }
 
-    log_v("<<");
-        
-    // Compute duration of loop
-    timeEndMicros = micros();
-    timeDeltaMicros = timeEndMicros - timeStartMicros;
+    uint32_t cyclesPerSample = (ESP.getCycleCount() - startCycles) / kNumSamples;
 
-    // Update maximum slot duration within cycle
-    if (timeDeltaMicros > timeDeltaMaxInCycleMicros)
+    const uint16_t *paths[] = { trace, smoothed };
+    const char* const kPathNames[] = { "unsmoothed", "smoothed" };
+
+    for (uint8_t pathIdx = 0; pathIdx < 2; ++pathIdx)
     {
-        timeDeltaMaxInCycleMicros = timeDeltaMicros;
+        const uint16_t *pPath = paths[pathIdx];
+
+        // Jitter over the second half of the rest period, after the filter has settled
+        uint16_t minQ8 = 0xFFFF;
+        uint16_t maxQ8 = 0;
+
+        for (uint16_t sampleIdx = kMotionStart / 2; sampleIdx < kMotionStart; ++sampleIdx)
+        {
+            minQ8 = (pPath[sampleIdx] < minQ8) ? pPath[sampleIdx] : minQ8;
+            maxQ8 = (pPath[sampleIdx] > maxQ8) ? pPath[sampleIdx] : maxQ8;
+        }
+
+        // Lag: samples from the start of the motion until 90 % of it have been covered
+        uint16_t targetQ8 = (kRestPos << 8) + (kMotionSamples * kMotionSteps * 256) * 9 / 10;
+        uint16_t lagSamples = kMotionStart;
 
-        // Update overall maximum slot duration
-        if (timeDeltaMicros > timeDeltaMaxMicros)
+        while ( (lagSamples < kNumSamples) && (pPath[lagSamples] < targetQ8) )
         {
-            timeDeltaMaxMicros = timeDeltaMicros;
+            ++lagSamples;
         }
+
+        log_i("Joystick %-10s: jitter at rest %u/256 raw steps peak-to-peak, 90 %% of motion after %u samples",
+            kPathNames[pathIdx], maxQ8 - minQ8, lagSamples - kMotionStart + 1);
     }
 
-    // Increase slot number up to end of cycle
-    curSlotNr = (curSlotNr + 1) % kNumSlots;
+    log_i("Joystick smoothing: %u CPU cycles per sample", cyclesPerSample);
+}
 
-    /* ----- Wait remaining time until next slot ----- */
-    if (timeDeltaMicros < slotTimeMicros) {
-        delayMicroseconds(slotTimeMicros - timeDeltaMicros);
+/**
+ * Handles single character commands received via the serial interface.
+ */
+void processSerialCommands()
+{
+    while (Serial.available() > 0)
+    {
+        switch (Serial.read())
+        {
+            case 'p':
+                printSubtaskLatency();
+                printInputLatency();
+                break;
+
+            case 'r':
+                resetSubtaskLatency();
+                log_i("Latency histograms reset.");
+                break;
+
+            case 'a':
+            {
+                M5StickC_GamepadIO::tAcquisitionMode mode = pGamepadIO->getAcquisitionMode();
+
+                mode = (M5StickC_GamepadIO::tAcquisitionMode) ((mode + 1) % (M5StickC_GamepadIO::tAcquisitionMode::SAMPLED + 1));
+                pGamepadIO->setAcquisitionMode(mode);
+
+                resetSubtaskLatency();
+                log_i("Joystick acquisition mode: %s, latency histograms reset.", kAcquisitionModeNames[mode]);
+                break;
+            }
+
+            case 'c':
+            {
+                static uint8_t profile = StickCurve::tProfile::RADIAL_DEADZONE;
+
+                profile = (profile + 1) % StickCurve::kNumProfiles;
+                pStickProfile.store(StickCurve::getProfile((StickCurve::tProfile) profile), std::memory_order_relaxed);
+
+                log_i("Stick response curve: %s", StickCurve::getProfileName((StickCurve::tProfile) profile));
+                break;
+            }
+
+            case 'b':
+                benchmarkStickCurve();
+                break;
+
+            case 'o':
+                benchmarkJoySmoothing();
+                break;
+
+            case 's':
+            {
+                bool enabled = !pGamepadIO->getJoySmoothing();
+
+                pGamepadIO->setJoySmoothing(enabled);
+
+                log_i("Joystick smoothing: %s", enabled ? "on" : "off");
+                break;
+            }
+
+            case 'g':
+            {
+                bool enabled = !gyroAimEnabled.load(std::memory_order_relaxed);
+
+                gyroAimEnabled.store(enabled, std::memory_order_relaxed);
+                motionAim.setEnabled(enabled);
+
+                log_i("Gyro aim: %s", enabled ? "on" : "off");
+                break;
+            }
+
+            case 'm':
+            {
+                GyroAim::tMode mode = (motionAim.getMode() == GyroAim::RATE) ? GyroAim::INTEGRATED : GyroAim::RATE;
+
+                motionAim.setMode(mode);
+
+                log_i("Gyro aim mode: %s", (mode == GyroAim::RATE) ? "rate" : "integrated");
+                break;
+            }
+
+            case 'i':
+            {
+                bool enabled = !pGamepadIO->isInputRecording();
+
+                pGamepadIO->setInputRecording(enabled);
+
+                log_i("Input recording: %s", enabled ? "started" : "stopped");
+                break;
+            }
+
+            case 'd':
+                pGamepadIO->dumpInputRecording(Serial);
+                break;
+
+            case 'x':
+                pGamepadIO->resetCalibration();
+                break;
+
+            case 'n':
+            {
+                GamepadBLE::tNotifyPath path = (pGamepadBle->getNotifyPath() == GamepadBLE::tNotifyPath::DIRECT)
+                    ? GamepadBLE::tNotifyPath::LIBRARY : GamepadBLE::tNotifyPath::DIRECT;
+
+                pGamepadBle->setNotifyPath(path);
+
+                log_i("Report notify path: %s", (path == GamepadBLE::tNotifyPath::DIRECT) ? "direct" : "library");
+                break;
+            }
+
+            default:
+                break; // ignore
+        }
     }
-    else {
-        // Print warning when slot time has been exceed
-        log_w("Duration of loop greater than cycle time: %d microseconds.", timeDeltaMicros);
+}
+
+/**
+ * Acquires the gamepad controls and sends the input report to the host once per tick.
+ * The tick period adapts to the user activity.
+ */
+void inputTask(void *p)
+{
+    inputScheduler.start();
+
+    while (true)
+    {
+        runProfiled(kSubtaskGamepadControls, processGamepadControls);
+
+        // Adapt the tick period to the user activity
+        rateTierController.update(pGamepadIO->isActive() || gyroAimActive, clockMicros());
+        inputScheduler.setTickPeriodMicros(rateTierController.getTickPeriodMicros());
+        pGamepadIO->setProcessPeriodMicros(rateTierController.getTickPeriodMicros());
+
+        // Trade report latency for power only after sustained idleness
+        pGamepadBle->setLinkProfile( (rateTierController.getTier() == RateTierController::IDLE)
+            ? GamepadBLE::tLinkProfile::POWER_SAVING : GamepadBLE::tLinkProfile::LOW_LATENCY );
+
+        // Sleep until the deadline of the next tick (overruns are only counted here and printed by the housekeeping task)
+        inputScheduler.waitForNextTick();
+
+        subtaskLatency[kSubtaskInputTick].record(inputScheduler.getBusyMicros());
     }
+}
+
+/**
+ * Prints statistics about the computation time of both tasks.
+ */
+void printTaskStatistics()
+{
+    DeferredLog *pLog = DeferredLog::getInstance();
+
+    pLog->log(DeferredLog::kFmtInputTickDuration,
+        inputScheduler.getBusyMicros(),
+        inputScheduler.getBusyMaxInCycleMicros(),
+        inputScheduler.getBusyMaxMicros());
+
+    pLog->log(DeferredLog::kFmtInputTickJitter,
+        inputScheduler.getJitterMaxInCycleMicros(),
+        inputScheduler.getJitterMaxMicros(),
+        inputScheduler.getOverrunCount(),
+        inputScheduler.getSkippedTickCount());
+
+    pLog->log(DeferredLog::kFmtRateTier,
+        rateTierController.getTier(),
+        rateTierController.getTimeInTierMillis(RateTierController::ACTIVE),
+        rateTierController.getTimeInTierMillis(RateTierController::REST),
+        rateTierController.getTimeInTierMillis(RateTierController::IDLE),
+        rateTierController.getTierChangeCount());
+
+    pLog->log(DeferredLog::kFmtReportCounts, pGamepadBle->getReportsSent(), pGamepadBle->getReportsSuppressed());
+
+    GamepadBLE::tSendStats sendStats;
+    pGamepadBle->getSendStats(sendStats);
+
+    pLog->log(DeferredLog::kFmtReportSend,
+        sendStats.path,
+        sendStats.numReports,
+        sendStats.avgCycles,
+        sendStats.maxCycles,
+        sendStats.numAllocs,
+        sendStats.maxAllocs);
+
+    pLog->log(DeferredLog::kFmtReportCongestion,
+        pGamepadBle->getReportsReplaced(),
+        pGamepadBle->getReportsInFlight(),
+        pGamepadBle->getReportsInFlightTimeouts(),
+        pGamepadBle->getCongestionCount(),
+        pGamepadBle->getCongestedMillis());
+
+    pLog->log(DeferredLog::kFmtButtonEvents, pGamepadIO->getCoalescedTapCount(), pGamepadIO->getBtnEventOverflowCount());
+
+    const I2CBusHealth &joyBus = pGamepadIO->getJoyBusHealth();
+
+    pLog->log(DeferredLog::kFmtJoystickBus,
+        joyBus.getTransactionCount(),
+        joyBus.getFailedTransactionCount(),
+        joyBus.getResultCount(I2CBusHealth::ADDR_NACK),
+        joyBus.getResultCount(I2CBusHealth::DATA_NACK),
+        joyBus.getResultCount(I2CBusHealth::TIMEOUT),
+        joyBus.getResultCount(I2CBusHealth::BUS_ERROR) + joyBus.getResultCount(I2CBusHealth::BUS_STUCK),
+        joyBus.getRetryCount(),
+        joyBus.getRecoveryCount());
+
+    I2CScheduler &groveBus = pGamepadIO->getGroveBus();
+
+    pLog->log(DeferredLog::kFmtI2CBusLoad,
+        groveBus.getUtilizationPermille(),
+        internalBus.getUtilizationPermille(),
+        groveBus.getMaxBusyMicros(),
+        internalBus.getMaxBusyMicros(),
+        groveBus.getJobRunCount(pGamepadIO->getJoyJobId()),
+        groveBus.getJobDeferCount(pGamepadIO->getJoyJobId()),
+        groveBus.getJobMissCount(pGamepadIO->getJoyJobId()));
+
+    MPU6886_MotionAim::tSlotTiming motionTiming = motionAim.getSlotTiming();
+
+    pLog->log(DeferredLog::kFmtMotionAim,
+        motionTiming.busMicros,
+        motionTiming.busMaxMicros,
+        motionTiming.cpuMicros,
+        motionTiming.cpuMaxMicros,
+        motionAim.getFrameCount(),
+        motionAim.getOverflowCount(),
+        motionAim.getReadErrorCount());
+
+    printInputLatency();
+
+    // Stats of the last slot itself are not accounted for
+    pLog->log(DeferredLog::kFmtHousekeepingSlotDuration,
+        housekeepingScheduler.getBusyMicros(),
+        housekeepingScheduler.getBusyMaxInCycleMicros(),
+        housekeepingScheduler.getBusyMaxMicros());
+}
+
+/**
+ * Updates the display, processes power management data and prints diagnostics once per slot.
+ */
+void housekeepingTask(void *p)
+{
+    housekeepingScheduler.start();
 
-}
\ No newline at end of file
+    while (true)
+    {
+        log_v(">>");
+
+        /* ----- Update display ----- */
+
+        // Do every second slot
+        if (housekeepingScheduler.isSlotDue(2, 0))
+        {
+            runProfiled(kSubtaskDisplayFast, updateDisplayFast);
+        }
+
+        // Do every 20 slots in slot 1, 21 etc.
+        if (housekeepingScheduler.isSlotDue(20, 1))
+        {
+            runProfiled(kSubtaskDisplaySlow, updateDisplaySlow);
+        }
+
+        /* ----- Update battery status ----- */
+
+        // Do in slot 3 every 20 slots (the data is provided by the power management worker task)
+        if (housekeepingScheduler.isSlotDue(20, 3))
+        {
+            runProfiled(kSubtaskPowerStatus, updatePowerStatus);
+        }
+
+        /* ----- Handle requests for diagnostic output ----- */
+
+        // Do in slot 5 every 20 slots
+        if (housekeepingScheduler.isSlotDue(20, 5))
+        {
+            processSerialCommands();
+        }
+
+        /* ----- Store the learned joystick center ----- */
+
+        // Do in slot 9 of each cycle (writes to flash are coalesced by M5StickC_GamepadIO)
+        if (housekeepingScheduler.isSlotDue(kNumSlots, 9))
+        {
+            pGamepadIO->persistCalibration();
+        }
+
+        /* ----- Print statistics about computation time ----- */
+
+        // Do in last slot of each cycle
+        if (housekeepingScheduler.isSlotDue(kNumSlots, kNumSlots - 1))
+        {
+            printTaskStatistics();
+        }
+
+        log_v("<<");
+
+        /* ----- Sleep until the deadline of the next slot ----- */
+        housekeepingScheduler.waitForNextTick();
+
+        subtaskLatency[kSubtaskHousekeepingTick].record(housekeepingScheduler.getBusyMicros());
+
+        if (housekeepingScheduler.hasOverrun())
+        {
+            // Print warning when slot time has been exceeded
+            log_w("Duration of housekeeping slot greater than slot time: %d microseconds.", housekeepingScheduler.getBusyMicros());
+        }
+    }
+}
+
+/**
+ * Reads and processes the power management data periodically with the lowest priority.
+ */
+void powerTask(void *p)
+{
+    TickType_t lastWakeTime = xTaskGetTickCount();
+
+    while (true)
+    {
+        runProfiled(kSubtaskAxp, processAxp);
+
+        vTaskDelayUntil(&lastWakeTime, kPowerTaskPeriodMillis / portTICK_PERIOD_MS);
+    }
+}
+
+void loop()
+{
+    // All work is done by the input task and the housekeeping task, hence the loop task is not needed
+    vTaskDelete(nullptr);
+}
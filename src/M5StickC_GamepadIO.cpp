@@ -23,8 +23,15 @@
 #include "M5StickC_GamepadIO.h"
 
 #include <M5StickC.h>
+#include <Preferences.h>
 
-const uint8_t M5StickC_GamepadIO::kBtnPin[2] = {kPinButtonBlue, kPinButtonRed};
+const uint8_t M5StickC_GamepadIO::kBtnPin[kBtnCount] = {kPinButtonBlue, kPinButtonRed};
+
+const char* const M5StickC_GamepadIO::kCalibrationNamespace = "joycal";
+
+const char* const M5StickC_GamepadIO::kCalibrationKeys[CenterCalibrator::kNumAxes] = {"centerX", "centerY"};
+
+const char* const M5StickC_GamepadIO::kRangeKeys[CenterCalibrator::kNumAxes] = {"rangeX", "rangeY"};
 
 
 M5StickC_GamepadIO* M5StickC_GamepadIO::getInstance()
@@ -40,49 +47,462 @@ M5StickC_GamepadIO::M5StickC_GamepadIO()
 
 }
 
-void M5StickC_GamepadIO::start()
+void M5StickC_GamepadIO::start(BaseType_t taskCore)
 {
     if (!initialized_)
     {
         initialized_ = true;
 
+        // Use the center learned in previous sessions right from the start
+        loadCalibration();
+
         // Setup I2C communiation for JoyC (grove port)
-        Wire.begin(kI2CpinSda, kI2CpinScl, kI2Cfreq);
+        joyBus_.begin();
 
         // Configure GPIO pins of dual button unit
         pinMode(kPinButtonBlue, INPUT_PULLUP);
         pinMode(kPinButtonRed, INPUT_PULLUP);
 
-        /* Register an interrupt routine for each button
-           Intention: Detect very short button activations between two calls of the "process" function
-           The registered interrupt routines set a flag each time a button is pressed
-        */
-        /*attachInterruptArg(digitalPinToInterrupt(kPinButtonBlue), isrBtnBlue, this, CHANGE);
-        attachInterruptArg(digitalPinToInterrupt(kPinButtonRed),  isrBtnRed,  this, CHANGE);*/
-
         // Create task with maximum priority for reading the button states
-        xTaskCreate(M5StickC_GamepadIO::buttonTask, "Gamepad button task", 4096, this, configMAX_PRIORITIES - 1, NULL);
+        xTaskCreatePinnedToCore(M5StickC_GamepadIO::buttonTask, "Gamepad button task", 4096, this, configMAX_PRIORITIES - 1, &buttonTaskHandle_, taskCore);
+
+        // Register an interrupt routine for each button, which captures the edges of the button signal
+        if (btnCaptureMode_ == tButtonCaptureMode::INTERRUPT)
+        {
+            for (uint8_t btnIdx = 0; btnIdx < kBtnCount; ++btnIdx)
+            {
+                btnIsrArg_[btnIdx] = {this, btnIdx, kBtnPin[btnIdx]};
+                attachInterruptArg(digitalPinToInterrupt(kBtnPin[btnIdx]), isrButton, &btnIsrArg_[btnIdx], CHANGE);
+            }
+        }
+
+        // Register the joystick read job, its period is set according to the acquisition mode
+        I2CScheduler::tJobConfig joyJob = {
+            kI2CjoystickUnitAddr, I2CBusHealth::kNoRegister, kI2CjoystickUnitNumBytes, kJoyJobPriority, 0,
+            M5StickC_GamepadIO::onJoystickRead, this
+        };
+
+        joyJobId_ = groveBus_.addJob(joyJob);
+
+        setJoySampleRate(kDefaultJoySampleRateHz);
+
+        /* Start the scheduler task for background reads. It preempts the caller of process() just long enough to
+           start the I2C transactions and then blocks until they are completed by the I2C interrupt. */
+        groveBus_.start("Grove I2C bus task", configMAX_PRIORITIES - 1, taskCore);
+
+        // Issue the first transaction, so that a sample is available on the first call in mode ASYNCHRONOUS
+        groveBus_.trigger(joyJobId_);
     }
 }
 
-void M5StickC_GamepadIO::process()
+void M5StickC_GamepadIO::loadCalibration()
+{
+    Preferences prefs;
+    prefs.begin(kCalibrationNamespace, true);
+
+    for (uint8_t axis = 0; axis < CenterCalibrator::kNumAxes; ++axis)
+    {
+        uint16_t centerQ8 = prefs.getUShort(kCalibrationKeys[axis], kJoyNominalCenter << 8);
+
+        if (!centerCalibrator_.setCenterQ8(axis, centerQ8))
+        {
+            log_w("Ignoring implausible joystick center %u/256 of axis %u.", centerQ8, axis);
+        }
+
+        joyMapper_[axis].setCenter(centerCalibrator_.getCenter(axis));
+
+        // Range: minimum in the low byte, maximum in the high byte (0 = not stored yet)
+        uint16_t range = prefs.getUShort(kRangeKeys[axis], 0);
+
+        if (range != 0)
+        {
+            joyMapper_[axis].setRange(range & 0xFF, range >> 8);
+        }
+
+        log_i("Joystick axis %u: center = %u, min = %u, max = %u",
+            axis, joyMapper_[axis].getCenter(), joyMapper_[axis].getMin(), joyMapper_[axis].getMax());
+    }
+
+    prefs.end();
+
+    publishCalibration();
+    persistedCalibration_ = calibration_.read();
+}
+
+void M5StickC_GamepadIO::publishCalibration()
+{
+    tCalibration calibration;
+
+    for (uint8_t axis = 0; axis < CenterCalibrator::kNumAxes; ++axis)
+    {
+        calibration.centerQ8[axis] = centerCalibrator_.getCenterQ8(axis);
+        calibration.rawMin[axis] = joyMapper_[axis].getMin();
+        calibration.rawMax[axis] = joyMapper_[axis].getMax();
+    }
+
+    calibration_.write(calibration);
+}
+
+void M5StickC_GamepadIO::persistCalibration()
+{
+    // Wait until process() has reset the calibration in use
+    if (calibrationResetPending_.load(std::memory_order_acquire))
+    {
+        return;
+    }
+
+    tCalibration calibration = calibration_.read();
+
+    // The keys have been removed, so there is nothing to store until something is learned again
+    if (calibrationResetPersisted_)
+    {
+        persistedCalibration_ = calibration;
+        calibrationResetPersisted_ = false;
+        return;
+    }
+
+    bool changed = false;
+
+    for (uint8_t axis = 0; axis < CenterCalibrator::kNumAxes; ++axis)
+    {
+        changed = changed
+            || (abs(calibration.centerQ8[axis] - persistedCalibration_.centerQ8[axis]) >= kCalibrationPersistMinDeltaQ8)
+            || (calibration.rawMin[axis] != persistedCalibration_.rawMin[axis])
+            || (calibration.rawMax[axis] != persistedCalibration_.rawMax[axis]);
+    }
+
+    if ( !changed || (millis() - lastPersistMillis_ < kCalibrationPersistIntervalMillis) )
+    {
+        return;
+    }
+
+    Preferences prefs;
+    prefs.begin(kCalibrationNamespace, false);
+
+    for (uint8_t axis = 0; axis < CenterCalibrator::kNumAxes; ++axis)
+    {
+        prefs.putUShort(kCalibrationKeys[axis], calibration.centerQ8[axis]);
+        prefs.putUShort(kRangeKeys[axis], calibration.rawMin[axis] | (calibration.rawMax[axis] << 8));
+    }
+
+    prefs.end();
+
+    persistedCalibration_ = calibration;
+    lastPersistMillis_ = millis();
+
+    log_i("Joystick calibration stored: center x = %u/256, y = %u/256; range x = %u..%u, y = %u..%u",
+        calibration.centerQ8[0], calibration.centerQ8[1],
+        calibration.rawMin[0], calibration.rawMax[0], calibration.rawMin[1], calibration.rawMax[1]);
+}
+
+void M5StickC_GamepadIO::resetCalibration()
 {
-    // Read joystick raw data via I2C
-    if ( Wire.requestFrom(kI2CjoystickUnitAddr, kI2CjoystickUnitNumBytes) ) {
-        joyRawX_ = Wire.read();
-        joyRawY_ = Wire.read();
-        joyPressed_ = Wire.read();
+    Preferences prefs;
+    prefs.begin(kCalibrationNamespace, false);
+
+    for (uint8_t axis = 0; axis < CenterCalibrator::kNumAxes; ++axis)
+    {
+        prefs.remove(kCalibrationKeys[axis]);
+        prefs.remove(kRangeKeys[axis]);
+    }
+
+    prefs.end();
+
+    calibrationResetPersisted_ = true;
+    calibrationResetPending_.store(true, std::memory_order_release);
+
+    log_i("Joystick calibration removed from NVS, default center and range apply.");
+}
+
+void M5StickC_GamepadIO::setAcquisitionMode(tAcquisitionMode mode)
+{
+    acquisitionMode_.store(mode, std::memory_order_relaxed);
+
+    updateJoyJobPeriod();
+}
+
+void M5StickC_GamepadIO::setJoySampleRate(uint16_t rateHz)
+{
+    TickType_t periodTicks = (rateHz > 0) ? (1000 / rateHz) / portTICK_PERIOD_MS : 0;
+
+    joySamplePeriodMicros_.store( ((periodTicks > 0) ? periodTicks : 1) * portTICK_PERIOD_MS * 1000, std::memory_order_relaxed );
+
+    updateJoyJobPeriod();
+}
+
+uint32_t M5StickC_GamepadIO::getJoyStaleMicros()
+{
+    // In mode SAMPLED, the joystick is read in the background, otherwise on each call of process()
+    uint32_t intervalMicros = (getAcquisitionMode() == tAcquisitionMode::SAMPLED)
+        ? joySamplePeriodMicros_.load(std::memory_order_relaxed) : processPeriodMicros_.load(std::memory_order_relaxed);
+
+    return intervalMicros + kJoyStaleMarginMicros;
+}
+
+void M5StickC_GamepadIO::updateJoyJobPeriod()
+{
+    if (joyJobId_ == I2CScheduler::kInvalidJobId)
+    {
+        return;
+    }
+
+    // Only mode SAMPLED reads periodically
+    bool sampled = (getAcquisitionMode() == tAcquisitionMode::SAMPLED);
+
+    groveBus_.setJobPeriod(joyJobId_, sampled ? joySamplePeriodMicros_.load(std::memory_order_relaxed) : 0);
+}
+
+void M5StickC_GamepadIO::readJoystick(tJoySample &sample)
+{
+    uint32_t startMicros = (uint32_t) esp_timer_get_time();
+
+    uint8_t data[kI2CjoystickUnitNumBytes];
+
+    if ( joyBus_.read(kI2CjoystickUnitAddr, data, kI2CjoystickUnitNumBytes) == I2CBusHealth::OK ) {
+        sample.rawX = data[0];
+        sample.rawY = data[1];
+        sample.pressed = data[2];
+        sample.valid = 1;
     }
     else
     {
-        log_e("Error reading joystick data via I2C.");
+        sample.valid = 0;
+    }
+
+    sample.sampleMicros = (uint32_t) esp_timer_get_time();
+    sample.readMicros = sample.sampleMicros - startMicros;
+
+    if (sample.valid)
+    {
+        recordJoystick(data, sample.sampleMicros);
+    }
+}
+
+void M5StickC_GamepadIO::onJoystickRead(void *pContext, const I2CScheduler::tCompletion &completion)
+{
+    M5StickC_GamepadIO *pGamepadIO = (M5StickC_GamepadIO*) pContext;
+    tJoyRing &ring = pGamepadIO->samplerRing_;
+
+    // The job may have been triggered before a change to mode SYNCHRONOUS, in which only process() accesses the joystick
+    if (pGamepadIO->getAcquisitionMode() == tAcquisitionMode::SYNCHRONOUS)
+    {
+        return;
+    }
+
+    ring.readMicros = completion.endMicros - completion.startMicros;
+
+    if (completion.result == I2CBusHealth::OK)
+    {
+        ring.newestIdx = (ring.newestIdx + 1) % kJoyRingSize;
+        ring.rawX[ring.newestIdx] = completion.pData[0];
+        ring.rawY[ring.newestIdx] = completion.pData[1];
+        ring.pressed = completion.pData[2];
+        ring.sampleMicros = completion.endMicros;
+        ++ring.sampleCount;
+
+        pGamepadIO->recordJoystick(completion.pData, completion.endMicros);
+
+        if (ring.numSamples < kJoyRingSize)
+        {
+            ++ring.numSamples;
+        }
+    }
+
+    pGamepadIO->joyRing_.write(ring);
+}
+
+bool M5StickC_GamepadIO::acquireJoystick(tJoySample &sample)
+{
+    tAcquisitionMode mode = getAcquisitionMode();
+
+    if (mode == tAcquisitionMode::SYNCHRONOUS)
+    {
+        // Wait for a batch of background jobs in progress, if any
+        groveBus_.lock();
+        readJoystick(sample);
+        groveBus_.unlock();
+
+        return true;
+    }
+
+    // Consume the samples completed in the background (if any)
+    tJoyRing ring;
+    joyRing_.read(ring);
+
+    if (mode == tAcquisitionMode::ASYNCHRONOUS)
+    {
+        // Issue the next transaction
+        groveBus_.trigger(joyJobId_);
+    }
+
+    if (ring.sampleCount == joySampleCountSeen_)
+    {
+        return false;
+    }
+
+    joySampleCountSeen_ = ring.sampleCount;
+
+    sample.valid = 1;
+    sample.readMicros = ring.readMicros;
+    sample.sampleMicros = ring.sampleMicros;
+    sample.pressed = ring.pressed;
+
+    if ( (mode == tAcquisitionMode::SAMPLED) && (ring.numSamples >= joyFilterWindowSize_) )
+    {
+        sample.rawX = JoystickFilter::apply(joyFilterType_, ring.rawX, kJoyRingSize, ring.newestIdx, joyFilterWindowSize_);
+        sample.rawY = JoystickFilter::apply(joyFilterType_, ring.rawY, kJoyRingSize, ring.newestIdx, joyFilterWindowSize_);
+    }
+    else
+    {
+        sample.rawX = ring.rawX[ring.newestIdx];
+        sample.rawY = ring.rawY[ring.newestIdx];
+    }
+
+    return true;
+}
+
+void M5StickC_GamepadIO::process()
+{
+    // Obtain joystick raw data via I2C
+    tJoySample sample;
+
+    bool newSample = acquireJoystick(sample);
+
+    bool calibrationChanged = false;
+
+    if (newSample)
+    {
+        joyReadMicros_ = sample.readMicros;
+
+        if (sample.valid)
+        {
+            joyRawX_ = sample.rawX;
+            joyRawY_ = sample.rawY;
+            joyPressed_ = sample.pressed;
+
+            joySampleMicros_ = sample.sampleMicros;
+
+            // Learn the extremes of the raw values (evaluate both, no short-circuit)
+            calibrationChanged = joyMapper_[0].learn(joyRawX_);
+            calibrationChanged = joyMapper_[1].learn(joyRawY_) || calibrationChanged;
+
+            // Smooth the jitter at rest, but follow motion quickly (timed by the sample, not by the call of process())
+            uint8_t raw[CenterCalibrator::kNumAxes] = {joyRawX_, joyRawY_};
+            bool smoothing = getJoySmoothing();
+
+            for (uint8_t axis = 0; axis < CenterCalibrator::kNumAxes; ++axis)
+            {
+                if (smoothing)
+                {
+                    joySmoothedQ8_[axis] = joySmoothingFilter_[axis].filter(raw[axis] << 8, joySampleMicros_);
+                }
+                else
+                {
+                    joySmoothingFilter_[axis].reset();
+                    joySmoothedQ8_[axis] = raw[axis] << 8;
+                }
+            }
+        }
 
         // Note: If reading is unsuccessful, the variables keep their previous values
     }
+
+    // Errors are counted by joyBus_, so only report the transitions of the stale state
+    uint32_t joyStaleMicros = getJoyStaleMicros();
+    bool joyStale = ((uint32_t) esp_timer_get_time() - joySampleMicros_) > joyStaleMicros;
+
+    if (joyStale != joyStale_)
+    {
+        if (joyStale)
+        {
+            log_e("Joystick data is stale, no successful I2C read for %u ms.", joyStaleMicros / 1000);
+        }
+        else
+        {
+            log_i("Joystick data is up to date.");
+        }
+
+        joyStale_ = joyStale;
+    }
     
     // Compute normalized stick positions
-    joyNormX_ = joyFactorX_ * (joyRawX_ - joyRawCenterX_);
-    joyNormY_ = joyFactorY_ * (joyRawY_ - joyRawCenterY_);
+    joyNormX_ = joyMapper_[0].mapQ8(joySmoothedQ8_[0]);
+    joyNormY_ = joyMapper_[1].mapQ8(joySmoothedQ8_[1]);
+
+    // Obtain a consistent copy of the button state from the button task
+    tButtonState btnState = buttonState_.read();
+
+    // Detect user activity: joystick moved or deflected, or any button pressed
+    bool joyMoved = (abs(joyRawX_ - prevJoyRawX_) >= kActivityMotionThreshold) || (abs(joyRawY_ - prevJoyRawY_) >= kActivityMotionThreshold);
+    bool joyDeflected = (abs(joyNormX_) >= kActivityDeflectionThreshold) || (abs(joyNormY_) >= kActivityDeflectionThreshold);
+    bool btnActive = joyPressed_ || btnState.btnPressed;
+
+    for (uint8_t btnIdx = 0; btnIdx < kBtnCount; ++btnIdx)
+    {
+        btnActive = btnActive || (btnState.btnPressCount[btnIdx] != prevBtnPressCount_[btnIdx]);
+        prevBtnPressCount_[btnIdx] = btnState.btnPressCount[btnIdx];
+    }
+
+    active_ = joyMoved || joyDeflected || btnActive;
+
+    // Refine the joystick center while the stick is at rest (the new center applies from the next call onwards)
+    if ( newSample && sample.valid )
+    {
+        uint8_t raw[CenterCalibrator::kNumAxes] = {joyRawX_, joyRawY_};
+
+        if ( centerCalibrator_.update(raw, btnActive, (uint64_t) esp_timer_get_time()) )
+        {
+            for (uint8_t axis = 0; axis < CenterCalibrator::kNumAxes; ++axis)
+            {
+                joyMapper_[axis].setCenter(centerCalibrator_.getCenter(axis));
+            }
+
+            calibrationChanged = true;
+        }
+    }
+
+    // Restore the defaults on request of resetCalibration()
+    if (calibrationResetPending_.load(std::memory_order_acquire))
+    {
+        for (uint8_t axis = 0; axis < CenterCalibrator::kNumAxes; ++axis)
+        {
+            centerCalibrator_.setCenterQ8(axis, kJoyNominalCenter << 8);
+            joyMapper_[axis].setCenter(kJoyNominalCenter);
+            joyMapper_[axis].resetRange(kJoyDefaultHalfRange);
+        }
+
+        publishCalibration();
+        calibrationResetPending_.store(false, std::memory_order_release);
+    }
+    else if (calibrationChanged)
+    {
+        publishCalibration();
+    }
+
+    prevJoyRawX_ = joyRawX_;
+    prevJoyRawY_ = joyRawY_;
+
+    // Publish the snapshot of all inputs
+    tInputState inputState;
+
+    inputState.btnPressed = btnState.btnPressed;
+
+    for (uint8_t btnIdx = 0; btnIdx < kBtnCount; ++btnIdx)
+    {
+        inputState.btnPressCount[btnIdx] = btnState.btnPressCount[btnIdx];
+    }
+
+    inputState.btnEdgeMicros = btnState.btnEdgeMicros;
+    inputState.joySampleMicros = joySampleMicros_;
+
+    inputState.joyRawX = joyRawX_;
+    inputState.joyRawY = joyRawY_;
+    inputState.joyPressed = joyPressed_;
+    inputState.joyStale = joyStale_;
+    inputState.joyNormX = joyNormX_;
+    inputState.joyNormY = joyNormY_;
+
+    inputState_.write(inputState);
 
     // Read current button states via GPIO
     //int btnBluePinValInv = !digitalRead(kPinButtonBlue);
@@ -97,8 +517,181 @@ void M5StickC_GamepadIO::process()
     //btnRedFlag_ = 0;
 }
 
+void IRAM_ATTR M5StickC_GamepadIO::isrButton(void *p)
+{
+    tBtnIsrArg *pArg = (tBtnIsrArg*) p;
+    M5StickC_GamepadIO *pGamepadIO = pArg->pGamepadIO;
+
+    uint32_t nowMicros = (uint32_t) esp_timer_get_time();
+    bool pressed = !digitalRead(pArg->pin);
+
+    portENTER_CRITICAL_ISR(&pGamepadIO->btnMux_);
+    bool changed = pGamepadIO->btnDebouncer_[pArg->btnIdx].onEdge(pressed, nowMicros);
+    portEXIT_CRITICAL_ISR(&pGamepadIO->btnMux_);
+
+    if (changed)
+    {
+        BaseType_t higherPriorityTaskWoken = pdFALSE;
+
+        vTaskNotifyGiveFromISR(pGamepadIO->buttonTaskHandle_, &higherPriorityTaskWoken);
+
+        if (higherPriorityTaskWoken)
+        {
+            portYIELD_FROM_ISR();
+        }
+    }
+}
+
+void M5StickC_GamepadIO::updateButtonStatesFromDebouncers()
+{
+    bool changed = false;
+    tBtnMask levels = 0;
+
+    for (uint8_t btnIdx = 0; btnIdx < kBtnCount; ++btnIdx)
+    {
+        bool level = !digitalRead(kBtnPin[btnIdx]);
+        levels |= (tBtnMask) level << btnIdx;
+        uint32_t nowMicros = (uint32_t) esp_timer_get_time();
+
+        portENTER_CRITICAL(&btnMux_);
+        EdgeDebouncer &debouncer = btnDebouncer_[btnIdx];
+
+        // Take over changes of the level that happened during the lockout window
+        debouncer.poll(level, nowMicros);
+
+        bool pressed = debouncer.isPressed();
+        uint8_t pressCount = debouncer.getPressCount();
+        uint32_t eventMicros = debouncer.getEventMicros();
+        portEXIT_CRITICAL(&btnMux_);
+
+        bool wasPressed = (btnTaskState_.btnPressed >> btnIdx) & 1;
+
+        if ( (pressed != wasPressed) || (pressCount != btnTaskState_.btnPressCount[btnIdx]) )
+        {
+            /* Queue all edges since the previous update. Usually, this is a single edge, since the button task
+               is woken up by each change. Edges in between share the timestamp of the last one. */
+            uint8_t newPresses = pressCount - btnTaskState_.btnPressCount[btnIdx];
+            uint16_t numEdges = 2 * newPresses + (wasPressed ? 1 : 0) - (pressed ? 1 : 0);
+            bool edgePressed = !wasPressed;
+
+            for (uint16_t edge = 0; edge < numEdges; ++edge)
+            {
+                pushButtonEvent(btnIdx, edgePressed, eventMicros);
+                edgePressed = !edgePressed;
+            }
+
+            btnTaskState_.btnPressed = (btnTaskState_.btnPressed & ~((tBtnMask) 1 << btnIdx)) | ((tBtnMask) pressed << btnIdx);
+            btnTaskState_.btnPressCount[btnIdx] = pressCount;
+
+            // Time of the edge as captured by the interrupt routine
+            if ( !changed || ((int32_t) (eventMicros - btnTaskState_.btnEdgeMicros) > 0) )
+            {
+                btnTaskState_.btnEdgeMicros = eventMicros;
+            }
+
+            changed = true;
+        }
+    }
+
+    // Publish the new state without blocking (the button task is the only writer)
+    if (changed)
+    {
+        buttonState_.write(btnTaskState_);
+    }
+
+    // Only the levels seen by the button task are recorded, i.e. bounces in between are not part of the recording
+    recordButtonLevels(levels);
+}
+
+void M5StickC_GamepadIO::setInputRecording(bool enabled)
+{
+    if (enabled && !isInputRecording())
+    {
+        portENTER_CRITICAL(&recMux_);
+        inputRecorder_.clear();
+        portEXIT_CRITICAL(&recMux_);
+    }
+
+    inputRecording_.store(enabled, std::memory_order_relaxed);
+}
+
+void M5StickC_GamepadIO::dumpInputRecording(Print &out)
+{
+    static const char kHexDigits[] = "0123456789abcdef";
+
+    bool recording = inputRecording_.exchange(false, std::memory_order_relaxed);
+
+    // Block currently being copied and its line of text ("B " + 2 hex digits per byte)
+    uint8_t block[InputTrace::kBlockSize];
+    char line[2 + 2 * InputTrace::kBlockSize + 1];
+
+    portENTER_CRITICAL(&recMux_);
+    uint16_t numBlocks = inputRecorder_.getNumBlocks();
+    uint32_t recordCount = inputRecorder_.getRecordCount();
+    uint32_t overwrittenBlockCount = inputRecorder_.getOverwrittenBlockCount();
+    portEXIT_CRITICAL(&recMux_);
+
+    out.printf("# input trace v%u blockSize %u blocks %u records %u overwritten %u\n",
+        InputTrace::kFormatVersion, InputTrace::kBlockSize, numBlocks, recordCount, overwrittenBlockCount);
+
+    for (uint16_t blockIdx = 0; blockIdx < numBlocks; ++blockIdx)
+    {
+        // A record of a task that has seen recording still enabled may be in progress
+        portENTER_CRITICAL(&recMux_);
+        memcpy(block, inputRecorder_.getBlock(blockIdx), InputTrace::kBlockSize);
+        portEXIT_CRITICAL(&recMux_);
+
+        line[0] = 'B';
+        line[1] = ' ';
+
+        for (uint16_t byteIdx = 0; byteIdx < InputTrace::kBlockSize; ++byteIdx)
+        {
+            line[2 + 2 * byteIdx] = kHexDigits[block[byteIdx] >> 4];
+            line[3 + 2 * byteIdx] = kHexDigits[block[byteIdx] & 0x0F];
+        }
+
+        line[sizeof(line) - 1] = '\0';
+
+        out.println(line);
+    }
+
+    out.println("# end");
+
+    // Continue the recording, if it was enabled
+    if (recording)
+    {
+        inputRecording_.store(true, std::memory_order_relaxed);
+    }
+}
+
+M5StickC_GamepadIO::tBtnMask M5StickC_GamepadIO::getReportButtons(bool applyEdge)
+{
+    tButtonEvent event;
+
+    while (btnEventQueue_.pop(event))
+    {
+        btnReportBuilder_.addEdge(event.btnIdx);
+    }
+
+    // Lost edges: continue with the current button states
+    uint32_t overflowCount = getBtnEventOverflowCount();
+
+    if (overflowCount != btnEventOverflowSeen_)
+    {
+        btnEventOverflowSeen_ = overflowCount;
+        btnReportBuilder_.resync(buttonState_.read().btnPressed);
+    }
+
+    return applyEdge ? btnReportBuilder_.build() : btnReportBuilder_.getReported();
+}
+
 M5StickC_GamepadIO::~M5StickC_GamepadIO()
 {
-    /*detachInterrupt(kPinButtonBlue);
-    detachInterrupt(kPinButtonRed );*/
+    if (btnCaptureMode_ == tButtonCaptureMode::INTERRUPT)
+    {
+        for (uint8_t btnIdx = 0; btnIdx < kBtnCount; ++btnIdx)
+        {
+            detachInterrupt(digitalPinToInterrupt(kBtnPin[btnIdx]));
+        }
+    }
 }
@@ -0,0 +1,238 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MPU6886_MotionAim.h"
+
+// Registers of the MPU6886
+static const uint8_t kRegSmplrtDiv   = 0x19;
+static const uint8_t kRegConfig      = 0x1A;
+static const uint8_t kRegGyroConfig  = 0x1B;
+static const uint8_t kRegAccelConfig = 0x1C;
+static const uint8_t kRegFifoEn      = 0x23;
+static const uint8_t kRegUserCtrl    = 0x6A;
+static const uint8_t kRegPwrMgmt1    = 0x6B;
+static const uint8_t kRegFifoCountH  = 0x72;
+static const uint8_t kRegFifoRw      = 0x74;
+static const uint8_t kRegWhoAmI      = 0x75;
+
+static const uint8_t kWhoAmI = 0x19;
+
+// Capacity of the FIFO [bytes]
+static const uint16_t kFifoSize = 1024;
+
+// Register values
+static const uint8_t kPwrMgmt1Reset     = 0x80;
+static const uint8_t kPwrMgmt1AutoClock = 0x01;
+static const uint8_t kConfigFifoNoOverwrite = 0x40;   // Keeps the frames aligned when the FIFO is full
+static const uint8_t kConfigDlpf176Hz   = 0x01;
+static const uint8_t kGyroConfig1000Dps = 0x10;
+static const uint8_t kAccelConfig8G     = 0x10;
+static const uint8_t kFifoEnGyroAccel   = 0x18;
+static const uint8_t kUserCtrlFifoEn    = 0x40;
+static const uint8_t kUserCtrlFifoRst   = 0x04;
+
+// Internal sample rate with the digital low-pass filter enabled [Hz]
+static const uint16_t kInternalRateHz = 1000;
+
+// Offset of the gyroscope data within a frame
+static const uint8_t kFrameGyroOffset = 8;
+
+MPU6886_MotionAim::MPU6886_MotionAim(I2CScheduler &bus, const GyroAim &aim)
+: bus_(bus)
+, gyroAim_(aim)
+{
+}
+
+bool MPU6886_MotionAim::start(uint32_t periodMicros, uint8_t priority)
+{
+    if (jobId_ != I2CScheduler::kInvalidJobId)
+    {
+        return true;
+    }
+
+    bus_.lock();
+    bool configured = configure(bus_.getBus());
+    bus_.unlock();
+
+    if (!configured)
+    {
+        log_w("MPU6886 not found, gyro aim is not available.");
+
+        return false;
+    }
+
+    I2CScheduler::tJobConfig job = {
+        kI2Caddr, kRegFifoCountH, 2, priority, periodMicros,
+        MPU6886_MotionAim::onFifoCount, this
+    };
+
+    periodMicros_ = periodMicros;
+    jobId_ = bus_.addJob(job);
+
+    return jobId_ != I2CScheduler::kInvalidJobId;
+}
+
+void MPU6886_MotionAim::setEnabled(bool enabled)
+{
+    if (jobId_ != I2CScheduler::kInvalidJobId)
+    {
+        bus_.setJobPeriod(jobId_, enabled ? periodMicros_ : 0);
+    }
+}
+
+bool MPU6886_MotionAim::configure(I2CBusHealth &bus)
+{
+    uint8_t whoAmI = 0;
+
+    if ( (bus.read(kI2Caddr, kRegWhoAmI, &whoAmI, 1) != I2CBusHealth::OK) || (whoAmI != kWhoAmI) )
+    {
+        return false;
+    }
+
+    bus.writeRegister(kI2Caddr, kRegPwrMgmt1, kPwrMgmt1Reset);
+    delay(10);
+
+    const uint8_t kConfiguration[][2] = {
+        { kRegPwrMgmt1,    kPwrMgmt1AutoClock },
+        { kRegSmplrtDiv,   kInternalRateHz / kSampleRateHz - 1 },
+        { kRegConfig,      kConfigFifoNoOverwrite | kConfigDlpf176Hz },
+        { kRegGyroConfig,  kGyroConfig1000Dps },
+        { kRegAccelConfig, kAccelConfig8G },
+        { kRegFifoEn,      kFifoEnGyroAccel },
+        { kRegUserCtrl,    kUserCtrlFifoRst },
+        { kRegUserCtrl,    kUserCtrlFifoEn }
+    };
+
+    for (uint8_t regIdx = 0; regIdx < sizeof(kConfiguration) / sizeof(kConfiguration[0]); ++regIdx)
+    {
+        if ( bus.writeRegister(kI2Caddr, kConfiguration[regIdx][0], kConfiguration[regIdx][1]) != I2CBusHealth::OK )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void MPU6886_MotionAim::onFifoCount(void *pContext, const I2CScheduler::tCompletion &completion)
+{
+    MPU6886_MotionAim *pMotionAim = (MPU6886_MotionAim*) pContext;
+
+    if (completion.result != I2CBusHealth::OK)
+    {
+        pMotionAim->readErrorCount_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    I2CBusHealth &bus = *completion.pBus;
+    uint32_t busMicros = completion.endMicros - completion.startMicros;
+
+    uint16_t fifoCount = (completion.pData[0] << 8) | completion.pData[1];
+
+    // The FIFO is not written while it is full, start over with an empty FIFO
+    if (fifoCount > kFifoSize - kFrameBytes)
+    {
+        uint32_t startMicros = (uint32_t) esp_timer_get_time();
+
+        bus.writeRegister(kI2Caddr, kRegUserCtrl, kUserCtrlFifoEn | kUserCtrlFifoRst);
+        pMotionAim->overflowCount_.fetch_add(1, std::memory_order_relaxed);
+
+        busMicros += (uint32_t) esp_timer_get_time() - startMicros;
+        fifoCount = 0;
+    }
+
+    uint8_t numFrames = (fifoCount / kFrameBytes > kMaxFramesPerRead) ? kMaxFramesPerRead : (fifoCount / kFrameBytes);
+
+    if (numFrames == 0)
+    {
+        return;
+    }
+
+    // Drain the complete frames in one burst
+    uint8_t data[kMaxFramesPerRead * kFrameBytes];
+
+    uint32_t readStartMicros = (uint32_t) esp_timer_get_time();
+    I2CBusHealth::tResult result = bus.read(kI2Caddr, kRegFifoRw, data, numFrames * kFrameBytes);
+    uint32_t cpuStartMicros = (uint32_t) esp_timer_get_time();
+
+    busMicros += cpuStartMicros - readStartMicros;
+
+    if (result != I2CBusHealth::OK)
+    {
+        // Part of the frames may have been consumed, so the FIFO is no longer aligned to the frames
+        bus.writeRegister(kI2Caddr, kRegUserCtrl, kUserCtrlFifoEn | kUserCtrlFifoRst);
+        pMotionAim->readErrorCount_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    GyroAim &gyroAim = pMotionAim->gyroAim_;
+
+    uint16_t sensitivityDps = pMotionAim->sensitivityDps_.load(std::memory_order_relaxed);
+
+    if (sensitivityDps != pMotionAim->appliedSensitivityDps_)
+    {
+        gyroAim.setSensitivity(sensitivityDps);
+        pMotionAim->appliedSensitivityDps_ = sensitivityDps;
+    }
+
+    gyroAim.setMode(pMotionAim->mode_.load(std::memory_order_relaxed));
+
+    for (uint8_t frameIdx = 0; frameIdx < numFrames; ++frameIdx)
+    {
+        const uint8_t *pGyro = &data[frameIdx * kFrameBytes + kFrameGyroOffset];
+        int16_t rate[GyroAim::kNumAxes];
+
+        for (uint8_t axis = 0; axis < GyroAim::kNumAxes; ++axis)
+        {
+            rate[axis] = (int16_t) ((pGyro[2 * axis] << 8) | pGyro[2 * axis + 1]);
+        }
+
+        gyroAim.addSample(rate);
+    }
+
+    tAim aim;
+
+    aim.stickX = gyroAim.getDeflection(0);
+    aim.stickY = gyroAim.getDeflection(1);
+    aim.sampleMicros = cpuStartMicros;
+
+    pMotionAim->aim_.write(aim);
+    pMotionAim->frameCount_.fetch_add(numFrames, std::memory_order_relaxed);
+
+    // Timing of the slot
+    tSlotTiming &timing = pMotionAim->timing_;
+
+    timing.busMicros = busMicros;
+    timing.cpuMicros = (uint32_t) esp_timer_get_time() - cpuStartMicros;
+
+    if (timing.busMicros > timing.busMaxMicros)
+    {
+        timing.busMaxMicros = timing.busMicros;
+    }
+
+    if (timing.cpuMicros > timing.cpuMaxMicros)
+    {
+        timing.cpuMaxMicros = timing.cpuMicros;
+    }
+
+    pMotionAim->slotTiming_.write(timing);
+}
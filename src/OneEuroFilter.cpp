@@ -0,0 +1,106 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "OneEuroFilter.h"
+
+// 2 * pi * 2^15 / (2^8 * 10^6) with 24 fractional bits, converts cutoff [Hz, Q8] * dt [us] to 2 * pi * fc * dt [Q15]
+static const uint64_t kTwoPiScaleQ24 = 13493;
+
+// Limit of the speed, far beyond the fastest stick motion [raw steps per ms, Q8]
+static const int32_t kMaxSpeedQ8 = 32767;
+
+OneEuroFilter::OneEuroFilter(uint16_t minCutoffQ8, uint16_t betaQ8, uint16_t derivCutoffQ8)
+: minCutoffQ8_{minCutoffQ8}
+, betaQ8_{betaQ8}
+, derivCutoffQ8_{derivCutoffQ8}
+{
+}
+
+uint32_t OneEuroFilter::computeAlphaQ15(uint32_t cutoffQ8, uint32_t dtMicros)
+{
+    // alpha = w / (1 + w) = 1 - 1 / (1 + w) with w = 2 * pi * fc * dt, which avoids shifting w before the division
+    uint64_t wQ15 = ((uint64_t) cutoffQ8 * dtMicros * kTwoPiScaleQ24) >> 24;
+
+    if (wQ15 > 0x7FFFFFFF)
+    {
+        wQ15 = 0x7FFFFFFF;
+    }
+
+    return 32768 - (uint32_t) ((1UL << 30) / (32768 + (uint32_t) wQ15));
+}
+
+uint16_t OneEuroFilter::filter(uint16_t xQ8, uint32_t timestampMicros)
+{
+    uint32_t dtMicros = timestampMicros - lastMicros_;
+
+    lastMicros_ = timestampMicros;
+
+    if (!initialized_)
+    {
+        initialized_ = true;
+        xHatQ8_ = xQ8;
+        dxHatQ8_ = 0;
+
+        return xQ8;
+    }
+
+    if (dtMicros == 0)
+    {
+        return (uint16_t) xHatQ8_;
+    }
+
+    if (dtMicros > kMaxDtMicros)
+    {
+        dtMicros = kMaxDtMicros;
+    }
+
+    // Speed relative to the previous filtered value, then smoothed with a fixed cutoff
+    int32_t dxQ8 = ((int32_t) xQ8 - xHatQ8_) * 1000 / (int32_t) dtMicros;
+
+    if (dxQ8 > kMaxSpeedQ8)
+    {
+        dxQ8 = kMaxSpeedQ8;
+    }
+    else if (dxQ8 < -kMaxSpeedQ8)
+    {
+        dxQ8 = -kMaxSpeedQ8;
+    }
+
+    int32_t alphaDerivQ15 = (int32_t) computeAlphaQ15(derivCutoffQ8_, dtMicros);
+
+    dxHatQ8_ += ((dxQ8 - dxHatQ8_) * alphaDerivQ15) >> 15;
+
+    // Cutoff adapted to the speed
+    uint32_t speedQ8 = (dxHatQ8_ >= 0) ? dxHatQ8_ : -dxHatQ8_;
+    uint32_t cutoffQ8 = minCutoffQ8_ + ((betaQ8_ * speedQ8) >> 8);
+
+    if (cutoffQ8 > kMaxCutoffQ8)
+    {
+        cutoffQ8 = kMaxCutoffQ8;
+    }
+
+    int32_t alphaQ15 = (int32_t) computeAlphaQ15(cutoffQ8, dtMicros);
+
+    xHatQ8_ += (((int32_t) xQ8 - xHatQ8_) * alphaQ15) >> 15;
+
+    return (uint16_t) xHatQ8_;
+}
@@ -0,0 +1,78 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "RateTierController.h"
+
+RateTierController::RateTierController(const uint32_t tierPeriodMicros[kNumTiers], uint32_t restAfterMicros, uint32_t idleAfterMicros)
+: restAfterMicros_{restAfterMicros}
+, idleAfterMicros_{idleAfterMicros}
+{
+    for (uint8_t tierIdx = 0; tierIdx < kNumTiers; ++tierIdx)
+    {
+        tierPeriodMicros_[tierIdx] = tierPeriodMicros[tierIdx];
+    }
+}
+
+RateTierController::tRateTier RateTierController::update(bool activity, uint64_t nowMicros)
+{
+    // Account the time since the previous update to the tier that has been active during that time
+    if (lastUpdateMicros_ != 0)
+    {
+        timeInTierMicros_[tier_] += nowMicros - lastUpdateMicros_;
+    }
+    else
+    {
+        // First update: no activity has been seen yet, start counting the idle time now
+        lastActivityMicros_ = nowMicros;
+    }
+
+    lastUpdateMicros_ = nowMicros;
+
+    tRateTier newTier = tier_;
+
+    if (activity)
+    {
+        lastActivityMicros_ = nowMicros;
+        newTier = tRateTier::ACTIVE;
+    }
+    else
+    {
+        uint64_t inactiveMicros = nowMicros - lastActivityMicros_;
+
+        if (inactiveMicros >= idleAfterMicros_)
+        {
+            newTier = tRateTier::IDLE;
+        }
+        else if ( (inactiveMicros >= restAfterMicros_) && (tier_ == tRateTier::ACTIVE) )
+        {
+            newTier = tRateTier::REST;
+        }
+    }
+
+    if (newTier != tier_)
+    {
+        tier_ = newTier;
+        ++tierChangeCount_;
+    }
+
+    return tier_;
+}
@@ -0,0 +1,135 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SlotScheduler.h"
+
+SlotScheduler::SlotScheduler(uint32_t slotMicros, uint16_t numSlots, tClockFunc clock, tSleepUntilFunc sleepUntil)
+: clock_{clock}
+, sleepUntil_{sleepUntil}
+, slotMicros_{slotMicros}
+, numSlots_{numSlots}
+, tickPeriodMicros_{slotMicros}
+{
+}
+
+void SlotScheduler::start()
+{
+    startMicros_ = clock_();
+    deadlineMicros_ = startMicros_;
+    tickStartMicros_ = startMicros_;
+
+    slotNr_ = 0;
+    slotsBegun_ = 1;
+    prevSlotsBegun_ = 0;
+}
+
+uint16_t SlotScheduler::waitForNextTick()
+{
+    uint64_t nowMicros = clock_();
+
+    /* ----- Statistics of the tick that has just ended ----- */
+
+    busyMicros_ = nowMicros - tickStartMicros_;
+
+    if (busyMicros_ > busyMaxInCycleMicros_)
+    {
+        busyMaxInCycleMicros_ = busyMicros_;
+
+        if (busyMicros_ > busyMaxMicros_)
+        {
+            busyMaxMicros_ = busyMicros_;
+        }
+    }
+
+    /* ----- Determine the deadline of the next tick ----- */
+
+    uint64_t nextDeadlineMicros = deadlineMicros_ + tickPeriodMicros_;
+    uint64_t tickAdvance = 1;
+
+    overrun_ = nowMicros > nextDeadlineMicros;
+
+    if (overrun_)
+    {
+        ++overrunCount_;
+
+        /* The next tick starts immediately. Grid points that have been missed completely are skipped,
+           so that the ticks keep their phase and do not bunch up while catching up. */
+        uint64_t missedTicks = (nowMicros - nextDeadlineMicros) / tickPeriodMicros_;
+
+        nextDeadlineMicros += missedTicks * tickPeriodMicros_;
+        tickAdvance += missedTicks;
+        skippedTickCount_ += missedTicks;
+    }
+    else
+    {
+        sleepUntil_(nextDeadlineMicros);
+    }
+
+    /* ----- Start the next tick ----- */
+
+    uint64_t wakeMicros = clock_();
+
+    latenessMicros_ = (wakeMicros > nextDeadlineMicros) ? wakeMicros - nextDeadlineMicros : 0;
+
+    // Deviation of the actual period from the nominal period (including skipped ticks)
+    uint64_t actualPeriodMicros = wakeMicros - tickStartMicros_;
+    uint64_t nominalPeriodMicros = tickAdvance * tickPeriodMicros_;
+
+    uint32_t jitterMicros = (actualPeriodMicros > nominalPeriodMicros)
+        ? actualPeriodMicros - nominalPeriodMicros
+        : nominalPeriodMicros - actualPeriodMicros;
+
+    deadlineMicros_ = nextDeadlineMicros;
+    tickStartMicros_ = wakeMicros;
+
+    // The slot is determined by the deadline, so it does not depend on the lateness of the tick
+    prevSlotsBegun_ = slotsBegun_;
+    slotsBegun_ = (deadlineMicros_ - startMicros_) / slotMicros_ + 1;
+
+    uint16_t nextSlotNr = (slotsBegun_ - 1) % numSlots_;
+
+    // In the first tick of a cycle, reset the statistics per cycle
+    if ( (nextSlotNr < slotNr_) || (slotsBegun_ - prevSlotsBegun_ >= numSlots_) )
+    {
+        busyMaxInCycleMicros_ = 0;
+        jitterMaxInCycleMicros_ = 0;
+    }
+
+    slotNr_ = nextSlotNr;
+
+    if (jitterMicros > jitterMaxInCycleMicros_)
+    {
+        jitterMaxInCycleMicros_ = jitterMicros;
+
+        if (jitterMicros > jitterMaxMicros_)
+        {
+            jitterMaxMicros_ = jitterMicros;
+        }
+    }
+
+    return slotNr_;
+}
+
+bool SlotScheduler::isSlotDue(uint16_t interval, uint16_t offset) const
+{
+    return countDueSlots(slotsBegun_, interval, offset) > countDueSlots(prevSlotsBegun_, interval, offset);
+}
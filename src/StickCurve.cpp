@@ -0,0 +1,96 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "StickCurve.h"
+
+// Generated at compile time, see StickCurve::makeLut()
+constexpr StickCurve::tLut StickCurve::kLuts[kNumProfiles] = {
+    makeLut(LINEAR,          tMakeIndexSeq<kLutSize>::type{}),
+    makeLut(QUADRATIC,       tMakeIndexSeq<kLutSize>::type{}),
+    makeLut(EXPONENTIAL,     tMakeIndexSeq<kLutSize>::type{}),
+    makeLut(RADIAL_DEADZONE, tMakeIndexSeq<kLutSize>::type{}),
+    makeLut(ANTI_DEADZONE,   tMakeIndexSeq<kLutSize>::type{})
+};
+
+const StickCurve::tProfileDef StickCurve::kProfiles[kNumProfiles] = {
+    { &kLuts[LINEAR],          0 },
+    { &kLuts[QUADRATIC],       0 },
+    { &kLuts[EXPONENTIAL],     0 },
+    { &kLuts[RADIAL_DEADZONE], kRadialDeadzone },
+    { &kLuts[ANTI_DEADZONE],   0 }
+};
+
+int16_t StickCurve::computeValueFloat(tProfile profile, int16_t x)
+{
+    uint8_t deadzone = axialDeadzone(profile);
+    int16_t magnitude = (x < 0) ? -x : x;
+
+    float t = (magnitude <= deadzone) ? 0.0f :
+              ( (magnitude >= kSaturation) ? 1.0f : (float) (magnitude - deadzone) / (kSaturation - deadzone) );
+
+    float y;
+
+    switch (profile)
+    {
+        case QUADRATIC:
+            y = t * t;
+            break;
+
+        case EXPONENTIAL:
+            y = (expf(kExponent * t) - 1.0f) / (expf(kExponent) - 1.0f);
+            break;
+
+        case ANTI_DEADZONE:
+            y = (t > 0.0f) ? (kAntiDeadzonePercent + (100 - kAntiDeadzonePercent) * t) / 100.0f : 0.0f;
+            break;
+
+        default:
+            y = t;
+            break;
+    }
+
+    return (x < 0 ? -1 : 1) * (int16_t) (y * kOutputMax + 0.5f);
+}
+
+const char* StickCurve::getProfileName(tProfile profile)
+{
+    switch (profile)
+    {
+        case LINEAR:
+            return "linear";
+
+        case QUADRATIC:
+            return "quadratic";
+
+        case EXPONENTIAL:
+            return "exponential";
+
+        case RADIAL_DEADZONE:
+            return "radial deadzone";
+
+        case ANTI_DEADZONE:
+            return "anti-deadzone";
+
+        default:
+            return "?";
+    }
+}
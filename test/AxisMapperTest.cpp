@@ -0,0 +1,233 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+
+#include "AxisMapper.h"
+
+namespace {
+
+// Nominal center and default half range of the joystick unit, see M5StickC_GamepadIO
+const uint8_t kCenter = 122;
+const uint8_t kDefaultHalfRange = 100;
+
+// Copy, so that the assertions do not need a definition of the class constant
+const int32_t kOutputMax = AxisMapper::kOutputMax;
+
+/**
+ * Floating point reference of AxisMapper::mapQ8().
+ */
+int32_t referenceMapQ8(const AxisMapper &mapper, uint16_t rawQ8)
+{
+    double deflection = rawQ8 / 256.0 - mapper.getCenter();
+    double halfRange = (deflection >= 0.0) ? (mapper.getMax() - mapper.getCenter()) : (mapper.getCenter() - mapper.getMin());
+
+    // A center at the end of the raw range has no half range on that side, beyond the center is full scale
+    if (halfRange == 0.0)
+    {
+        return (deflection == 0.0) ? 0 : ( (deflection > 0.0) ? kOutputMax : -kOutputMax );
+    }
+
+    double out = std::round(deflection / halfRange * kOutputMax);
+
+    return (int32_t) std::fmax(-kOutputMax, std::fmin(kOutputMax, out));
+}
+
+/**
+ * Checks every raw value and every raw value with 8 fractional bits against the reference, including the
+ * clamping beyond the extremes, and checks that the mapping is monotonic.
+ */
+void expectMappingOfEveryRawValue(const AxisMapper &mapper, bool invert)
+{
+    int32_t sign = invert ? -1 : 1;
+
+    for (uint16_t raw = 0; raw <= 255; ++raw)
+    {
+        int32_t expected = (raw <= mapper.getMin()) ? -kOutputMax :
+                           ( (raw >= mapper.getMax()) ? kOutputMax : referenceMapQ8(mapper, raw << 8) );
+
+        if (raw == mapper.getCenter())
+        {
+            expected = 0;
+        }
+
+        ASSERT_EQ(mapper.map(raw), sign * expected) << "raw " << raw;
+    }
+
+    int32_t prevOut = sign * mapper.mapQ8(0);
+
+    for (uint32_t rawQ8 = 0; rawQ8 <= 0xFFFF; ++rawQ8)
+    {
+        int32_t out = sign * mapper.mapQ8(rawQ8);
+
+        ASSERT_EQ(out, referenceMapQ8(mapper, rawQ8)) << "rawQ8 " << rawQ8;
+        ASSERT_GE(out, prevOut) << "rawQ8 " << rawQ8;
+
+        prevOut = out;
+    }
+}
+
+void learnRepeatedly(AxisMapper &mapper, uint8_t raw, uint8_t count)
+{
+    for (uint8_t sampleIdx = 0; sampleIdx < count; ++sampleIdx)
+    {
+        mapper.learn(raw);
+    }
+}
+
+TEST(AxisMapperTest, MapsEveryRawValueOfTheDefaultRange)
+{
+    AxisMapper mapper(kCenter, kDefaultHalfRange, false);
+
+    EXPECT_EQ(mapper.getMin(), kCenter - kDefaultHalfRange);
+    EXPECT_EQ(mapper.getMax(), kCenter + kDefaultHalfRange);
+
+    expectMappingOfEveryRawValue(mapper, false);
+}
+
+TEST(AxisMapperTest, MapsEveryRawValueInverted)
+{
+    AxisMapper mapper(kCenter, kDefaultHalfRange, true);
+
+    expectMappingOfEveryRawValue(mapper, true);
+
+    EXPECT_EQ(mapper.map(0), kOutputMax);
+    EXPECT_EQ(mapper.map(255), -kOutputMax);
+}
+
+TEST(AxisMapperTest, MapsEveryRawValueOfAnAsymmetricRange)
+{
+    AxisMapper mapper(kCenter, kDefaultHalfRange, false);
+
+    mapper.setRange(5, 240);
+
+    expectMappingOfEveryRawValue(mapper, false);
+}
+
+TEST(AxisMapperTest, ClampsTheRangeToTheRawLimits)
+{
+    for (uint16_t center = 0; center <= 255; ++center)
+    {
+        AxisMapper mapper(center, kDefaultHalfRange, false);
+
+        ASSERT_LE(mapper.getMin(), center);
+        ASSERT_GE(mapper.getMax(), center);
+
+        // The minimum half range applies unless the center is at the end of the raw range
+        ASSERT_TRUE( (mapper.getMax() - center >= AxisMapper::kMinHalfRange) || (mapper.getMax() == 255) ) << center;
+        ASSERT_TRUE( (center - mapper.getMin() >= AxisMapper::kMinHalfRange) || (mapper.getMin() == 0) ) << center;
+
+        expectMappingOfEveryRawValue(mapper, false);
+    }
+}
+
+TEST(AxisMapperTest, KeepsTheMinimumHalfRange)
+{
+    AxisMapper mapper(kCenter, kDefaultHalfRange, false);
+
+    mapper.setRange(kCenter - 1, kCenter + 1);
+
+    EXPECT_EQ(mapper.getMin(), kCenter - AxisMapper::kMinHalfRange);
+    EXPECT_EQ(mapper.getMax(), kCenter + AxisMapper::kMinHalfRange);
+
+    mapper.setCenter(250);
+
+    EXPECT_EQ(mapper.getMax(), 255);
+    expectMappingOfEveryRawValue(mapper, false);
+}
+
+TEST(AxisMapperTest, WidensOnlyAfterConsecutiveSamplesBeyondTheExtreme)
+{
+    AxisMapper mapper(kCenter, kDefaultHalfRange, false);
+    uint8_t defaultMax = mapper.getMax();
+
+    // One sample short of the confirmation, then a sample inside the range restarts the count
+    learnRepeatedly(mapper, defaultMax + 10, AxisMapper::kLearnConfirmSamples - 1);
+    EXPECT_FALSE(mapper.learn(defaultMax));
+    EXPECT_EQ(mapper.getMax(), defaultMax);
+
+    learnRepeatedly(mapper, defaultMax + 10, AxisMapper::kLearnConfirmSamples - 1);
+    EXPECT_EQ(mapper.getMax(), defaultMax);
+
+    EXPECT_TRUE(mapper.learn(defaultMax + 10));
+    EXPECT_EQ(mapper.getMax(), defaultMax + 10);
+
+    // The edge itself maps to full scale, the step below it does not
+    EXPECT_EQ(mapper.map(defaultMax + 10), kOutputMax);
+    EXPECT_LT(mapper.map(defaultMax + 9), kOutputMax);
+
+    expectMappingOfEveryRawValue(mapper, false);
+}
+
+TEST(AxisMapperTest, WidensToTheLeastExtremeSampleOfTheRun)
+{
+    AxisMapper mapper(kCenter, kDefaultHalfRange, false);
+    uint8_t defaultMin = mapper.getMin();
+
+    // A single glitch to 0 within the run does not define the extreme
+    learnRepeatedly(mapper, defaultMin - 5, AxisMapper::kLearnConfirmSamples / 2);
+    mapper.learn(0);
+    learnRepeatedly(mapper, defaultMin - 5, AxisMapper::kLearnConfirmSamples / 2 - 1);
+
+    EXPECT_EQ(mapper.getMin(), defaultMin - 5);
+    EXPECT_EQ(mapper.map(defaultMin - 5), -kOutputMax);
+    EXPECT_GT(mapper.map(defaultMin - 4), -kOutputMax);
+
+    expectMappingOfEveryRawValue(mapper, false);
+}
+
+TEST(AxisMapperTest, IsolatedGlitchesDoNotWiden)
+{
+    AxisMapper mapper(kCenter, kDefaultHalfRange, false);
+
+    for (uint16_t sampleIdx = 0; sampleIdx < 1000; ++sampleIdx)
+    {
+        ASSERT_FALSE(mapper.learn( (sampleIdx % 2 == 0) ? 255 : kCenter ));
+        ASSERT_FALSE(mapper.learn( (sampleIdx % 2 == 0) ? 0 : kCenter ));
+    }
+
+    EXPECT_EQ(mapper.getMin(), kCenter - kDefaultHalfRange);
+    EXPECT_EQ(mapper.getMax(), kCenter + kDefaultHalfRange);
+}
+
+TEST(AxisMapperTest, ResetRangeRestoresTheDefault)
+{
+    AxisMapper mapper(kCenter, kDefaultHalfRange, false);
+
+    learnRepeatedly(mapper, 255, AxisMapper::kLearnConfirmSamples);
+    learnRepeatedly(mapper, 0, AxisMapper::kLearnConfirmSamples);
+
+    EXPECT_EQ(mapper.getMin(), 0);
+    EXPECT_EQ(mapper.getMax(), 255);
+
+    // A run that has started before the reset does not count
+    learnRepeatedly(mapper, kCenter + kDefaultHalfRange + 1, AxisMapper::kLearnConfirmSamples - 1);
+    mapper.resetRange(kDefaultHalfRange);
+    EXPECT_FALSE(mapper.learn(kCenter + kDefaultHalfRange + 1));
+
+    EXPECT_EQ(mapper.getMin(), kCenter - kDefaultHalfRange);
+    EXPECT_EQ(mapper.getMax(), kCenter + kDefaultHalfRange);
+}
+
+}
@@ -0,0 +1,119 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+
+#include "CenterCalibrator.h"
+
+namespace {
+
+// Parameters of the calibration, see M5StickC_GamepadIO
+const uint8_t kNominalCenter = 122;
+const uint8_t kMaxOffset = 8;
+const uint32_t kRestMicros = 3000000;
+const uint8_t kMaxVariance = 2;
+const uint8_t kUpdateShift = 2;
+const uint8_t kConfirmPeriods = 3;
+
+// Joystick sampled at 200 Hz
+const uint32_t kSamplePeriodMicros = 5000;
+
+class CenterCalibratorTest : public ::testing::Test
+{
+    protected:
+
+        CenterCalibrator calibrator_{kNominalCenter, kMaxOffset, kRestMicros, kMaxVariance, kUpdateShift, kConfirmPeriods};
+
+        uint64_t nowMicros_ = 1000000;
+
+        /**
+         * Holds the stick at the given position with +/-1 raw step of noise, without button activity.
+         *
+         * @return Number of center updates.
+         */
+        uint32_t rest(uint8_t rawX, uint8_t rawY, uint32_t durationMicros)
+        {
+            uint32_t numUpdates = 0;
+
+            for (uint32_t elapsedMicros = 0; elapsedMicros < durationMicros; elapsedMicros += kSamplePeriodMicros)
+            {
+                uint8_t noise = (elapsedMicros / kSamplePeriodMicros) % 3;
+                uint8_t raw[CenterCalibrator::kNumAxes] = { (uint8_t) (rawX + noise - 1), rawY };
+
+                numUpdates += calibrator_.update(raw, false, nowMicros_) ? 1 : 0;
+                nowMicros_ += kSamplePeriodMicros;
+            }
+
+            return numUpdates;
+        }
+
+        void pressButton()
+        {
+            uint8_t raw[CenterCalibrator::kNumAxes] = { kNominalCenter, kNominalCenter };
+
+            calibrator_.update(raw, true, nowMicros_);
+            nowMicros_ += kSamplePeriodMicros;
+        }
+};
+
+TEST_F(CenterCalibratorTest, LearnsADriftedCenterAfterConsistentRestPeriods)
+{
+    // Less than the confirming rest periods do not move the center
+    EXPECT_EQ(rest(126, 120, (kConfirmPeriods - 1) * kRestMicros + kRestMicros / 2), 0u);
+    EXPECT_EQ(calibrator_.getCenter(0), kNominalCenter);
+
+    // The estimate converges towards the drifted center
+    rest(126, 120, 20 * kConfirmPeriods * kRestMicros);
+
+    EXPECT_EQ(calibrator_.getCenter(0), 126);
+    EXPECT_EQ(calibrator_.getCenter(1), 120);
+}
+
+TEST_F(CenterCalibratorTest, IgnoresAHeldDeflectionBeyondTheMaximumOffset)
+{
+    EXPECT_EQ(rest(kNominalCenter + kMaxOffset + 4, kNominalCenter, 10 * kConfirmPeriods * kRestMicros), 0u);
+
+    EXPECT_EQ(calibrator_.getCenterQ8(0), kNominalCenter << 8);
+    EXPECT_EQ(calibrator_.getCenterQ8(1), kNominalCenter << 8);
+}
+
+TEST_F(CenterCalibratorTest, RequiresConsistentRestPeriods)
+{
+    // Rest periods at alternating positions, e.g. the stick held slightly deflected in between, never confirm each other
+    for (uint8_t period = 0; period < 4 * kConfirmPeriods; ++period)
+    {
+        EXPECT_EQ(rest( (period % 2) ? kNominalCenter : kNominalCenter + 4, kNominalCenter, kRestMicros + kSamplePeriodMicros), 0u);
+        pressButton();
+    }
+
+    EXPECT_EQ(calibrator_.getUpdateCount(), 0u);
+    EXPECT_EQ(calibrator_.getCenterQ8(0), kNominalCenter << 8);
+}
+
+TEST_F(CenterCalibratorTest, RejectsImplausibleStoredCenters)
+{
+    EXPECT_FALSE(calibrator_.setCenterQ8(0, (kNominalCenter + kMaxOffset + 1) << 8));
+    EXPECT_TRUE(calibrator_.setCenterQ8(0, (kNominalCenter - kMaxOffset) << 8));
+    EXPECT_EQ(calibrator_.getCenter(0), kNominalCenter - kMaxOffset);
+}
+
+}
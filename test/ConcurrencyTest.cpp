@@ -0,0 +1,222 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "SeqLock.h"
+#include "SpscQueue.h"
+
+namespace {
+
+/**
+ * Payload whose fields are derived from a single value, so that a torn read is detectable.
+ */
+typedef struct {
+    uint32_t value;
+    uint32_t inverted;
+    uint64_t squared;
+    uint8_t tag;
+} tPayload;
+
+tPayload makePayload(uint32_t value)
+{
+    tPayload payload;
+    payload.value = value;
+    payload.inverted = ~value;
+    payload.squared = (uint64_t) value * value;
+    payload.tag = (uint8_t) (value * 7);
+
+    return payload;
+}
+
+bool isConsistent(const tPayload &payload)
+{
+    return (payload.inverted == ~payload.value)
+        && (payload.squared == (uint64_t) payload.value * payload.value)
+        && (payload.tag == (uint8_t) (payload.value * 7));
+}
+
+TEST(SeqLockTest, ReadReturnsLastWrite)
+{
+    SeqLock<tPayload> lock;
+
+    EXPECT_EQ(lock.read().value, 0u);
+
+    lock.write(makePayload(42));
+
+    tPayload payload;
+    uint32_t seq = lock.read(payload);
+
+    EXPECT_EQ(payload.value, 42u);
+    EXPECT_TRUE(isConsistent(payload));
+    EXPECT_EQ(seq % 2, 0u);
+}
+
+TEST(SeqLockTest, ConcurrentReadersNeverSeeTornOrOutdatedValues)
+{
+    static const uint32_t kNumWrites = 1000000;
+    static const uint8_t kNumReaders = 3;
+
+    SeqLock<tPayload> lock;
+    lock.write(makePayload(0));
+
+    std::atomic<bool> done{false};
+    std::atomic<uint32_t> tornCount{0};
+    std::atomic<uint32_t> regressionCount{0};
+    std::vector<std::thread> readers;
+
+    for (uint8_t readerIdx = 0; readerIdx < kNumReaders; ++readerIdx)
+    {
+        readers.emplace_back([&]() {
+            uint32_t prevValue = 0;
+            uint32_t prevSeq = 0;
+
+            while (!done.load(std::memory_order_acquire))
+            {
+                tPayload payload;
+                uint32_t seq = lock.read(payload);
+
+                if (!isConsistent(payload))
+                {
+                    tornCount.fetch_add(1);
+                }
+
+                // Values and sequence numbers only increase
+                if ( (payload.value < prevValue) || (seq < prevSeq) )
+                {
+                    regressionCount.fetch_add(1);
+                }
+
+                prevValue = payload.value;
+                prevSeq = seq;
+            }
+        });
+    }
+
+    for (uint32_t value = 1; value <= kNumWrites; ++value)
+    {
+        lock.write(makePayload(value));
+    }
+
+    done.store(true, std::memory_order_release);
+
+    for (std::thread &reader : readers)
+    {
+        reader.join();
+    }
+
+    EXPECT_EQ(tornCount.load(), 0u);
+    EXPECT_EQ(regressionCount.load(), 0u);
+    EXPECT_EQ(lock.read().value, kNumWrites);
+}
+
+TEST(SpscQueueTest, FailsWhenFullAndWhenEmpty)
+{
+    SpscQueue<uint32_t, 4> queue{};
+    uint32_t element;
+
+    EXPECT_FALSE(queue.pop(element));
+
+    for (uint32_t value = 0; value < 4; ++value)
+    {
+        EXPECT_TRUE(queue.push(value));
+    }
+
+    EXPECT_FALSE(queue.push(4));
+
+    for (uint32_t value = 0; value < 4; ++value)
+    {
+        ASSERT_TRUE(queue.pop(element));
+        EXPECT_EQ(element, value);
+    }
+
+    EXPECT_FALSE(queue.pop(element));
+}
+
+TEST(SpscQueueTest, KeepsOrderAcrossIndexWrapAround)
+{
+    SpscQueue<uint32_t, 8> queue;
+
+    // The 16-bit positions wrap around after 65536 elements
+    for (uint32_t value = 0; value < 200000; ++value)
+    {
+        uint32_t element;
+
+        ASSERT_TRUE(queue.push(value));
+        ASSERT_TRUE(queue.pop(element));
+        ASSERT_EQ(element, value);
+    }
+}
+
+TEST(SpscQueueTest, ConcurrentProducerAndConsumerLoseNothing)
+{
+    static const uint32_t kNumElements = 2000000;
+
+    SpscQueue<tPayload, 32> queue;
+
+    std::atomic<uint32_t> fullCount{0};
+
+    std::thread producer([&]() {
+        for (uint32_t value = 0; value < kNumElements; ++value)
+        {
+            while (!queue.push(makePayload(value)))
+            {
+                fullCount.fetch_add(1, std::memory_order_relaxed);
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    uint32_t expected = 0;
+    uint32_t errorCount = 0;
+
+    while (expected < kNumElements)
+    {
+        tPayload payload;
+
+        if (!queue.pop(payload))
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        if ( (payload.value != expected) || !isConsistent(payload) )
+        {
+            ++errorCount;
+        }
+
+        ++expected;
+    }
+
+    producer.join();
+
+    EXPECT_EQ(errorCount, 0u);
+
+    tPayload payload;
+    EXPECT_FALSE(queue.pop(payload));
+}
+
+}
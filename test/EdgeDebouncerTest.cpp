@@ -0,0 +1,260 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "EdgeDebouncer.h"
+
+namespace {
+
+// Lockout window and polling period of the button task, see M5StickC_GamepadIO
+const uint32_t kLockoutMicros = 10000;
+const uint32_t kPollMicros = 5000;
+
+/**
+ * Level of the button from the given time on.
+ */
+typedef struct {
+    uint32_t micros;
+    bool level;
+} tEdge;
+
+/**
+ * Change of the debounced state.
+ */
+typedef struct {
+    uint32_t micros;
+    bool pressed;
+} tChange;
+
+/**
+ * Synthetic bounce traces. The noise comes from a linear congruential generator, so that every run uses the same traces.
+ */
+class BounceTrace
+{
+    public:
+
+        explicit BounceTrace(uint32_t startMicros, uint32_t seed = 12345)
+        : nowMicros_{startMicros}
+        , lcg_{seed}
+        {
+        }
+
+        /**
+         * Appends a contact change to the given level that bounces for up to bounceMicros, followed by the stable level for holdMicros.
+         */
+        void addChange(bool level, uint32_t bounceMicros, uint32_t holdMicros)
+        {
+            uint32_t bounceEndMicros = nowMicros_ + bounceMicros;
+            bool bounceLevel = level;
+
+            // Bounces of 20..500 us each
+            while ( (int32_t) (bounceEndMicros - nowMicros_) > 0 )
+            {
+                edges_.push_back({nowMicros_, bounceLevel});
+                nowMicros_ += 20 + random() % 480;
+                bounceLevel = !bounceLevel;
+            }
+
+            edges_.push_back({nowMicros_, level});
+            nowMicros_ += holdMicros;
+        }
+
+        const std::vector<tEdge>& getEdges() const
+        {
+            return edges_;
+        }
+
+        uint32_t getEndMicros() const
+        {
+            return nowMicros_;
+        }
+
+        uint32_t random()
+        {
+            lcg_ = lcg_ * 1103515245 + 12345;
+
+            return lcg_ >> 16;
+        }
+
+    private:
+
+        std::vector<tEdge> edges_;
+
+        uint32_t nowMicros_;
+
+        uint32_t lcg_;
+};
+
+/**
+ * Feeds the edges of a trace to the debouncer as the interrupt routine does, and polls it as the button task does.
+ *
+ * @return Changes of the debounced state.
+ */
+std::vector<tChange> runTrace(EdgeDebouncer &debouncer, uint32_t startMicros, const std::vector<tEdge> &edges, uint32_t endMicros)
+{
+    std::vector<tChange> changes;
+
+    bool level = false;
+    uint32_t nextPollMicros = startMicros + kPollMicros;
+    size_t edgeIdx = 0;
+
+    while ( (int32_t) (endMicros - nextPollMicros) >= 0 )
+    {
+        // Edges up to the next poll (times relative to the start, so that wrap-around traces work)
+        while ( (edgeIdx < edges.size()) && (edges[edgeIdx].micros - startMicros <= nextPollMicros - startMicros) )
+        {
+            level = edges[edgeIdx].level;
+
+            if (debouncer.onEdge(level, edges[edgeIdx].micros))
+            {
+                changes.push_back({edges[edgeIdx].micros, debouncer.isPressed()});
+            }
+
+            ++edgeIdx;
+        }
+
+        if (debouncer.poll(level, nextPollMicros))
+        {
+            changes.push_back({nextPollMicros, debouncer.isPressed()});
+        }
+
+        nextPollMicros += kPollMicros;
+    }
+
+    return changes;
+}
+
+TEST(EdgeDebouncerTest, AcceptsCleanEdgesImmediately)
+{
+    BounceTrace trace(0);
+    trace.addChange(true, 0, 50000);
+    trace.addChange(false, 0, 50000);
+
+    EdgeDebouncer debouncer(kLockoutMicros);
+    std::vector<tChange> changes = runTrace(debouncer, 0, trace.getEdges(), trace.getEndMicros());
+
+    ASSERT_EQ(changes.size(), 2u);
+    EXPECT_EQ(changes[0].micros, trace.getEdges()[0].micros);
+    EXPECT_TRUE(changes[0].pressed);
+    EXPECT_EQ(changes[1].micros, trace.getEdges()[1].micros);
+    EXPECT_FALSE(changes[1].pressed);
+    EXPECT_EQ(debouncer.getPressCount(), 1);
+    EXPECT_EQ(debouncer.getBounceCount(), 0u);
+}
+
+TEST(EdgeDebouncerTest, RejectsBouncesAndReportsThePressAtTheFirstEdge)
+{
+    BounceTrace trace(1000);
+    trace.addChange(true, 3000, 50000);
+    trace.addChange(false, 3000, 50000);
+
+    EdgeDebouncer debouncer(kLockoutMicros);
+    std::vector<tChange> changes = runTrace(debouncer, 0, trace.getEdges(), trace.getEndMicros());
+
+    ASSERT_EQ(changes.size(), 2u);
+    EXPECT_EQ(changes[0].micros, 1000u);
+    EXPECT_TRUE(changes[0].pressed);
+    EXPECT_FALSE(changes[1].pressed);
+    EXPECT_EQ(debouncer.getPressCount(), 1);
+    EXPECT_GT(debouncer.getBounceCount(), 0u);
+}
+
+TEST(EdgeDebouncerTest, PollPicksUpAReleaseDuringTheLockout)
+{
+    // A tap shorter than the lockout window: the release edge is rejected, the poll after the window resynchronizes
+    std::vector<tEdge> edges = { {1000, true}, {4000, false} };
+
+    EdgeDebouncer debouncer(kLockoutMicros);
+    std::vector<tChange> changes = runTrace(debouncer, 0, edges, 40000);
+
+    ASSERT_EQ(changes.size(), 2u);
+    EXPECT_EQ(changes[0].micros, 1000u);
+    EXPECT_TRUE(changes[0].pressed);
+    EXPECT_FALSE(changes[1].pressed);
+    EXPECT_GE(changes[1].micros, 1000 + kLockoutMicros);
+    EXPECT_LT(changes[1].micros, 1000 + kLockoutMicros + kPollMicros);
+    EXPECT_EQ(debouncer.getPressCount(), 1);
+}
+
+TEST(EdgeDebouncerTest, IgnoresSpikesThatReadTheUnchangedLevel)
+{
+    // The interrupt routine of a spike shorter than its latency reads the released level
+    std::vector<tEdge> edges = { {1000, false}, {1001, false}, {20000, false} };
+
+    EdgeDebouncer debouncer(kLockoutMicros);
+    std::vector<tChange> changes = runTrace(debouncer, 0, edges, 40000);
+
+    EXPECT_TRUE(changes.empty());
+    EXPECT_EQ(debouncer.getPressCount(), 0);
+}
+
+TEST(EdgeDebouncerTest, CountsEveryPressOfRandomBounceTraces)
+{
+    for (uint32_t seed = 1; seed <= 50; ++seed)
+    {
+        BounceTrace trace(0, seed);
+        uint8_t numPresses = 20;
+
+        for (uint8_t pressIdx = 0; pressIdx < numPresses; ++pressIdx)
+        {
+            // Bouncing of up to 8 ms, held for at least the lockout window plus one poll
+            trace.addChange(true, trace.random() % 8000, kLockoutMicros + kPollMicros + trace.random() % 100000);
+            trace.addChange(false, trace.random() % 8000, kLockoutMicros + kPollMicros + trace.random() % 100000);
+        }
+
+        EdgeDebouncer debouncer(kLockoutMicros);
+        std::vector<tChange> changes = runTrace(debouncer, 0, trace.getEdges(), trace.getEndMicros());
+
+        ASSERT_EQ(changes.size(), 2u * numPresses) << "seed " << seed;
+        EXPECT_EQ(debouncer.getPressCount(), numPresses) << "seed " << seed;
+
+        for (size_t changeIdx = 0; changeIdx < changes.size(); ++changeIdx)
+        {
+            ASSERT_EQ(changes[changeIdx].pressed, changeIdx % 2 == 0) << "seed " << seed << ", change " << changeIdx;
+        }
+
+        EXPECT_FALSE(debouncer.isPressed()) << "seed " << seed;
+    }
+}
+
+TEST(EdgeDebouncerTest, HandlesTimestampWrapAround)
+{
+    uint32_t startMicros = UINT32_MAX - 20000;
+
+    BounceTrace trace(startMicros + 15000);
+    trace.addChange(true, 3000, 50000);
+    trace.addChange(false, 3000, 50000);
+
+    EdgeDebouncer debouncer(kLockoutMicros);
+    std::vector<tChange> changes = runTrace(debouncer, startMicros, trace.getEdges(), trace.getEndMicros());
+
+    ASSERT_EQ(changes.size(), 2u);
+    EXPECT_EQ(changes[0].micros, startMicros + 15000);
+    EXPECT_TRUE(changes[0].pressed);
+    EXPECT_FALSE(changes[1].pressed);
+    EXPECT_EQ(debouncer.getPressCount(), 1);
+}
+
+}
@@ -0,0 +1,104 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+
+#include "GyroAim.h"
+
+namespace {
+
+// Scale and sample rate of the MPU6886, see MPU6886_MotionAim
+const uint16_t kLsbPer10Dps = 328;
+const uint16_t kSampleRateHz = 200;
+
+const int16_t kFullDeflection = 32767;
+
+class GyroAimTest : public ::testing::Test
+{
+    protected:
+
+        // Yaw drives the stick x-axis, pitch the y-axis
+        GyroAim aim_{kLsbPer10Dps, kSampleRateHz, 2, false, 1, false};
+
+        /**
+         * Turns the device about the yaw axis at the given rate for the given number of samples.
+         */
+        void turn(int16_t rateDps, uint16_t numSamples)
+        {
+            int16_t rate[GyroAim::kNumAxes] = { 0, 0, (int16_t) (rateDps * kLsbPer10Dps / 10) };
+
+            for (uint16_t sampleIdx = 0; sampleIdx < numSamples; ++sampleIdx)
+            {
+                aim_.addSample(rate);
+            }
+        }
+};
+
+TEST_F(GyroAimTest, RateModeFollowsTheAngularRate)
+{
+    aim_.setSensitivity(180);
+
+    turn(90, 50);
+    EXPECT_NEAR(aim_.getDeflection(0), kFullDeflection / 2, kFullDeflection / 50);
+
+    // Holding still stops the camera
+    turn(0, 50);
+    EXPECT_EQ(aim_.getDeflection(0), 0);
+    EXPECT_EQ(aim_.getDeflection(1), 0);
+}
+
+TEST_F(GyroAimTest, IntegratedModeFollowsTheAngle)
+{
+    aim_.setMode(GyroAim::INTEGRATED);
+    aim_.setAngleSensitivity(30);
+    aim_.setLeakShift(0);
+
+    // Turned by 15 degrees within 0.5 s, then held still: the deflection stays at half of the full deflection
+    turn(30, kSampleRateHz / 2);
+    turn(0, kSampleRateHz);
+    EXPECT_NEAR(aim_.getDeflection(0), kFullDeflection / 2, kFullDeflection / 20);
+
+    // Turned back
+    turn(-30, kSampleRateHz / 2);
+    turn(0, kSampleRateHz);
+    EXPECT_NEAR(aim_.getDeflection(0), 0, kFullDeflection / 20);
+}
+
+TEST_F(GyroAimTest, IntegratedModeSaturatesAndLeaksToTheCenter)
+{
+    aim_.setMode(GyroAim::INTEGRATED);
+    aim_.setAngleSensitivity(30);
+
+    // Turned by 60 degrees: saturated, so that turning back by 15 degrees takes effect right away
+    turn(60, kSampleRateHz);
+    EXPECT_EQ(aim_.getDeflection(0), kFullDeflection);
+
+    turn(-30, kSampleRateHz / 2);
+    EXPECT_LT(aim_.getDeflection(0), kFullDeflection * 3 / 4);
+    EXPECT_GT(aim_.getDeflection(0), 0);
+
+    // Held still, the deflection returns to the center
+    turn(0, 20 << GyroAim::kDefaultLeakShift);
+    EXPECT_EQ(aim_.getDeflection(0), 0);
+}
+
+}
@@ -0,0 +1,235 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "InputRecorder.h"
+#include "InputReplayer.h"
+
+namespace {
+
+const uint8_t kCenter = 122;
+
+// Joystick sampled at 200 Hz
+const uint32_t kSamplePeriodMicros = 5000;
+
+/**
+ * Records a synthetic session and writes it as the lines of a serial dump, like M5StickC_GamepadIO::dumpInputRecording().
+ */
+class InputReplayerTest : public ::testing::Test
+{
+    protected:
+
+        static const uint16_t kNumBlocks = 16;
+
+        InputRecorder<kNumBlocks> recorder_;
+
+        uint32_t nowMicros_ = 1000000;
+
+        InputTrace::tRecord state_ = {};
+
+        InputReplayer replayer_{kCenter, 100, 256, 7680, 256, 10000, 5000};
+
+        void SetUp() override
+        {
+            recorder_.clear();
+            state_.rawX = kCenter;
+            state_.rawY = kCenter;
+        }
+
+        void recordJoystick(uint8_t rawX, uint8_t rawY)
+        {
+            state_.type = InputTrace::JOYSTICK;
+            state_.micros = nowMicros_;
+            state_.rawX = rawX;
+            state_.rawY = rawY;
+            recorder_.record(state_);
+
+            nowMicros_ += kSamplePeriodMicros;
+        }
+
+        void recordButtons(uint8_t btnLevels, uint32_t afterMicros)
+        {
+            state_.type = InputTrace::BUTTONS;
+            state_.micros = nowMicros_ - kSamplePeriodMicros + afterMicros;
+            state_.btnLevels = btnLevels;
+            recorder_.record(state_);
+        }
+
+        std::vector<std::string> dump()
+        {
+            static const char kHexDigits[] = "0123456789abcdef";
+
+            std::vector<std::string> lines;
+            lines.push_back("# input trace");
+
+            for (uint16_t blockIdx = 0; blockIdx < recorder_.getNumBlocks(); ++blockIdx)
+            {
+                const uint8_t *pBlock = recorder_.getBlock(blockIdx);
+                std::string line = "B ";
+
+                for (uint16_t byteIdx = 0; byteIdx < InputTrace::kBlockSize; ++byteIdx)
+                {
+                    line += kHexDigits[pBlock[byteIdx] >> 4];
+                    line += kHexDigits[pBlock[byteIdx] & 0x0F];
+                }
+
+                lines.push_back(line);
+            }
+
+            lines.push_back("# end");
+
+            return lines;
+        }
+
+        void replay(const std::vector<std::string> &lines)
+        {
+            replay(lines, replayer_);
+        }
+
+        static void replay(const std::vector<std::string> &lines, InputReplayer &replayer)
+        {
+            for (const std::string &line : lines)
+            {
+                ASSERT_TRUE(replayer.replayDumpLine(line.c_str()));
+            }
+        }
+
+        /**
+         * Records the stick at rest at the center with +/-1 step of noise.
+         */
+        void recordRestAtCenter(uint16_t numSamples)
+        {
+            for (uint16_t sampleIdx = 0; sampleIdx < numSamples; ++sampleIdx)
+            {
+                recordJoystick(kCenter + (sampleIdx % 3) - 1, kCenter + ((sampleIdx + 1) % 3) - 1);
+            }
+        }
+};
+
+TEST_F(InputReplayerTest, ReplaysARecordedSession)
+{
+    // Rest with +/-1 step of noise, then a motion to full deflection and back, with two button presses
+    for (uint16_t sampleIdx = 0; sampleIdx < 200; ++sampleIdx)
+    {
+        recordJoystick(kCenter + (sampleIdx % 3) - 1, kCenter);
+    }
+
+    recordButtons(0x01, 1000);
+
+    for (uint16_t sampleIdx = 0; sampleIdx < 20; ++sampleIdx)
+    {
+        recordJoystick(kCenter + sampleIdx * 5, kCenter);
+    }
+
+    recordButtons(0x00, 2000);
+    recordButtons(0x02, 3000);
+
+    for (uint16_t sampleIdx = 0; sampleIdx < 20; ++sampleIdx)
+    {
+        recordJoystick(kCenter + (20 - sampleIdx) * 5, kCenter);
+    }
+
+    recordButtons(0x00, 1000);
+
+    for (uint16_t sampleIdx = 0; sampleIdx < 100; ++sampleIdx)
+    {
+        recordJoystick(kCenter, kCenter);
+    }
+
+    ASSERT_EQ(recorder_.getOverwrittenBlockCount(), 0u);
+
+    replay(dump());
+
+    InputReplayer::tMetrics metrics = replayer_.getMetrics();
+
+    EXPECT_EQ(metrics.numJoySamples, 340u);
+    EXPECT_EQ(metrics.numBtnChanges, 4u);
+    EXPECT_EQ(metrics.joyPeriodP50, kSamplePeriodMicros);
+    EXPECT_EQ(metrics.joyPeriodMax, kSamplePeriodMicros);
+    EXPECT_EQ(metrics.numPressesEdge, 2u);
+    EXPECT_EQ(metrics.numPressesPolled, 2u);
+
+    // The smoothing reduces the jitter at rest and follows the motion with some lag
+    EXPECT_LT(metrics.restJitterSmoothed, metrics.restJitterUnsmoothed);
+    EXPECT_GT(metrics.motionLag, 0u);
+
+    // The polled debouncer detects a press after several polls
+    EXPECT_GT(metrics.polledLatencyP50, 0u);
+    EXPECT_LE(metrics.polledLatencyMax, 50000u);
+}
+
+TEST_F(InputReplayerTest, AppliesTheJoystickFilter)
+{
+    recordRestAtCenter(300);
+
+    std::vector<std::string> lines = dump();
+
+    replay(lines);
+
+    // The median of 5 samples removes the periodic noise before the smoothing, apart from the first samples
+    InputReplayer medianReplayer{kCenter, 100, 256, 7680, 256, 10000, 5000};
+    medianReplayer.setJoyFilter(JoystickFilter::MEDIAN, 5);
+    replay(lines, medianReplayer);
+
+    EXPECT_GT(replayer_.getMetrics().restJitterUnsmoothed, 0u);
+    EXPECT_LT(medianReplayer.getMetrics().restJitterUnsmoothed * 10, replayer_.getMetrics().restJitterUnsmoothed);
+}
+
+TEST_F(InputReplayerTest, ShapesTheStickWithTheSelectedCurve)
+{
+    recordRestAtCenter(300);
+
+    std::vector<std::string> lines = dump();
+
+    replay(lines);
+
+    // The jitter at the center remains within the radial dead zone
+    InputReplayer deadzoneReplayer{kCenter, 100, 256, 7680, 256, 10000, 5000};
+    deadzoneReplayer.setStickProfile(StickCurve::getProfile(StickCurve::RADIAL_DEADZONE));
+    replay(lines, deadzoneReplayer);
+
+    EXPECT_GT(replayer_.getMetrics().restJitterShaped, 0u);
+    EXPECT_EQ(deadzoneReplayer.getMetrics().restJitterShaped, 0u);
+}
+
+TEST_F(InputReplayerTest, RejectsMalformedBlockLines)
+{
+    for (uint16_t sampleIdx = 0; sampleIdx < 10; ++sampleIdx)
+    {
+        recordJoystick(kCenter, kCenter);
+    }
+
+    std::vector<std::string> lines = dump();
+
+    // Truncated block line, and a line that is not a block line
+    std::string truncated = lines[1].substr(0, 100);
+
+    EXPECT_FALSE(replayer_.replayDumpLine(truncated.c_str()));
+    EXPECT_TRUE(replayer_.replayDumpLine("[I] some log line"));
+    EXPECT_EQ(replayer_.getMetrics().numJoySamples, 0u);
+}
+
+}
@@ -0,0 +1,226 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include "OneEuroFilter.h"
+#include "InputReplayer.h"
+
+namespace {
+
+// Parameters of the smoothing filter, see M5StickC_GamepadIO
+const uint16_t kMinCutoffQ8 = 256;
+const uint16_t kBetaQ8 = 7680;
+const uint16_t kDerivCutoffQ8 = 256;
+
+// Design targets of the smoothing: the jitter at rest is reduced to at most half, and the extra lag of a motion
+// stays within 10 ms, i.e. below one frame of a game running at 100 fps
+const uint8_t kJitterTargetPercent = 50;
+const uint32_t kExtraLagTargetMicros = 10000;
+
+/**
+ * The synthetic trace of the device benchmark (serial command 'o'), sampled at 500 Hz: the stick rests with
+ * +/-1 raw step of noise, moves by 100 raw steps within 50 ms and rests again.
+ */
+class OneEuroFilterTest : public ::testing::Test
+{
+    protected:
+
+        static const uint16_t kNumSamples = 600;
+        static const uint16_t kMotionStart = 300;
+        static const uint16_t kMotionSamples = 25;
+        static const uint8_t kMotionSteps = 4;
+        static const uint8_t kRestPos = 122;
+        static const uint32_t kSamplePeriodMicros = 2000;
+
+        uint16_t trace_[kNumSamples];
+
+        void SetUp() override
+        {
+            // Noise from a linear congruential generator, so that every run uses the same trace
+            uint32_t lcg = 12345;
+
+            for (uint16_t sampleIdx = 0; sampleIdx < kNumSamples; ++sampleIdx)
+            {
+                lcg = lcg * 1103515245 + 12345;
+
+                uint16_t motion = (sampleIdx < kMotionStart) ? 0 :
+                    ( (sampleIdx < kMotionStart + kMotionSamples) ? (sampleIdx - kMotionStart + 1) * kMotionSteps : kMotionSamples * kMotionSteps );
+
+                trace_[sampleIdx] = (kRestPos + motion + (int8_t) ((lcg >> 16) % 3) - 1) << 8;
+            }
+        }
+
+        /**
+         * Returns the jitter over the second half of the rest period, after the filter has settled [raw steps peak-to-peak, Q8].
+         */
+        static uint16_t jitterAtRestQ8(const uint16_t *pPath)
+        {
+            uint16_t minQ8 = 0xFFFF;
+            uint16_t maxQ8 = 0;
+
+            for (uint16_t sampleIdx = kMotionStart / 2; sampleIdx < kMotionStart; ++sampleIdx)
+            {
+                minQ8 = (pPath[sampleIdx] < minQ8) ? pPath[sampleIdx] : minQ8;
+                maxQ8 = (pPath[sampleIdx] > maxQ8) ? pPath[sampleIdx] : maxQ8;
+            }
+
+            return maxQ8 - minQ8;
+        }
+
+        /**
+         * Returns the number of samples from the start of the motion until 90 % of it have been covered.
+         */
+        static uint16_t lagSamples(const uint16_t *pPath)
+        {
+            uint16_t targetQ8 = (kRestPos << 8) + (kMotionSamples * kMotionSteps * 256) * 9 / 10;
+            uint16_t sampleIdx = kMotionStart;
+
+            while ( (sampleIdx < kNumSamples) && (pPath[sampleIdx] < targetQ8) )
+            {
+                ++sampleIdx;
+            }
+
+            return sampleIdx - kMotionStart + 1;
+        }
+};
+
+TEST_F(OneEuroFilterTest, SmoothsTheJitterAtRestWithLittleExtraLag)
+{
+    OneEuroFilter filter(kMinCutoffQ8, kBetaQ8, kDerivCutoffQ8);
+    uint16_t smoothed[kNumSamples];
+
+    for (uint16_t sampleIdx = 0; sampleIdx < kNumSamples; ++sampleIdx)
+    {
+        smoothed[sampleIdx] = filter.filter(trace_[sampleIdx], sampleIdx * kSamplePeriodMicros);
+    }
+
+    uint16_t rawJitterQ8 = jitterAtRestQ8(trace_);
+    uint16_t smoothedJitterQ8 = jitterAtRestQ8(smoothed);
+
+    std::printf("Joystick unsmoothed: jitter at rest %u/256 raw steps peak-to-peak, 90 %% of motion after %u samples\n",
+        rawJitterQ8, lagSamples(trace_));
+    std::printf("Joystick smoothed:   jitter at rest %u/256 raw steps peak-to-peak, 90 %% of motion after %u samples\n",
+        smoothedJitterQ8, lagSamples(smoothed));
+
+    // Noise of +/-1 raw step
+    EXPECT_EQ(rawJitterQ8, 2 * 256);
+    EXPECT_LE(smoothedJitterQ8, rawJitterQ8 * kJitterTargetPercent / 100);
+
+    EXPECT_LE(lagSamples(smoothed), lagSamples(trace_) + kExtraLagTargetMicros / kSamplePeriodMicros);
+
+    // Settles at the final position
+    EXPECT_NEAR(smoothed[kNumSamples - 1], (kRestPos + kMotionSamples * kMotionSteps) << 8, 256);
+}
+
+/**
+ * Host counterpart of the cycle count of the device benchmark (serial command 'o'). Reports only, the timing
+ * depends on the build type and the machine.
+ */
+TEST_F(OneEuroFilterTest, BenchmarkTimePerSample)
+{
+    static const uint16_t kNumRepetitions = 1000;
+
+    typedef std::chrono::steady_clock tClock;
+
+    OneEuroFilter filter(kMinCutoffQ8, kBetaQ8, kDerivCutoffQ8);
+
+    // Prevents the compiler from optimizing the computations away
+    volatile uint16_t sink;
+
+    tClock::time_point start = tClock::now();
+
+    for (uint16_t rep = 0; rep < kNumRepetitions; ++rep)
+    {
+        for (uint16_t sampleIdx = 0; sampleIdx < kNumSamples; ++sampleIdx)
+        {
+            sink = filter.filter(trace_[sampleIdx], (rep * kNumSamples + sampleIdx) * kSamplePeriodMicros);
+        }
+    }
+
+    double nanos = std::chrono::duration<double, std::nano>(tClock::now() - start).count();
+    uint32_t numSamples = (uint32_t) kNumRepetitions * kNumSamples;
+
+    std::printf("Joystick smoothing %u samples: %.1f ns per sample\n", numSamples, nanos / numSamples);
+
+    (void) sink;
+}
+
+TEST_F(OneEuroFilterTest, PassesTheFirstSampleAfterResetThrough)
+{
+    OneEuroFilter filter(kMinCutoffQ8, kBetaQ8, kDerivCutoffQ8);
+
+    filter.filter(trace_[0], 0);
+    filter.reset();
+
+    EXPECT_EQ(filter.filter(200 << 8, kSamplePeriodMicros), 200 << 8);
+}
+
+TEST_F(OneEuroFilterTest, IsIndependentOfTimestampWrapAround)
+{
+    OneEuroFilter filter(kMinCutoffQ8, kBetaQ8, kDerivCutoffQ8);
+    OneEuroFilter wrappedFilter(kMinCutoffQ8, kBetaQ8, kDerivCutoffQ8);
+
+    uint32_t offsetMicros = UINT32_MAX - kMotionStart * kSamplePeriodMicros;
+
+    for (uint16_t sampleIdx = 0; sampleIdx < kNumSamples; ++sampleIdx)
+    {
+        ASSERT_EQ(filter.filter(trace_[sampleIdx], sampleIdx * kSamplePeriodMicros),
+                  wrappedFilter.filter(trace_[sampleIdx], offsetMicros + sampleIdx * kSamplePeriodMicros)) << sampleIdx;
+    }
+}
+
+/**
+ * Replays the committed input session (test/data) through the smoothing and compares it with the unsmoothed path.
+ */
+TEST(OneEuroFilterReplayTest, MeetsTheDesignTargetsOnARecordedSession)
+{
+    // Parameters of the input processing of the firmware, see M5StickC_GamepadIO
+    InputReplayer replayer(122, 100, kMinCutoffQ8, kBetaQ8, kDerivCutoffQ8, 10000, 5000);
+
+    std::ifstream dump(TEST_DATA_DIR "/input_session.txt");
+    ASSERT_TRUE(dump.is_open());
+
+    std::string line;
+
+    while (std::getline(dump, line))
+    {
+        ASSERT_TRUE(replayer.replayDumpLine(line.c_str()));
+    }
+
+    InputReplayer::tMetrics metrics = replayer.getMetrics();
+
+    std::printf("Recorded session: jitter at rest unsmoothed %u, smoothed %u per sample, lag during motion %u us\n",
+        metrics.restJitterUnsmoothed, metrics.restJitterSmoothed, metrics.motionLagMicros);
+
+    ASSERT_GT(metrics.numJoySamples, 1000u);
+
+    EXPECT_LE(metrics.restJitterSmoothed, metrics.restJitterUnsmoothed * kJitterTargetPercent / 100);
+    EXPECT_LE(metrics.motionLagMicros, kExtraLagTargetMicros);
+}
+
+}
@@ -0,0 +1,196 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "ButtonReportBuilder.h"
+#include "ReportSlot.h"
+
+namespace {
+
+typedef ButtonReportBuilder<2> tBuilder;
+
+typedef struct {
+    tBuilder::tMask buttons;
+    uint32_t tick;
+} tReport;
+
+/**
+ * Link state while the report of a tick is built and while it is sent. The pattern comes from a linear
+ * congruential generator, so that every run uses the same pattern.
+ */
+class BusyLink
+{
+    public:
+
+        /**
+         * @param busyPercent Probability that the link is busy at a given point in time [%].
+         */
+        explicit BusyLink(uint32_t busyPercent, uint32_t seed = 12345)
+        : busyPercent_{busyPercent}
+        , lcg_{seed}
+        {
+        }
+
+        bool isBusy()
+        {
+            lcg_ = lcg_ * 1103515245u + 12345u;
+
+            return ((lcg_ >> 16) % 100) < busyPercent_;
+        }
+
+    private:
+
+        uint32_t busyPercent_;
+
+        uint32_t lcg_;
+};
+
+/**
+ * Runs the report loop of the app in report mode ALWAYS, i.e. a report is due every tick.
+ * Button 0 is tapped (pressed and released within the same tick) every tapPeriod ticks during the first
+ * tapTicks ticks. The remaining ticks let the pending edges drain.
+ *
+ * @param gateEdges True, if edges are only applied to reports that are sent right away.
+ * @param coalescedTaps Returns the number of taps the builder has coalesced because the reports fell behind.
+ * @return Sent reports.
+ */
+std::vector<tReport> runReportLoop(uint32_t ticks, uint32_t tapTicks, uint32_t tapPeriod, BusyLink &link,
+    bool gateEdges, uint32_t &coalescedTaps)
+{
+    tBuilder builder;
+    ReportSlot<tReport> slot;
+    std::vector<tReport> sent;
+
+    for (uint32_t tick = 0; tick < ticks; ++tick)
+    {
+        if ((tick < tapTicks) && (tick % tapPeriod == 0))
+        {
+            builder.addEdge(0);
+            builder.addEdge(0);
+        }
+
+        bool applyEdge = !gateEdges || slot.isReadyForEdges(link.isBusy());
+
+        tReport report = { applyEdge ? builder.build() : builder.getReported(), tick };
+
+        slot.offer(report);
+
+        if (slot.take(link.isBusy(), report))
+        {
+            sent.push_back(report);
+        }
+    }
+
+    coalescedTaps = builder.getCoalescedTapCount();
+
+    return sent;
+}
+
+uint32_t countPresses(const std::vector<tReport> &reports)
+{
+    uint32_t presses = 0;
+    tBuilder::tMask previous = 0;
+
+    for (const tReport &report : reports)
+    {
+        if ((report.buttons & 1) && !(previous & 1))
+        {
+            ++presses;
+        }
+
+        previous = report.buttons;
+    }
+
+    return presses;
+}
+
+const uint32_t kTicks = 11000;
+const uint32_t kTapTicks = 10000;
+const uint32_t kTapPeriod = 10;
+const uint32_t kTaps = kTapTicks / kTapPeriod;
+
+}  // namespace
+
+TEST(ReportSlotTest, LatestWins)
+{
+    ReportSlot<int> slot;
+    int report = 0;
+
+    EXPECT_FALSE(slot.offer(1));
+    EXPECT_TRUE(slot.offer(2));
+    EXPECT_FALSE(slot.take(true, report));
+    EXPECT_TRUE(slot.take(false, report));
+    EXPECT_EQ(report, 2);
+    EXPECT_FALSE(slot.isPending());
+    EXPECT_EQ(slot.getReplacedCount(), 1u);
+}
+
+TEST(ReportSlotTest, ReadyForEdgesOnlyIfSentRightAway)
+{
+    ReportSlot<int> slot;
+
+    EXPECT_TRUE(slot.isReadyForEdges(false));
+    EXPECT_FALSE(slot.isReadyForEdges(true));
+
+    slot.offer(1);
+
+    EXPECT_FALSE(slot.isReadyForEdges(false));
+
+    slot.clear();
+
+    EXPECT_TRUE(slot.isReadyForEdges(false));
+}
+
+TEST(ReportSlotTest, EveryTapIsSentWithBusyLink)
+{
+    // Taps faster than two sent reports each are coalesced by the builder on purpose, but none may vanish silently
+    for (uint32_t busyPercent : {0u, 25u, 50u, 75u, 90u})
+    {
+        BusyLink link(busyPercent);
+        uint32_t coalescedTaps = 0;
+
+        std::vector<tReport> sent = runReportLoop(kTicks, kTapTicks, kTapPeriod, link, true, coalescedTaps);
+
+        EXPECT_EQ(countPresses(sent) + coalescedTaps, kTaps) << "busy " << busyPercent << " %";
+        EXPECT_EQ(sent.back().buttons, 0u) << "busy " << busyPercent << " %";
+
+        if (busyPercent <= 25)
+        {
+            EXPECT_EQ(coalescedTaps, 0u) << "busy " << busyPercent << " %";
+        }
+    }
+}
+
+TEST(ReportSlotTest, UngatedEdgesAreLostWithBusyLink)
+{
+    // Applying an edge every tick lets a report with a release replace the pending report with the press
+    BusyLink link(50);
+    uint32_t coalescedTaps = 0;
+
+    std::vector<tReport> sent = runReportLoop(kTicks, kTapTicks, kTapPeriod, link, false, coalescedTaps);
+
+    EXPECT_EQ(coalescedTaps, 0u);
+    EXPECT_LT(countPresses(sent), kTaps);
+}
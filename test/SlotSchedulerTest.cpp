@@ -0,0 +1,178 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+
+#include "SlotScheduler.h"
+
+namespace {
+
+/**
+ * Fake clock: time only advances when the test spends it (busy time) or the scheduler sleeps.
+ */
+uint64_t fakeNowMicros = 0;
+
+// Delay between the deadline and the actual wake-up of the next sleep
+uint32_t fakeWakeLatenessMicros = 0;
+
+uint64_t fakeClock()
+{
+    return fakeNowMicros;
+}
+
+void fakeSleepUntil(uint64_t wakeTimeMicros)
+{
+    if (wakeTimeMicros > fakeNowMicros)
+    {
+        fakeNowMicros = wakeTimeMicros;
+    }
+
+    fakeNowMicros += fakeWakeLatenessMicros;
+}
+
+class SlotSchedulerTest : public ::testing::Test
+{
+    protected:
+
+        static const uint32_t kSlotMicros = 25000;
+        static const uint16_t kNumSlots = 200;
+
+        SlotScheduler scheduler_{kSlotMicros, kNumSlots, fakeClock, fakeSleepUntil};
+
+        void SetUp() override
+        {
+            fakeNowMicros = 1000000;
+            fakeWakeLatenessMicros = 0;
+            scheduler_.start();
+        }
+};
+
+TEST_F(SlotSchedulerTest, BusyTimeDoesNotAccumulateAsDrift)
+{
+    const uint64_t startMicros = fakeNowMicros;
+    const uint32_t periodMicros = 5000;
+
+    scheduler_.setTickPeriodMicros(periodMicros);
+
+    for (uint32_t tick = 1; tick <= 10000; ++tick)
+    {
+        fakeNowMicros += 1000 + (tick % 7) * 300;
+        scheduler_.waitForNextTick();
+
+        ASSERT_EQ(fakeNowMicros, startMicros + (uint64_t) tick * periodMicros);
+    }
+
+    EXPECT_EQ(scheduler_.getOverrunCount(), 0u);
+    EXPECT_EQ(scheduler_.getJitterMaxMicros(), 0u);
+    EXPECT_EQ(scheduler_.getBusyMaxMicros(), 1000u + 6 * 300);
+}
+
+TEST_F(SlotSchedulerTest, WakeLatenessShowsAsJitterButNotAsDrift)
+{
+    const uint64_t startMicros = fakeNowMicros;
+    const uint32_t periodMicros = 5000;
+
+    scheduler_.setTickPeriodMicros(periodMicros);
+
+    for (uint32_t tick = 1; tick <= 1000; ++tick)
+    {
+        // Alternate between late and punctual wake-ups
+        fakeWakeLatenessMicros = (tick % 2) ? 300 : 0;
+
+        fakeNowMicros += 500;
+        scheduler_.waitForNextTick();
+
+        ASSERT_EQ(scheduler_.getLatenessMicros(), fakeWakeLatenessMicros);
+        ASSERT_EQ(fakeNowMicros, startMicros + (uint64_t) tick * periodMicros + fakeWakeLatenessMicros);
+    }
+
+    EXPECT_EQ(scheduler_.getJitterMaxMicros(), 300u);
+    EXPECT_EQ(scheduler_.getOverrunCount(), 0u);
+}
+
+TEST_F(SlotSchedulerTest, OverrunSkipsMissedTicksAndKeepsPhase)
+{
+    const uint64_t startMicros = fakeNowMicros;
+    const uint32_t periodMicros = 5000;
+
+    scheduler_.setTickPeriodMicros(periodMicros);
+
+    // The first tick takes 2.4 periods: deadlines 1 and 2 have passed, 2 is missed completely
+    fakeNowMicros += 12000;
+    scheduler_.waitForNextTick();
+
+    EXPECT_TRUE(scheduler_.hasOverrun());
+    EXPECT_EQ(scheduler_.getOverrunCount(), 1u);
+    EXPECT_EQ(scheduler_.getSkippedTickCount(), 1u);
+
+    // The next tick starts immediately, the one after it on the original grid
+    EXPECT_EQ(fakeNowMicros, startMicros + 12000);
+
+    fakeNowMicros += 100;
+    scheduler_.waitForNextTick();
+
+    EXPECT_FALSE(scheduler_.hasOverrun());
+    EXPECT_EQ(fakeNowMicros, startMicros + 3 * periodMicros);
+}
+
+TEST_F(SlotSchedulerTest, SlotsFollowDeadlinesRegardlessOfTickPeriod)
+{
+    // Tick period 100 ms: every tick covers 4 slots, hence a sub function due every 20 slots runs every 5 ticks
+    scheduler_.setTickPeriodMicros(4 * kSlotMicros);
+
+    uint32_t dueCount = 0;
+
+    for (uint32_t tick = 0; tick < 100; ++tick)
+    {
+        scheduler_.waitForNextTick();
+
+        if (scheduler_.isSlotDue(20, 1))
+        {
+            ++dueCount;
+        }
+    }
+
+    // 100 ticks cover 400 slots, i.e. 20 slots of the form 20 * n + 1
+    EXPECT_EQ(dueCount, 20u);
+
+    // Tick period 5 ms: a slot begins in every fifth tick only
+    scheduler_.setTickPeriodMicros(kSlotMicros / 5);
+
+    uint32_t slotChanges = 0;
+    uint16_t prevSlotNr = scheduler_.getSlotNr();
+
+    for (uint32_t tick = 0; tick < 50; ++tick)
+    {
+        uint16_t slotNr = scheduler_.waitForNextTick();
+
+        if (slotNr != prevSlotNr)
+        {
+            ++slotChanges;
+        }
+
+        prevSlotNr = slotNr;
+    }
+
+    EXPECT_EQ(slotChanges, 10u);
+}
+
+}
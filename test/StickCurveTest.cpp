@@ -0,0 +1,235 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+
+#include "StickCurve.h"
+
+namespace {
+
+StickCurve::tProfile profileAt(uint8_t profile)
+{
+    return (StickCurve::tProfile) profile;
+}
+
+TEST(StickCurveTest, TablesMatchTheReferenceCurves)
+{
+    for (uint8_t profile = 0; profile < StickCurve::kNumProfiles; ++profile)
+    {
+        const StickCurve::tProfileDef *pProfile = StickCurve::getProfile(profileAt(profile));
+
+        for (int16_t x = -128; x < 128; ++x)
+        {
+            ASSERT_EQ(pProfile->pLut->values[x + 128], StickCurve::computeValue(profileAt(profile), x))
+                << StickCurve::getProfileName(profileAt(profile)) << " at " << x;
+        }
+    }
+}
+
+TEST(StickCurveTest, FloatMathMatchesTheReferenceCurves)
+{
+    for (uint8_t profile = 0; profile < StickCurve::kNumProfiles; ++profile)
+    {
+        for (int16_t x = -128; x < 128; ++x)
+        {
+            ASSERT_NEAR(StickCurve::computeValueFloat(profileAt(profile), x), StickCurve::computeValue(profileAt(profile), x), 2)
+                << StickCurve::getProfileName(profileAt(profile)) << " at " << x;
+        }
+    }
+}
+
+TEST(StickCurveTest, CurvesAreMonotonicAndSaturate)
+{
+    for (uint8_t profile = 0; profile < StickCurve::kNumProfiles; ++profile)
+    {
+        const StickCurve::tProfileDef *pProfile = StickCurve::getProfile(profileAt(profile));
+
+        EXPECT_EQ(pProfile->pLut->values[128], 0);
+        EXPECT_EQ(pProfile->pLut->values[128 + StickCurve::kSaturation], (int16_t) StickCurve::kOutputMax);
+        EXPECT_EQ(pProfile->pLut->values[0], -(int16_t) StickCurve::kOutputMax);
+
+        for (uint16_t idx = 1; idx < StickCurve::kLutSize; ++idx)
+        {
+            ASSERT_GE(pProfile->pLut->values[idx], pProfile->pLut->values[idx - 1])
+                << StickCurve::getProfileName(profileAt(profile)) << " at " << idx;
+        }
+    }
+}
+
+TEST(StickCurveTest, RadialDeadzoneSuppressesBothAxes)
+{
+    const StickCurve::tProfileDef *pProfile = StickCurve::getProfile(StickCurve::RADIAL_DEADZONE);
+    int16_t outX, outY;
+
+    // Inside the circle, although each axis alone is beyond the axial dead zone of the linear curve
+    StickCurve::apply(pProfile, 7 * 256, -7 * 256, outX, outY);
+    EXPECT_EQ(outX, 0);
+    EXPECT_EQ(outY, 0);
+
+    // Outside the circle, the vertical axis still follows the curve
+    StickCurve::apply(pProfile, 20 * 256, 0, outX, outY);
+    EXPECT_GT(outX, 0);
+    EXPECT_EQ(outY, 0);
+
+    // Diagonal just outside the circle: no axis is suppressed on its own, i.e. the dead zone is not a cross
+    StickCurve::apply(pProfile, 8 * 256, -7 * 256, outX, outY);
+    EXPECT_GT(outX, 0);
+    EXPECT_LT(outY, 0);
+
+    StickCurve::apply(pProfile, 60 * 256, 10 * 256, outX, outY);
+    EXPECT_GT(outY, 0);
+
+    // The direction is preserved
+    StickCurve::apply(pProfile, 40 * 256, 30 * 256, outX, outY);
+    EXPECT_NEAR(outX * 3.0 / (outY * 4.0), 1.0, 0.01);
+
+    // The output rises from 0 at the circle and still saturates
+    StickCurve::apply(pProfile, 11 * 256, 0, outX, outY);
+    EXPECT_LT(outX, 2 * StickCurve::kOutputMax / StickCurve::kSaturation);
+
+    StickCurve::apply(pProfile, -128 * 256, 127 * 256, outX, outY);
+    EXPECT_EQ(outX, -(int16_t) StickCurve::kOutputMax);
+    EXPECT_EQ(outY, (int16_t) StickCurve::kOutputMax);
+}
+
+TEST(StickCurveTest, InterpolationHitsTheTableEntries)
+{
+    for (uint8_t profile = 0; profile < StickCurve::kNumProfiles; ++profile)
+    {
+        const StickCurve::tProfileDef *pProfile = StickCurve::getProfile(profileAt(profile));
+        int16_t outX, outY;
+
+        // The radial dead zone rescales the axes before the table lookup
+        if (pProfile->radialDeadzone > 0)
+        {
+            continue;
+        }
+
+        for (int16_t x = -128; x < 128; ++x)
+        {
+            StickCurve::apply(pProfile, x * 256, 127 * 256, outX, outY);
+
+            ASSERT_EQ(outX, pProfile->pLut->values[x + 128]) << StickCurve::getProfileName(profileAt(profile)) << " at " << x;
+        }
+    }
+}
+
+TEST(StickCurveTest, InterpolationPreservesTheFractionalResolution)
+{
+    const StickCurve::tProfileDef *pProfile = StickCurve::getProfile(StickCurve::LINEAR);
+    int16_t outX, outY;
+    int32_t prevOut = -StickCurve::kOutputMax;
+    uint32_t numDistinct = 0;
+
+    for (int32_t axis = -32768; axis <= 32767; ++axis)
+    {
+        StickCurve::apply(pProfile, axis, 0, outX, outY);
+
+        // Monotonic, and each step of the input changes the output by at most one step of the table / 256
+        ASSERT_GE(outX, prevOut) << axis;
+        ASSERT_LE(outX - prevOut, StickCurve::kOutputMax / StickCurve::kSaturation / 256 + 1) << axis;
+
+        numDistinct += (outX != prevOut) ? 1 : 0;
+        prevOut = outX;
+    }
+
+    // Without interpolation, the output would only take one value per table entry
+    EXPECT_GT(numDistinct, 32u * StickCurve::kLutSize);
+}
+
+TEST(StickCurveTest, InterpolationIsMonotonicForEveryProfile)
+{
+    for (uint8_t profile = 0; profile < StickCurve::kNumProfiles; ++profile)
+    {
+        const StickCurve::tProfileDef *pProfile = StickCurve::getProfile(profileAt(profile));
+        int16_t outX, outY;
+        int16_t prevOut = -StickCurve::kOutputMax;
+
+        for (int32_t axis = -32768; axis <= 32767; ++axis)
+        {
+            StickCurve::apply(pProfile, axis, 127 * 256, outX, outY);
+
+            ASSERT_GE(outX, prevOut) << StickCurve::getProfileName(profileAt(profile)) << " at " << axis;
+            prevOut = outX;
+        }
+
+        EXPECT_EQ(prevOut, (int16_t) StickCurve::kOutputMax);
+    }
+}
+
+/**
+ * Host counterpart of the device benchmark (serial command 'b'): times shaping all stick positions via the
+ * lookup tables and via single precision floating point math. Reports only, the timing depends on the build type
+ * and the machine.
+ */
+TEST(StickCurveTest, BenchmarkTableAgainstFloatMath)
+{
+    static const uint16_t kNumRepetitions = 2000;
+
+    typedef std::chrono::steady_clock tClock;
+
+    // Prevents the compiler from optimizing the computations away
+    volatile int16_t sink;
+
+    for (uint8_t profile = 0; profile < StickCurve::kNumProfiles; ++profile)
+    {
+        const StickCurve::tProfileDef *pProfile = StickCurve::getProfile(profileAt(profile));
+        int16_t outX, outY;
+
+        tClock::time_point start = tClock::now();
+
+        for (uint16_t rep = 0; rep < kNumRepetitions; ++rep)
+        {
+            for (int16_t x = -128; x < 128; ++x)
+            {
+                StickCurve::apply(pProfile, x * 256, 0, outX, outY);
+                sink = outX;
+            }
+        }
+
+        double lutNanos = std::chrono::duration<double, std::nano>(tClock::now() - start).count();
+
+        start = tClock::now();
+
+        for (uint16_t rep = 0; rep < kNumRepetitions; ++rep)
+        {
+            for (int16_t x = -128; x < 128; ++x)
+            {
+                sink = StickCurve::computeValueFloat(profileAt(profile), x);
+            }
+        }
+
+        double floatNanos = std::chrono::duration<double, std::nano>(tClock::now() - start).count();
+
+        uint32_t numEvaluations = kNumRepetitions * StickCurve::kLutSize;
+
+        std::printf("Stick curve %-16s %u evaluations: LUT %.1f ns, float math %.1f ns per evaluation\n",
+            StickCurve::getProfileName(profileAt(profile)), numEvaluations, lutNanos / numEvaluations, floatNanos / numEvaluations);
+    }
+
+    (void) sink;
+}
+
+}
@@ -0,0 +1,273 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "InputReplayer.h"
+
+#include <stdlib.h>
+
+InputReplayer::InputReplayer(uint8_t center, uint8_t halfRange, uint16_t minCutoffQ8, uint16_t betaQ8, uint16_t derivCutoffQ8,
+                             uint32_t lockoutMicros, uint32_t pollMicros)
+: mapper_{ {center, halfRange, false}, {center, halfRange, true} }
+, filter_{ {minCutoffQ8, betaQ8, derivCutoffQ8}, {minCutoffQ8, betaQ8, derivCutoffQ8} }
+, edgeDebouncer_{ EdgeDebouncer{lockoutMicros}, EdgeDebouncer{lockoutMicros}, EdgeDebouncer{lockoutMicros},
+                  EdgeDebouncer{lockoutMicros}, EdgeDebouncer{lockoutMicros}, EdgeDebouncer{lockoutMicros} }
+, pollMicros_{pollMicros}
+{
+}
+
+void InputReplayer::setJoyFilter(JoystickFilter::tFilterType type, uint8_t windowSize)
+{
+    joyFilterType_ = type;
+    joyFilterWindowSize_ = (windowSize > kJoyRingSize) ? kJoyRingSize : windowSize;
+}
+
+static int8_t hexValue(char c)
+{
+    if ( (c >= '0') && (c <= '9') )
+    {
+        return c - '0';
+    }
+
+    if ( (c >= 'a') && (c <= 'f') )
+    {
+        return c - 'a' + 10;
+    }
+
+    if ( (c >= 'A') && (c <= 'F') )
+    {
+        return c - 'A' + 10;
+    }
+
+    return -1;
+}
+
+bool InputReplayer::replayDumpLine(const char *line)
+{
+    if ( (line[0] != 'B') || (line[1] != ' ') )
+    {
+        return true;
+    }
+
+    uint8_t block[InputTrace::kBlockSize];
+
+    for (uint16_t byteIdx = 0; byteIdx < InputTrace::kBlockSize; ++byteIdx)
+    {
+        int8_t high = hexValue(line[2 + 2 * byteIdx]);
+        int8_t low = (high < 0) ? -1 : hexValue(line[3 + 2 * byteIdx]);
+
+        if (low < 0)
+        {
+            return false;
+        }
+
+        block[byteIdx] = (high << 4) | low;
+    }
+
+    replayBlock(block);
+
+    return true;
+}
+
+void InputReplayer::replayBlock(const uint8_t *pBlock)
+{
+    InputTrace::BlockReader reader(pBlock);
+    InputTrace::tRecord record;
+
+    while (reader.next(record))
+    {
+        replayRecord(record);
+    }
+}
+
+void InputReplayer::replayRecord(const InputTrace::tRecord &record)
+{
+    if (!started_)
+    {
+        started_ = true;
+        btnLevels_ = record.btnLevels;
+        nextPollMicros_ = record.micros;
+    }
+
+    pollButtonsUntil(record.micros);
+
+    if (record.type == InputTrace::JOYSTICK)
+    {
+        replayJoystick(record);
+    }
+
+    uint8_t changed = record.btnLevels ^ btnLevels_;
+
+    for (uint8_t btnIdx = 0; btnIdx < InputTrace::kMaxButtons; ++btnIdx)
+    {
+        bool pressed = (record.btnLevels >> btnIdx) & 1;
+
+        if ((changed >> btnIdx) & 1)
+        {
+            edgeDebouncer_[btnIdx].onEdge(pressed, record.micros);
+            ++numBtnChanges_;
+
+            if (pressed)
+            {
+                pressChangeMicros_[btnIdx] = record.micros;
+                pressChangePending_ |= 1 << btnIdx;
+            }
+        }
+        else
+        {
+            edgeDebouncer_[btnIdx].poll(pressed, record.micros);
+        }
+    }
+
+    btnLevels_ = record.btnLevels;
+}
+
+void InputReplayer::replayJoystick(const InputTrace::tRecord &record)
+{
+    uint8_t raw[kNumAxes] = {record.rawX, record.rawY};
+    uint8_t prevRaw[kNumAxes] = {prevJoy_.rawX, prevJoy_.rawY};
+
+    bool rest = true;
+    uint32_t unsmoothedChange = 0;
+    uint32_t smoothedChange = 0;
+    uint32_t shapedChange = 0;
+    uint32_t lag = 0;
+
+    joyRingNewestIdx_ = (joyRingNewestIdx_ + 1) % kJoyRingSize;
+
+    if (joyRingNumSamples_ < kJoyRingSize)
+    {
+        ++joyRingNumSamples_;
+    }
+
+    int16_t smoothed[kNumAxes];
+
+    for (uint8_t axis = 0; axis < kNumAxes; ++axis)
+    {
+        joyRing_[axis][joyRingNewestIdx_] = raw[axis];
+
+        uint8_t filtered = (joyRingNumSamples_ >= joyFilterWindowSize_)
+            ? JoystickFilter::apply(joyFilterType_, joyRing_[axis], kJoyRingSize, joyRingNewestIdx_, joyFilterWindowSize_)
+            : raw[axis];
+
+        mapper_[axis].learn(filtered);
+
+        int16_t unsmoothed = mapper_[axis].map(filtered);
+        smoothed[axis] = mapper_[axis].mapQ8(filter_[axis].filter(filtered << 8, record.micros));
+
+        rest = rest && (abs(raw[axis] - prevRaw[axis]) <= 1);
+        unsmoothedChange += abs(unsmoothed - prevUnsmoothed_[axis]);
+        smoothedChange += abs(smoothed[axis] - prevSmoothed_[axis]);
+        lag += abs(smoothed[axis] - unsmoothed);
+
+        prevUnsmoothed_[axis] = unsmoothed;
+        prevSmoothed_[axis] = smoothed[axis];
+    }
+
+    int16_t shaped[kNumAxes];
+
+    StickCurve::apply(pStickProfile_, smoothed[0], smoothed[1], shaped[0], shaped[1]);
+
+    for (uint8_t axis = 0; axis < kNumAxes; ++axis)
+    {
+        shapedChange += abs(shaped[axis] - prevShaped_[axis]);
+        prevShaped_[axis] = shaped[axis];
+    }
+
+    if (hasPrevJoy_)
+    {
+        joyPeriod_.record(record.micros - prevJoy_.micros);
+
+        if (rest)
+        {
+            ++numRestSamples_;
+            restJitterUnsmoothedSum_ += unsmoothedChange;
+            restJitterSmoothedSum_ += smoothedChange;
+            restJitterShapedSum_ += shapedChange;
+        }
+        else
+        {
+            ++numMotionSamples_;
+            motionLagSum_ += lag;
+            motionChangeSum_ += unsmoothedChange;
+            motionPeriodSum_ += record.micros - prevJoy_.micros;
+        }
+    }
+
+    prevJoy_ = record;
+    hasPrevJoy_ = true;
+    ++numJoySamples_;
+}
+
+void InputReplayer::pollButtonsUntil(uint32_t micros)
+{
+    while ((int32_t) (micros - nextPollMicros_) > 0)
+    {
+        polledDebouncer_.update(btnLevels_);
+
+        for (BitSlicedDebouncer<InputTrace::kMaxButtons>::tMask pending = polledDebouncer_.getDownEvents(); pending != 0; pending &= pending - 1)
+        {
+            uint8_t btnIdx = __builtin_ctz(pending);
+
+            ++numPressesPolled_;
+
+            // Presses that started before the trace have no latency
+            if ((pressChangePending_ >> btnIdx) & 1)
+            {
+                polledLatency_.record(nextPollMicros_ - pressChangeMicros_[btnIdx]);
+                pressChangePending_ &= ~(1 << btnIdx);
+            }
+        }
+
+        nextPollMicros_ += pollMicros_;
+    }
+}
+
+InputReplayer::tMetrics InputReplayer::getMetrics() const
+{
+    tMetrics metrics;
+
+    metrics.numJoySamples = numJoySamples_;
+    metrics.numBtnChanges = numBtnChanges_;
+
+    metrics.joyPeriodP50 = joyPeriod_.getPercentile(50);
+    metrics.joyPeriodP99 = joyPeriod_.getPercentile(99);
+    metrics.joyPeriodMax = joyPeriod_.getMax();
+
+    metrics.restJitterUnsmoothed = (numRestSamples_ > 0) ? (uint32_t) (restJitterUnsmoothedSum_ / numRestSamples_) : 0;
+    metrics.restJitterSmoothed = (numRestSamples_ > 0) ? (uint32_t) (restJitterSmoothedSum_ / numRestSamples_) : 0;
+    metrics.restJitterShaped = (numRestSamples_ > 0) ? (uint32_t) (restJitterShapedSum_ / numRestSamples_) : 0;
+    metrics.motionLag = (numMotionSamples_ > 0) ? (uint32_t) (motionLagSum_ / numMotionSamples_) : 0;
+    metrics.motionLagMicros = (motionChangeSum_ > 0) ? (uint32_t) (motionLagSum_ * motionPeriodSum_ / (motionChangeSum_ * numMotionSamples_)) : 0;
+
+    metrics.numPressesEdge = 0;
+
+    for (uint8_t btnIdx = 0; btnIdx < InputTrace::kMaxButtons; ++btnIdx)
+    {
+        metrics.numPressesEdge += edgeDebouncer_[btnIdx].getPressCount();
+    }
+
+    metrics.numPressesPolled = numPressesPolled_;
+    metrics.polledLatencyP50 = polledLatency_.getPercentile(50);
+    metrics.polledLatencyMax = polledLatency_.getMax();
+
+    return metrics;
+}
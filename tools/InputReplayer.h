@@ -0,0 +1,214 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "InputTrace.h"
+#include "JoystickFilter.h"
+#include "OneEuroFilter.h"
+#include "AxisMapper.h"
+#include "StickCurve.h"
+#include "EdgeDebouncer.h"
+#include "BitSlicedDebouncer.h"
+#include "LatencyHistogram.h"
+
+/**
+ * Replays a recorded input trace through the input processing and computes latency and jitter metrics.
+ *
+ * The trace is fed as the lines of a serial dump (see M5StickC_GamepadIO::dumpInputRecording()) or as
+ * blocks. Joystick samples pass through the joystick filter over the newest raw samples (acquisition mode
+ * SAMPLED, off by default), the smoothing filter, the axis mapping and the stick curve. Button level changes
+ * pass through both debouncers: the leading-edge debouncer (capture mode INTERRUPT) and the bit-sliced
+ * debouncer sampled on a grid of pollMicros (capture mode POLLED).
+ *
+ * Only the Arduino-independent classes are involved, so the replayer is built on a host computer (tool
+ * replay_trace, see test/CMakeLists.txt), e.g. to compare the metrics of two firmware revisions on the same
+ * trace. It is not part of the firmware. The joystick range is learned as on the device, whereas the center
+ * is fixed, i.e. the center calibration is not replayed. Every sample is processed, whereas process() on the
+ * device only takes the newest sample of each call.
+ *
+ * The class does not depend on the Arduino framework.
+ */
+class InputReplayer
+{
+    public:
+
+        /**
+         * Metrics of the replayed trace. Stick values are normalized (-32767..32767).
+         */
+        typedef struct {
+            uint32_t numJoySamples;
+            uint32_t numBtnChanges;
+
+            // Time between two joystick samples [us]
+            uint32_t joyPeriodP50;
+            uint32_t joyPeriodP99;
+            uint32_t joyPeriodMax;
+
+            // Mean change of the stick value per sample at rest (raw values change by at most 1 step), both axes
+            uint32_t restJitterUnsmoothed;
+            uint32_t restJitterSmoothed;
+
+            // Mean change of the stick value after the stick curve per sample at rest, both axes
+            uint32_t restJitterShaped;
+
+            // Mean deviation of the smoothed from the unsmoothed stick value during motion
+            uint32_t motionLag;
+
+            // Mean deviation during motion divided by the mean speed of the unsmoothed stick value, i.e. the
+            // deviation expressed as a delay [us]
+            uint32_t motionLagMicros;
+
+            // Presses detected by the leading-edge and by the polled debouncer
+            uint32_t numPressesEdge;
+            uint32_t numPressesPolled;
+
+            // Time from the first level change of a press to its detection by the polled debouncer [us]
+            uint32_t polledLatencyP50;
+            uint32_t polledLatencyMax;
+        } tMetrics;
+
+        /**
+         * @param center, halfRange Raw center and half range of the joystick axes.
+         *
+         * @param minCutoffQ8, betaQ8, derivCutoffQ8 Parameters of the smoothing filter, see OneEuroFilter.
+         *
+         * @param lockoutMicros Lockout window of the leading-edge debouncer [us].
+         *
+         * @param pollMicros Sample period of the polled debouncer [us].
+         */
+        InputReplayer(uint8_t center, uint8_t halfRange, uint16_t minCutoffQ8, uint16_t betaQ8, uint16_t derivCutoffQ8,
+                      uint32_t lockoutMicros, uint32_t pollMicros);
+
+        /**
+         * Selects the joystick filter applied to the newest raw samples, see JoystickFilter.
+         *
+         * @param windowSize Number of samples (1 = off, at most kJoyRingSize).
+         */
+        void setJoyFilter(JoystickFilter::tFilterType type, uint8_t windowSize);
+
+        /**
+         * Selects the stick curve. Default is LINEAR.
+         */
+        inline void setStickProfile(const StickCurve::tProfileDef *pProfile)
+        {
+            pStickProfile_ = pProfile;
+        }
+
+        /**
+         * Replays a line of a serial dump. Lines other than block lines ("B <hex>") are ignored.
+         *
+         * @return False, if the line is a malformed block line.
+         */
+        bool replayDumpLine(const char *line);
+
+        /**
+         * Replays a block of a trace. The blocks must be replayed in the order of recording.
+         */
+        void replayBlock(const uint8_t *pBlock);
+
+        /**
+         * Returns the metrics of all records replayed so far.
+         */
+        tMetrics getMetrics() const;
+
+        // Number of raw samples kept for the joystick filter, as in M5StickC_GamepadIO
+        static const uint8_t kJoyRingSize = 8;
+
+    private:
+
+        static const uint8_t kNumAxes = 2;
+
+        JoystickFilter::tFilterType joyFilterType_ = JoystickFilter::MEDIAN;
+
+        uint8_t joyFilterWindowSize_ = 1;
+
+        // Newest raw samples per axis
+        uint8_t joyRing_[kNumAxes][kJoyRingSize] = {{0}};
+
+        uint8_t joyRingNewestIdx_ = 0;
+
+        uint8_t joyRingNumSamples_ = 0;
+
+        const StickCurve::tProfileDef *pStickProfile_ = StickCurve::getProfile(StickCurve::LINEAR);
+
+        AxisMapper mapper_[kNumAxes];
+
+        OneEuroFilter filter_[kNumAxes];
+
+        EdgeDebouncer edgeDebouncer_[InputTrace::kMaxButtons];
+
+        BitSlicedDebouncer<InputTrace::kMaxButtons> polledDebouncer_;
+
+        uint32_t pollMicros_;
+
+        bool started_ = false;
+
+        // Previous joystick record
+        InputTrace::tRecord prevJoy_ = {};
+
+        bool hasPrevJoy_ = false;
+
+        int16_t prevUnsmoothed_[kNumAxes] = {0};
+
+        int16_t prevSmoothed_[kNumAxes] = {0};
+
+        int16_t prevShaped_[kNumAxes] = {0};
+
+        // Button levels before the current record and time of the next poll of the polled debouncer
+        uint8_t btnLevels_ = 0;
+
+        uint32_t nextPollMicros_ = 0;
+
+        // Time of the most recent change to "pressed" per button [us]
+        uint32_t pressChangeMicros_[InputTrace::kMaxButtons] = {0};
+
+        // Buttons with a change to "pressed" that the polled debouncer has not detected yet
+        uint8_t pressChangePending_ = 0;
+
+        uint32_t numJoySamples_ = 0;
+        uint32_t numBtnChanges_ = 0;
+        uint32_t numRestSamples_ = 0;
+        uint32_t numMotionSamples_ = 0;
+        uint64_t restJitterUnsmoothedSum_ = 0;
+        uint64_t restJitterSmoothedSum_ = 0;
+        uint64_t restJitterShapedSum_ = 0;
+        uint64_t motionLagSum_ = 0;
+        uint64_t motionChangeSum_ = 0;
+        uint64_t motionPeriodSum_ = 0;
+        uint32_t numPressesPolled_ = 0;
+
+        LatencyHistogram joyPeriod_;
+
+        LatencyHistogram polledLatency_;
+
+        void replayRecord(const InputTrace::tRecord &record);
+
+        void replayJoystick(const InputTrace::tRecord &record);
+
+        /**
+         * Samples the button levels for the polled debouncer up to (excluding) the given time.
+         */
+        void pollButtonsUntil(uint32_t micros);
+};
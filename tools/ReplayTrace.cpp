@@ -0,0 +1,114 @@
+/**
+    M5StickC_GamepadApp:
+    This application has been developed to use an M5StickC device (ESP32)
+    as bluetooth gamepad input device. It reads a joystick position and
+    button status and provides these data via Bluetooth Low Energy (BLE)
+    using the Human Interface Device (HID) via GATT protocol.
+    Copyright (C) 2020 by Ernst Sikora
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "InputReplayer.h"
+
+/*
+ * Replays a serial dump of an input recording (serial commands 'i' and 'd') on a host computer and prints the
+ * metrics of the input processing, see InputReplayer.
+ *
+ * Usage: replay_trace [dump file], reads the standard input if no file is given.
+ * The dump may be embedded in a log with other lines and prefixed by timestamps (monitor filter "time").
+ */
+
+// Parameters of the input processing of the firmware, see M5StickC_GamepadIO
+static const uint8_t kJoyNominalCenter = 122;
+static const uint8_t kJoyDefaultHalfRange = 100;
+static const uint16_t kJoySmoothingMinCutoffQ8 = 256;
+static const uint16_t kJoySmoothingBetaQ8 = 7680;
+static const uint16_t kJoySmoothingDerivCutoffQ8 = 256;
+static const uint32_t kBtnLockoutMicros = 10000;
+static const uint32_t kBtnPollMicros = 5000;
+
+// Joystick filter and stick curve selected by M5StickC_GamepadApp
+static const uint8_t kJoyFilterWindowSize = 5;
+static const StickCurve::tProfile kStickProfile = StickCurve::RADIAL_DEADZONE;
+
+int main(int argc, char **argv)
+{
+    FILE *pFile = (argc > 1) ? fopen(argv[1], "r") : stdin;
+
+    if (pFile == nullptr)
+    {
+        fprintf(stderr, "Cannot open %s\n", argv[1]);
+        return 1;
+    }
+
+    InputReplayer replayer(kJoyNominalCenter, kJoyDefaultHalfRange, kJoySmoothingMinCutoffQ8, kJoySmoothingBetaQ8,
+                           kJoySmoothingDerivCutoffQ8, kBtnLockoutMicros, kBtnPollMicros);
+
+    replayer.setJoyFilter(JoystickFilter::MEDIAN, kJoyFilterWindowSize);
+    replayer.setStickProfile(StickCurve::getProfile(kStickProfile));
+
+    // A block line holds "B " and 2 hex digits per byte
+    static char line[4 * InputTrace::kBlockSize];
+
+    uint32_t numBlocks = 0;
+    uint32_t numMalformed = 0;
+
+    while (fgets(line, sizeof(line), pFile) != nullptr)
+    {
+        // Block lines start with "B ", or with "> B " after a timestamp
+        const char *pBlockLine = (strncmp(line, "B ", 2) == 0) ? line : strstr(line, "> B ");
+
+        if (pBlockLine == nullptr)
+        {
+            continue;
+        }
+
+        if (pBlockLine != line)
+        {
+            pBlockLine += 2;
+        }
+
+        if (replayer.replayDumpLine(pBlockLine))
+        {
+            ++numBlocks;
+        }
+        else
+        {
+            ++numMalformed;
+        }
+    }
+
+    if (pFile != stdin)
+    {
+        fclose(pFile);
+    }
+
+    InputReplayer::tMetrics metrics = replayer.getMetrics();
+
+    printf("Blocks replayed:             %u (%u malformed lines skipped)\n", numBlocks, numMalformed);
+    printf("Joystick samples:            %u\n", metrics.numJoySamples);
+    printf("Joystick sample period:      p50 %u us, p99 %u us, max %u us\n", metrics.joyPeriodP50, metrics.joyPeriodP99, metrics.joyPeriodMax);
+    printf("Stick jitter at rest:        unsmoothed %u, smoothed %u, after the %s curve %u per sample\n", metrics.restJitterUnsmoothed,
+        metrics.restJitterSmoothed, StickCurve::getProfileName(kStickProfile), metrics.restJitterShaped);
+    printf("Smoothing lag during motion: %u (%u us)\n", metrics.motionLag, metrics.motionLagMicros);
+    printf("Button level changes:        %u\n", metrics.numBtnChanges);
+    printf("Button presses:              leading-edge %u, polled %u\n", metrics.numPressesEdge, metrics.numPressesPolled);
+    printf("Polled press latency:        p50 %u us, max %u us\n", metrics.polledLatencyP50, metrics.polledLatencyMax);
+
+    return (numMalformed > 0) ? 2 : 0;
+}